@@ -123,6 +123,9 @@ class TAeaOutput : public ICompressedOutput, public TAeaCommon {
 public:
     TAeaOutput(const string& filename, const string& title, size_t numChannel, uint32_t numFrames);
     void WriteFrame(vector<char> data) override;
+    void Flush() override {
+        fflush(Meta.AeaFile);
+    }
 
     size_t GetChannelNum() const override {
         return TAeaCommon::GetChannelNum();
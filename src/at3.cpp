@@ -142,6 +142,10 @@ public:
         }
     }
 
+    void Flush() override {
+        fflush(fp);
+    }
+
     std::string GetName() const override {
         return {};
     }
@@ -22,6 +22,7 @@
 #include <array>
 #include <map>
 #include <math.h>
+#include "atrac/atrac_speed.h"
 
 namespace NBitStream {
     class TBitStream;
@@ -41,19 +42,45 @@ private:
     const bool FastBfuNumSearch = false;
     EWindowMode WindowMode = EWindowMode::EWM_AUTO;
     const uint32_t WindowMask = 0;
+    // Start bit allocation search from the previous sound unit solution
+    const bool WarmRateControl = false;
+    const ESpeed Speed = ESpeed::Default;
+    // Process channels of a stereo frame on two threads
+    const bool ParallelChannels = false;
+    // Write a precomputed frame for silence instead of encoding it
+    const bool SkipSilence = true;
 public:
     TAtrac1EncodeSettings()
     {}
-    TAtrac1EncodeSettings(uint32_t bfuIdxConst, bool fastBfuNumSearch, EWindowMode windowMode, uint32_t windowMask)
+    TAtrac1EncodeSettings(uint32_t bfuIdxConst, bool fastBfuNumSearch, EWindowMode windowMode, uint32_t windowMask,
+                          bool warmRateControl = false, ESpeed speed = ESpeed::Default,
+                          bool parallelChannels = false, bool skipSilence = true)
         : BfuIdxConst(bfuIdxConst)
-        , FastBfuNumSearch(fastBfuNumSearch)
+        , FastBfuNumSearch(fastBfuNumSearch || speed <= ESpeed::Fast)
         , WindowMode(windowMode)
         , WindowMask(windowMask)
+        , WarmRateControl(warmRateControl || speed <= ESpeed::Fast)
+        , Speed(speed)
+        , ParallelChannels(parallelChannels)
+        , SkipSilence(skipSilence)
     {}
     uint32_t GetBfuIdxConst() const { return BfuIdxConst; }
     bool GetFastBfuNumSearch() const { return FastBfuNumSearch; }
     EWindowMode GetWindowMode() const {return WindowMode; }
     uint32_t GetWindowMask() const {return WindowMask; }
+    bool GetWarmRateControl() const { return WarmRateControl; }
+    ESpeed GetSpeed() const { return Speed; }
+    bool GetParallelChannels() const { return ParallelChannels; }
+    bool GetSkipSilence() const { return SkipSilence; }
+    // Width of the bit allocation shift range at which the search stops
+    float GetShiftPrecision() const {
+        switch (Speed) {
+            case ESpeed::Fastest: return 0.4;
+            case ESpeed::Fast: return 0.2;
+            case ESpeed::Slow: return 0.05;
+            default: return 0.1;
+        }
+    }
 };
 
 class TAtrac1Data {
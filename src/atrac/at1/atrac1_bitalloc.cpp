@@ -21,9 +21,12 @@
 #include <atrac/atrac_psy_common.h>
 #include <atrac/atrac_scale.h>
 #include <math.h>
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <bitstream/bitstream.h>
 #include <env.h>
+#include <stage_stat.h>
 
 namespace NAtracDEnc {
 namespace NAtrac1 {
@@ -31,7 +34,6 @@ namespace NAtrac1 {
 using std::vector;
 using std::cerr;
 using std::endl;
-using std::pair;
 
 static const uint32_t FixedBitAllocTableLong[TAtrac1Data::MaxBfus] = {
     7, 7, 7, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
@@ -51,30 +53,41 @@ static const uint32_t BitBoostMask[TAtrac1Data::MaxBfus] = {
     1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
-TBitsBooster::TBitsBooster() {
+TBitsBooster::TBitsBooster()
+    : NumBoostPos(0)
+{
     for (uint32_t i = 0; i < TAtrac1Data::MaxBfus; ++i) {
         if (BitBoostMask[i] == 0)
             continue;
         const uint32_t nBits = TAtrac1Data::SpecsPerBlock[i];
-        BitsBoostMap.insert(pair<uint32_t, uint32_t>(nBits, i));
+        // insert after all entries with the same cost
+        uint32_t pos = NumBoostPos;
+        while (pos && BoostBits[pos - 1] > nBits) {
+            BoostBits[pos] = BoostBits[pos - 1];
+            BoostPos[pos] = BoostPos[pos - 1];
+            pos--;
+        }
+        BoostBits[pos] = nBits;
+        BoostPos[pos] = i;
+        NumBoostPos++;
     }
-    MaxBitsPerIteration = BitsBoostMap.size() ? (--BitsBoostMap.end())->first : 0;
-    MinKey = BitsBoostMap.begin()->first;
+    MaxBitsPerIteration = NumBoostPos ? BoostBits[NumBoostPos - 1] : 0;
+    MinKey = BoostBits[0];
 }
 
 uint32_t TBitsBooster::ApplyBoost(std::vector<uint32_t>* bitsPerEachBlock, uint32_t cur, uint32_t target) {
     uint32_t surplus = target - cur;
     uint32_t key = (surplus > MaxBitsPerIteration) ? MaxBitsPerIteration : surplus;
-    std::multimap<uint32_t, uint32_t>::iterator maxIt = BitsBoostMap.upper_bound(key);
+    const uint32_t end = std::upper_bound(BoostBits.begin(), BoostBits.begin() + NumBoostPos, key) - BoostBits.begin();
     //the key too low
-    if (maxIt == BitsBoostMap.begin())
+    if (end == 0)
         return surplus;
 
     while (surplus >= MinKey) {
         bool done = true;
-        for (std::multimap<uint32_t, uint32_t>::iterator it = BitsBoostMap.begin(); it != maxIt; ++it) {
-            const uint32_t curBits = it->first;
-            const uint32_t curPos = it->second;
+        for (uint32_t j = 0; j < end; ++j) {
+            const uint32_t curBits = BoostBits[j];
+            const uint32_t curPos = BoostPos[j];
 
             assert(key >= curBits);
             if (curPos >= bitsPerEachBlock->size())
@@ -98,12 +111,143 @@ uint32_t TBitsBooster::ApplyBoost(std::vector<uint32_t>* bitsPerEachBlock, uint3
     return surplus;
 }
 
+constexpr float TBitAllocCurve::MinShift;
+constexpr float TBitAllocCurve::MaxShift;
+
+// Returns the largest shift the BFU keeps at least wordLen bits at,
+// the same expression as in GetAllocation is used so the step is exact.
+// The search runs over the float bit patterns ordered as integers.
+float TBitAllocCurve::FindStep(double base, uint32_t wordLen) {
+    auto keeps = [base, wordLen](float shift) {
+        const int tmp = base - shift;
+        return tmp >= (int)wordLen;
+    };
+    auto toKey = [](float f) {
+        int32_t i;
+        memcpy(&i, &f, sizeof(i));
+        return (i < 0) ? -(i & 0x7fffffff) : i;
+    };
+    auto fromKey = [](int32_t key) {
+        const int32_t i = (key < 0) ? (int32_t)((uint32_t)(-key) | 0x80000000u) : key;
+        float f;
+        memcpy(&f, &i, sizeof(f));
+        return f;
+    };
+    const float approx = base - wordLen;
+    int32_t lo = toKey(approx - 0.001f);
+    int32_t hi = toKey(approx + 0.001f);
+    assert(keeps(fromKey(lo)) && !keeps(fromKey(hi)));
+    while (hi - lo > 1) {
+        const int32_t mid = lo + (hi - lo) / 2;
+        if (keeps(fromKey(mid))) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return fromKey(lo);
+}
+
+void TBitAllocCurve::Build(const std::vector<TScaledBlock>& scaledBlocks, uint32_t bfuNum, float spread,
+                           const TAtrac1Data::TBlockSizeMod& blockSize, const float* ath, float loudness) {
+    BfuNum = bfuNum;
+    NumSteps = 0;
+    FixedBitsTotal = 0;
+    for (uint32_t i = 0; i < bfuNum; ++i) {
+        FixedBits[i] = 0;
+        const bool shortBlock = blockSize.LogCount[TAtrac1Data::BfuToBand(i)];
+        const uint32_t fix = shortBlock ? FixedBitAllocTableShort[i] : FixedBitAllocTableLong[i];
+        Active[i] = shortBlock || scaledBlocks[i].MaxEnergy >= ath[i] * loudness;
+        if (!Active[i])
+            continue;
+        Base[i] = spread * ( (float)scaledBlocks[i].ScaleFactorIndex/3.2) + (1.0 - spread) * fix;
+
+        // Rough range of word lengths which change inside the search range, the exact
+        // position of each step is checked below.
+        const int hi = std::min((int)MaxWordLen, (int)Base[i] - (int)MinShift + 1);
+        const int lo = std::max((int)MinWordLen, (int)Base[i] - (int)MaxShift - 1);
+        for (int wl = (int)MinWordLen; wl < lo; wl++) {
+            FixedBits[i] += (wl == MinWordLen) ? MinWordLen : 1;
+        }
+        for (int wl = lo; wl <= hi; wl++) {
+            const float step = FindStep(Base[i], wl);
+            const uint32_t bits = (wl == MinWordLen) ? MinWordLen : 1;
+            if (step >= MaxShift) {
+                FixedBits[i] += bits;
+            } else if (step >= MinShift) {
+                Steps[NumSteps++] = {step, (uint8_t)i, (uint8_t)(bits * TAtrac1Data::SpecsPerBlock[i])};
+            }
+        }
+        FixedBits[i] *= TAtrac1Data::SpecsPerBlock[i];
+        FixedBitsTotal += FixedBits[i];
+    }
+
+    std::sort(Steps.begin(), Steps.begin() + NumSteps, [](const TStep& a, const TStep& b) {
+        return a.Shift < b.Shift;
+    });
+
+    SuffixBits[NumSteps] = 0;
+    for (size_t i = NumSteps; i > 0; --i) {
+        SuffixBits[i - 1] = SuffixBits[i] + Steps[i - 1].Bits;
+    }
+}
+
+void TBitAllocCurve::Restrict(uint32_t bfuNum) {
+    assert(bfuNum <= BfuNum);
+    for (uint32_t i = bfuNum; i < BfuNum; ++i) {
+        if (Active[i])
+            FixedBitsTotal -= FixedBits[i];
+    }
+    BfuNum = bfuNum;
+
+    size_t n = 0;
+    for (size_t i = 0; i < NumSteps; ++i) {
+        if (Steps[i].Bfu < bfuNum)
+            Steps[n++] = Steps[i];
+    }
+    NumSteps = n;
+
+    SuffixBits[NumSteps] = 0;
+    for (size_t i = NumSteps; i > 0; --i) {
+        SuffixBits[i - 1] = SuffixBits[i] + Steps[i - 1].Bits;
+    }
+}
+
+uint32_t TBitAllocCurve::GetBits(float shift) const {
+    // steps at or above the shift are not passed yet
+    const auto it = std::lower_bound(Steps.begin(), Steps.begin() + NumSteps, shift,
+        [](const TStep& step, float s) { return step.Shift < s; });
+    return FixedBitsTotal + SuffixBits[it - Steps.begin()];
+}
+
+void TBitAllocCurve::GetAllocation(float shift, std::vector<uint32_t>* bitsPerEachBlock) const {
+    bitsPerEachBlock->resize(BfuNum);
+    for (uint32_t i = 0; i < BfuNum; ++i) {
+        if (!Active[i]) {
+            (*bitsPerEachBlock)[i] = 0;
+            continue;
+        }
+        int tmp = Base[i] - shift;
+        if (tmp > 16) {
+            (*bitsPerEachBlock)[i] = 16;
+        } else if (tmp < 2) {
+            (*bitsPerEachBlock)[i] = 0;
+        } else {
+            (*bitsPerEachBlock)[i] = tmp;
+        }
+    }
+}
+
 std::vector<float> TAtrac1SimpleBitAlloc::ATHLong;
 
-TAtrac1SimpleBitAlloc::TAtrac1SimpleBitAlloc(ICompressedOutput* container, uint32_t bfuIdxConst, bool fastBfuNumSearch)
+TAtrac1SimpleBitAlloc::TAtrac1SimpleBitAlloc(ICompressedOutput* container, uint32_t bfuIdxConst, bool fastBfuNumSearch,
+                                             bool warmRateControl, float shiftPrecision)
     : TAtrac1BitStreamWriter(container)
     , BfuIdxConst(bfuIdxConst)
     , FastBfuNumSearch(fastBfuNumSearch)
+    , WarmRateControl(warmRateControl)
+    , ShiftPrecision(shiftPrecision)
+    , RateControl(shiftPrecision, 0.5)
 {
     if (ATHLong.size()) {
         return;
@@ -123,34 +267,6 @@ TAtrac1SimpleBitAlloc::TAtrac1SimpleBitAlloc(ICompressedOutput* container, uint3
     }
 }
 
-vector<uint32_t> TAtrac1SimpleBitAlloc::CalcBitsAllocation(const std::vector<TScaledBlock>& scaledBlocks,
-                                                           const uint32_t bfuNum,
-                                                           const float spread,
-                                                           const float shift,
-                                                           const TAtrac1Data::TBlockSizeMod& blockSize,
-                                                           const float loudness) {
-    vector<uint32_t> bitsPerEachBlock(bfuNum);
-    for (size_t i = 0; i < bitsPerEachBlock.size(); ++i) {
-        bool shortBlock = blockSize.LogCount[TAtrac1Data::BfuToBand(i)];
-        const uint32_t fix = shortBlock ? FixedBitAllocTableShort[i] : FixedBitAllocTableLong[i];
-        float ath = ATHLong[i] * loudness;
-        //std::cerr << "block: " << i << " Loudness: " << loudness << " " << 10 * log10(scaledBlocks[i].MaxEnergy / ath) << std::endl;
-        if (!shortBlock && scaledBlocks[i].MaxEnergy < ath) {
-            bitsPerEachBlock[i] = 0;
-        } else {
-            int tmp = spread * ( (float)scaledBlocks[i].ScaleFactorIndex/3.2) + (1.0 - spread) * fix - shift;
-            if (tmp > 16) {
-                bitsPerEachBlock[i] = 16;
-            } else if (tmp < 2) {
-                bitsPerEachBlock[i] = 0;
-            } else {
-                bitsPerEachBlock[i] = tmp;
-            }
-        }
-    }
-    return bitsPerEachBlock;
-}
-
 uint32_t TAtrac1SimpleBitAlloc::GetMaxUsedBfuId(const vector<uint32_t>& bitsPerEachBlock) {
     uint32_t idx = 7;
     for (;;) {
@@ -186,68 +302,80 @@ uint32_t TAtrac1SimpleBitAlloc::CheckBfuUsage(bool* changed,
     return curBfuId;
 }
 
+float TAtrac1SimpleBitAlloc::SearchShift(uint32_t minBits, uint32_t maxBits, uint32_t* iterations) {
+    if (WarmRateControl) {
+        RateControl.Start(TBitAllocCurve::MinShift, TBitAllocCurve::MaxShift, 3.0, minBits, maxBits);
+        do {
+            (*iterations)++;
+        } while (!RateControl.Submit(Curve.GetBits(RateControl.Get())));
+        return RateControl.GetResult();
+    }
+
+    // Plain bisection, each frame from scratch
+    float maxShift = TBitAllocCurve::MaxShift;
+    float minShift = TBitAllocCurve::MinShift;
+    float shift = 3.0;
+
+    for (;;) {
+        (*iterations)++;
+        const uint32_t bitsUsed = Curve.GetBits(shift);
+
+        if (bitsUsed < minBits) {
+            if (maxShift - minShift < ShiftPrecision) {
+                return shift;
+            }
+            maxShift = shift;
+            shift -= (shift - minShift) / 2;
+        } else if (bitsUsed > maxBits) {
+            minShift = shift;
+            shift += (maxShift - shift) / 2;
+        } else {
+            return shift;
+        }
+    }
+}
+
 uint32_t TAtrac1SimpleBitAlloc::Write(const std::vector<TScaledBlock>& scaledBlocks, const TAtrac1Data::TBlockSizeMod& blockSize, float loudness) {
     uint32_t bfuIdx = BfuIdxConst ? BfuIdxConst - 1 : 7;
     bool autoBfu = !BfuIdxConst;
     float spread = AnalizeScaleFactorSpread(scaledBlocks);
 
+    Curve.Build(scaledBlocks, TAtrac1Data::BfuAmountTab[bfuIdx], spread, blockSize, ATHLong.data(), loudness);
+
     vector<uint32_t> bitsPerEachBlock(TAtrac1Data::BfuAmountTab[bfuIdx]);
+    vector<uint32_t> tmpAlloc;
     uint32_t targetBitsPerBfus;
     uint32_t curBitsPerBfus;
+    uint32_t iterations = 0;
     for (;;) {
         bitsPerEachBlock.resize(TAtrac1Data::BfuAmountTab[bfuIdx]);
+        Curve.Restrict(TAtrac1Data::BfuAmountTab[bfuIdx]);
         const uint32_t bitsAvaliablePerBfus = TAtrac1Data::SoundUnitSize * 8 -
             TAtrac1Data::BitsPerBfuAmountTabIdx - 32 - 2 - 3 -
             bitsPerEachBlock.size() * (TAtrac1Data::BitsPerIDWL + TAtrac1Data::BitsPerIDSF);
 
-        float maxShift = 15;
-        float minShift = -3;
-        float shift = 3.0;
         const uint32_t maxBits = bitsAvaliablePerBfus;
         const uint32_t minBits = bitsAvaliablePerBfus - 110;
 
-        bool bfuNumChanged = false;
-        for (;;) {
-            const vector<uint32_t>& tmpAlloc = CalcBitsAllocation(scaledBlocks, TAtrac1Data::BfuAmountTab[bfuIdx],
-                                                                  spread, shift, blockSize, loudness);
-            uint32_t bitsUsed = 0;
-            for (size_t i = 0; i < tmpAlloc.size(); i++) {
-                bitsUsed += TAtrac1Data::SpecsPerBlock[i] * tmpAlloc[i];
-            }
+        const float shift = SearchShift(minBits, maxBits, &iterations);
+        curBitsPerBfus = Curve.GetBits(shift);
 
-            if (bitsUsed < minBits) {
-                if (maxShift - minShift < 0.1) {
-                    if (autoBfu) {
-                        bfuIdx = CheckBfuUsage(&bfuNumChanged, bfuIdx, tmpAlloc);
-                    }
-                    if (!bfuNumChanged) {
-                        bitsPerEachBlock = tmpAlloc;
-                    }
-                    curBitsPerBfus = bitsUsed;
-                    break;
-                }
-                maxShift = shift;
-                shift -= (shift - minShift) / 2;
-            } else if (bitsUsed > maxBits) {
-                minShift = shift;
-                shift += (maxShift - shift) / 2;
-            } else {
-                if (autoBfu) {
-                    bfuIdx = CheckBfuUsage(&bfuNumChanged, bfuIdx, tmpAlloc);
-                }
-                if (!bfuNumChanged) {
-                    bitsPerEachBlock = tmpAlloc;
-                }
-                curBitsPerBfus = bitsUsed;
-                break;
-            }
+        bool bfuNumChanged = false;
+        Curve.GetAllocation(shift, &tmpAlloc);
+        if (autoBfu) {
+            bfuIdx = CheckBfuUsage(&bfuNumChanged, bfuIdx, tmpAlloc);
         }
         if (!bfuNumChanged) {
+            bitsPerEachBlock.swap(tmpAlloc);
             targetBitsPerBfus = bitsAvaliablePerBfus;
             break;
         }
     }
-    ApplyBoost(&bitsPerEachBlock, curBitsPerBfus, targetBitsPerBfus);
+    RateControlStat.Add(iterations);
+    TStageStat::AddIterations(EStage::BitAlloc, iterations);
+    if (curBitsPerBfus < targetBitsPerBfus) {
+        ApplyBoost(&bitsPerEachBlock, curBitsPerBfus, targetBitsPerBfus);
+    }
     WriteBitStream(bitsPerEachBlock, scaledBlocks, bfuIdx, blockSize);
     return TAtrac1Data::BfuAmountTab[bfuIdx];
 }
@@ -262,6 +390,7 @@ void TAtrac1BitStreamWriter::WriteBitStream(const vector<uint32_t>& bitsPerEachB
                                             const std::vector<TScaledBlock>& scaledBlocks,
                                             uint32_t bfuAmountIdx,
                                             const TAtrac1Data::TBlockSizeMod& blockSize) {
+    TStageScope stage(EStage::Bitstream);
     NBitStream::TBitStream bitStream;
     size_t bitUsed = 0;
     if (bfuAmountIdx >= (1 << TAtrac1Data::BitsPerBfuAmountTabIdx)) {
@@ -324,6 +453,7 @@ void TAtrac1BitStreamWriter::WriteBitStream(const vector<uint32_t>& bitsPerEachB
         cerr << "ATRAC1 bitstream corrupted, used: " << bitUsed << " exp: " << TAtrac1Data::SoundUnitSize * 8 << endl;
         abort();
     }
+    TStageScope write(EStage::Container);
     Container->WriteFrame(bitStream.GetBytes());
 }
 
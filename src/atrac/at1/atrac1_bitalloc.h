@@ -20,8 +20,9 @@
 #include "atrac1.h"
 #include <atrac/atrac_scale.h>
 #include <compressed_io.h>
+#include <bs_encode/rate_control.h>
+#include <array>
 #include <vector>
-#include <map>
 #include <cstdint>
 
 namespace NAtracDEnc {
@@ -34,10 +35,15 @@ public:
     IAtrac1BitAlloc() {};
     virtual ~IAtrac1BitAlloc() {};
     virtual uint32_t Write(const std::vector<TScaledBlock>& scaledBlocks, const TAtrac1Data::TBlockSizeMod& blockSize, float loudness) = 0;
+    virtual const TRateControlStat& GetRateControlStat() const = 0;
 };
 
 class TBitsBooster {
-    std::multimap<uint32_t, uint32_t> BitsBoostMap; //bits needed -> position
+    // Boostable BFUs ordered by bits needed to add one bit per spectral line,
+    // BFUs with equal cost keep ascending position order.
+    std::array<uint32_t, TAtrac1Data::MaxBfus> BoostBits;
+    std::array<uint32_t, TAtrac1Data::MaxBfus> BoostPos;
+    uint32_t NumBoostPos;
     uint32_t MaxBitsPerIteration;
     uint32_t MinKey;
 public:
@@ -45,6 +51,49 @@ public:
     uint32_t ApplyBoost(std::vector<uint32_t>* bitsPerEachBlock, uint32_t cur, uint32_t target);
 };
 
+// Bits consumed by spectral data as a function of the allocation shift.
+// Word length of each BFU is a step function of the shift, so the whole curve
+// is described by the sorted list of shifts where some BFU loses bits.
+// The curve is built once per frame, each probe of the shift search is a lookup.
+class TBitAllocCurve {
+public:
+    // Range of shift probed by the search
+    static constexpr float MinShift = -3;
+    static constexpr float MaxShift = 15;
+
+    void Build(const std::vector<TScaledBlock>& scaledBlocks, uint32_t bfuNum, float spread,
+               const TAtrac1Data::TBlockSizeMod& blockSize, const float* ath, float loudness);
+    // Limit the curve to the first bfuNum BFUs, bfuNum must not grow
+    void Restrict(uint32_t bfuNum);
+    uint32_t GetBits(float shift) const;
+    void GetAllocation(float shift, std::vector<uint32_t>* bitsPerEachBlock) const;
+
+private:
+    static constexpr uint32_t MinWordLen = 2;
+    static constexpr uint32_t MaxWordLen = 16;
+    static constexpr size_t MaxSteps = TAtrac1Data::MaxBfus * (MaxWordLen - MinWordLen + 1);
+
+    struct TStep {
+        float Shift; // the last shift where the BFU still has the word length
+        uint8_t Bfu;
+        uint8_t Bits; // bits lost when the shift passes the step
+    };
+
+    static float FindStep(double base, uint32_t wordLen);
+
+    uint32_t BfuNum = 0;
+    std::array<double, TAtrac1Data::MaxBfus> Base;
+    std::array<bool, TAtrac1Data::MaxBfus> Active;
+    // Bits of steps above MaxShift, such BFUs always keep them during the search
+    std::array<uint32_t, TAtrac1Data::MaxBfus> FixedBits;
+    uint32_t FixedBitsTotal = 0;
+
+    std::array<TStep, MaxSteps> Steps;
+    size_t NumSteps = 0;
+    // SuffixBits[i] - bits of Steps[i..NumSteps)
+    std::array<uint32_t, MaxSteps + 1> SuffixBits;
+};
+
 class TAtrac1BitStreamWriter {
     ICompressedOutput* Container;
 public:
@@ -55,20 +104,24 @@ public:
 };
 
 class TAtrac1SimpleBitAlloc : public TAtrac1BitStreamWriter, public TBitsBooster, public virtual IAtrac1BitAlloc {
-    std::vector<uint32_t> CalcBitsAllocation(const std::vector<TScaledBlock>& scaledBlocks, const uint32_t bfuNum,
-                                             const float spread, const float shift,
-                                             const TAtrac1Data::TBlockSizeMod& blockSize,
-                                             const float loudness);
     const uint32_t BfuIdxConst;
     const bool FastBfuNumSearch;
+    const bool WarmRateControl;
+    const float ShiftPrecision;
     static std::vector<float> ATHLong;
+    TBitAllocCurve Curve;
+    TRateControl RateControl;
+    TRateControlStat RateControlStat;
 
+    float SearchShift(uint32_t minBits, uint32_t maxBits, uint32_t* iterations);
     uint32_t GetMaxUsedBfuId(const std::vector<uint32_t>& bitsPerEachBlock);
     uint32_t CheckBfuUsage(bool* changed, uint32_t curBfuId, const std::vector<uint32_t>& bitsPerEachBlock);
 public:
-    TAtrac1SimpleBitAlloc(ICompressedOutput* container, uint32_t bfuIdxConst, bool fastBfuNumSearch);
+    TAtrac1SimpleBitAlloc(ICompressedOutput* container, uint32_t bfuIdxConst, bool fastBfuNumSearch,
+                          bool warmRateControl = false, float shiftPrecision = 0.1);
     ~TAtrac1SimpleBitAlloc() {};
     uint32_t Write(const std::vector<TScaledBlock>& scaledBlocks, const TAtrac1Data::TBlockSizeMod& blockSize, float loudness) override;
+    const TRateControlStat& GetRateControlStat() const override { return RateControlStat; }
 };
 
 } //namespace NAtrac1
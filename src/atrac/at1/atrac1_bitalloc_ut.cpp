@@ -0,0 +1,191 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "atrac1_bitalloc.h"
+#include <atrac1denc.h>
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <vector>
+
+using namespace NAtracDEnc;
+using namespace NAtrac1;
+
+namespace {
+
+class THashOutput : public ICompressedOutput {
+public:
+    explicit THashOutput(size_t channels)
+        : Channels(channels)
+    {}
+
+    void WriteFrame(std::vector<char> data) override {
+        // Amount of BFUs follows 8 bits of block size modes
+        Bfus += TAtrac1Data::BfuAmountTab[(uint8_t)data[1] >> 5];
+        for (char c : data) {
+            Hash ^= (uint8_t)c;
+            Hash *= 0x100000001b3ull;
+        }
+        Frames++;
+    }
+
+    std::string GetName() const override { return "ut"; }
+    size_t GetChannelNum() const override { return Channels; }
+
+    uint64_t Hash = 0xcbf29ce484222325ull;
+    size_t Frames = 0;
+    size_t Bfus = 0;
+private:
+    const size_t Channels;
+};
+
+// Deterministic test signal: sweep, bursts of a high tone, decaying
+// transients and LCG noise, so all window modes and BFU counts get exercised.
+void GenSignal(std::vector<float>& buf, size_t channels, size_t len, double noiseLevel) {
+    buf.resize(len * channels);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < len; i++) {
+        const double t = i / 44100.0;
+        seed = seed * 1664525u + 1013904223u;
+        const double noise = ((int32_t)seed >> 8) / (double)(1 << 23);
+        double l = 0.3 * sin(2 * M_PI * (200 * t + 2000 * t * t)) + noiseLevel * noise;
+        if ((i / 11025) & 1)
+            l += 0.6 * sin(2 * M_PI * 3000 * t);
+        buf[i * channels] = l;
+        if (channels == 2) {
+            const double r = 0.4 * sin(2 * M_PI * 440 * t) * exp(-((i % 22050) / 8000.0))
+                + 0.2 * sin(2 * M_PI * 1234 * t);
+            buf[i * channels + 1] = r;
+        }
+    }
+}
+
+uint64_t Encode(size_t channels, TAtrac1EncodeSettings&& settings, double noiseLevel = 0.05,
+                TRateControlStat* stat = nullptr, size_t* bfus = nullptr) {
+    const size_t frames = 256;
+    std::vector<float> pcm;
+    GenSignal(pcm, channels, frames * TAtrac1Data::NumSamples, noiseLevel);
+
+    THashOutput* out = new THashOutput(channels);
+    TAtrac1Encoder encoder(TCompressedOutputPtr(out), std::move(settings));
+    auto lambda = encoder.GetLambda();
+    TPCMEngine::ProcessMeta meta = {(uint16_t)channels};
+    for (size_t i = 0; i < frames; i++) {
+        lambda(pcm.data() + i * TAtrac1Data::NumSamples * channels, meta);
+    }
+    EXPECT_EQ(out->Frames, frames * channels);
+    if (stat) {
+        *stat = encoder.GetRateControlStat();
+    }
+    if (bfus) {
+        *bfus = out->Bfus;
+    }
+    return out->Hash;
+}
+
+using EWindowMode = TAtrac1EncodeSettings::EWindowMode;
+
+} // namespace
+
+// Reference hashes were taken from the bisection-based allocator, the allocator
+// must stay bit exact with it.
+TEST(TAtrac1BitAlloc, BitExactStereo) {
+    EXPECT_EQ(Encode(2, TAtrac1EncodeSettings(0, false, EWindowMode::EWM_AUTO, 0)), 17043295704549184356ull);
+}
+
+TEST(TAtrac1BitAlloc, BitExactMono) {
+    EXPECT_EQ(Encode(1, TAtrac1EncodeSettings(0, false, EWindowMode::EWM_AUTO, 0)), 10856377335493409451ull);
+}
+
+TEST(TAtrac1BitAlloc, BitExactBfuSearch) {
+    EXPECT_EQ(Encode(2, TAtrac1EncodeSettings(0, false, EWindowMode::EWM_AUTO, 0), 0.0), 3458519693257138131ull);
+}
+
+// With a low noise floor the BFUs above the tones get a few bits, so the regular search
+// steps down the BFU amount one table entry at a time while the fast one jumps to the
+// last used BFU at once, and the outputs differ
+TEST(TAtrac1BitAlloc, BitExactFastBfuSearch) {
+    size_t fastBfus = 0;
+    size_t regularBfus = 0;
+    const uint64_t fast = Encode(2, TAtrac1EncodeSettings(0, true, EWindowMode::EWM_AUTO, 0), 0.001,
+                                 nullptr, &fastBfus);
+    const uint64_t regular = Encode(2, TAtrac1EncodeSettings(0, false, EWindowMode::EWM_AUTO, 0), 0.001,
+                                    nullptr, &regularBfus);
+    EXPECT_EQ(fast, 8108490147408114939ull);
+    EXPECT_NE(fast, regular);
+    EXPECT_NE(fastBfus, regularBfus);
+}
+
+TEST(TAtrac1BitAlloc, BitExactConstBfu) {
+    EXPECT_EQ(Encode(2, TAtrac1EncodeSettings(5, false, EWindowMode::EWM_AUTO, 0)), 4092305130642428491ull);
+}
+
+TEST(TAtrac1BitAlloc, BitExactShortWindows) {
+    EXPECT_EQ(Encode(2, TAtrac1EncodeSettings(0, false, EWindowMode::EWM_NOTRANSIENT, 7)), 3298561339916502661ull);
+}
+
+TEST(TAtrac1BitAlloc, BitsBoosterKeepsBudget) {
+    TBitsBooster booster;
+    std::vector<uint32_t> bits(TAtrac1Data::MaxBfus, 3);
+    uint32_t used = 0;
+    for (size_t i = 0; i < bits.size(); i++) {
+        used += bits[i] * TAtrac1Data::SpecsPerBlock[i];
+    }
+    const uint32_t target = used + 100;
+    const uint32_t surplus = booster.ApplyBoost(&bits, used, target);
+
+    uint32_t boosted = 0;
+    for (size_t i = 0; i < bits.size(); i++) {
+        boosted += bits[i] * TAtrac1Data::SpecsPerBlock[i];
+    }
+    EXPECT_EQ(boosted + surplus, target);
+    EXPECT_LT(surplus, 100u);
+}
+
+TEST(TAtrac1BitAlloc, WarmRateControl) {
+    TRateControlStat cold;
+    TRateControlStat warm;
+    Encode(2, TAtrac1EncodeSettings(0, false, EWindowMode::EWM_AUTO, 0), 0.05, &cold);
+    Encode(2, TAtrac1EncodeSettings(0, false, EWindowMode::EWM_AUTO, 0, true), 0.05, &warm);
+    EXPECT_EQ(cold.Frames, 2 * 256u);
+    EXPECT_EQ(warm.Frames, 2 * 256u);
+    EXPECT_LT(warm.Iterations, cold.Iterations);
+}
+
+TEST(TAtrac1BitAlloc, SpeedPresets) {
+    EXPECT_EQ(Encode(2, TAtrac1EncodeSettings(0, false, EWindowMode::EWM_AUTO, 0, false, ESpeed::Default)),
+              17043295704549184356ull);
+
+    TRateControlStat stat[4];
+    const ESpeed presets[4] = {ESpeed::Fastest, ESpeed::Fast, ESpeed::Default, ESpeed::Slow};
+    for (size_t i = 0; i < 4; i++) {
+        Encode(2, TAtrac1EncodeSettings(0, false, EWindowMode::EWM_AUTO, 0, false, presets[i]), 0.05, &stat[i]);
+        EXPECT_EQ(stat[i].Frames, 2 * 256u);
+    }
+    EXPECT_LT(stat[0].Iterations, stat[2].Iterations);
+    EXPECT_LT(stat[1].Iterations, stat[2].Iterations);
+    EXPECT_LE(stat[2].Iterations, stat[3].Iterations);
+}
+
+TEST(TAtrac1BitAlloc, BitExactParallelChannels) {
+    EXPECT_EQ(Encode(2, TAtrac1EncodeSettings(0, false, EWindowMode::EWM_AUTO, 0, false, ESpeed::Default, true)),
+              17043295704549184356ull);
+    EXPECT_EQ(Encode(1, TAtrac1EncodeSettings(0, false, EWindowMode::EWM_AUTO, 0, false, ESpeed::Default, true)),
+              10856377335493409451ull);
+}
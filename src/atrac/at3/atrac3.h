@@ -24,6 +24,7 @@
 #include <vector>
 #include <cassert>
 #include <iostream>
+#include "atrac/atrac_speed.h"
 
 namespace NAtracDEnc {
 namespace NAtrac3 {
@@ -259,18 +260,49 @@ public:
 
 struct TAtrac3EncoderSettings {
     TAtrac3EncoderSettings(uint32_t bitrate, bool noGainControll,
-                           bool noTonalComponents, uint8_t sourceChannels, uint32_t bfuIdxConst)
+                           bool noTonalComponents, uint8_t sourceChannels, uint32_t bfuIdxConst,
+                           bool warmRateControl = false, ESpeed speed = ESpeed::Default,
+                           bool parallelChannels = false, bool skipSilence = true)
         : ConteinerParams(TAtrac3Data::GetContainerParamsForBitrate(bitrate))
-        , NoGainControll(noGainControll)
+        , NoGainControll(noGainControll || speed == ESpeed::Fastest)
         , NoTonalComponents(noTonalComponents)
         , SourceChannels(sourceChannels)
         , BfuIdxConst(bfuIdxConst)
+        , WarmRateControl(warmRateControl || speed <= ESpeed::Fast)
+        , Speed(speed)
+        , ShiftPrecision(GetShiftPrecision(speed))
+        , EnergyErrCorrection(speed != ESpeed::Fastest)
+        , FastBfuNumSearch(speed <= ESpeed::Fast)
+        , ParallelChannels(parallelChannels)
+        , SkipSilence(skipSilence)
     { }
     const TContainerParams* ConteinerParams;
     const bool NoGainControll;
     const bool NoTonalComponents;
     const uint8_t SourceChannels;
     const uint32_t BfuIdxConst;
+    // Start bit allocation search from the previous frame solution
+    const bool WarmRateControl;
+    const ESpeed Speed;
+    // Width of the bit allocation shift range at which the search stops
+    const float ShiftPrecision;
+    // Give more bits to the low BFUs with a big quantization error (EAQ)
+    const bool EnergyErrCorrection;
+    // Drop all unused trailing BFUs at once instead of one per search
+    const bool FastBfuNumSearch;
+    // Process channels of a stereo frame on two threads
+    const bool ParallelChannels;
+    // Write a precomputed frame for silence instead of encoding it
+    const bool SkipSilence;
+private:
+    static float GetShiftPrecision(ESpeed speed) {
+        switch (speed) {
+            case ESpeed::Fastest: return 0.4;
+            case ESpeed::Fast: return 0.2;
+            case ESpeed::Slow: return 0.05;
+            default: return 0.1;
+        }
+    }
 };
 
 } // namespace NAtrac3
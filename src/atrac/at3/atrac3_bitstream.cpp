@@ -21,6 +21,7 @@
 #include <bitstream/bitstream.h>
 #include <util.h>
 #include <env.h>
+#include <stage_stat.h>
 #include <algorithm>
 #include <iostream>
 #include <vector>
@@ -56,10 +57,17 @@ static constexpr size_t BOOST_NAQ_END = 0;
 #endif
 
 std::vector<float> TAtrac3BitStreamWriter::ATH;
-TAtrac3BitStreamWriter::TAtrac3BitStreamWriter(ICompressedOutput* container, const TContainerParams& params, uint32_t bfuIdxConst)
+TAtrac3BitStreamWriter::TAtrac3BitStreamWriter(ICompressedOutput* container, const TContainerParams& params, uint32_t bfuIdxConst,
+                                               bool warmRateControl, float shiftPrecision,
+                                               bool energyErrCorrection, bool fastBfuNumSearch)
     : Container(container)
     , Params(params)
     , BfuIdxConst(bfuIdxConst)
+    , WarmRateControl(warmRateControl)
+    , ShiftPrecision(shiftPrecision)
+    , EnergyErrCorrection(energyErrCorrection)
+    , FastBfuNumSearch(fastBfuNumSearch)
+    , RateControl{TRateControl(shiftPrecision, 0.5), TRateControl(shiftPrecision, 0.5)}
 {
     NEnv::SetRoundFloat();
     if (ATH.size()) {
@@ -170,13 +178,16 @@ std::pair<uint8_t, uint32_t> TAtrac3BitStreamWriter::CalcSpecsBitsConsumption(co
 
 //true - should reencode
 //false - not need to
-static inline bool CheckBfus(uint16_t* numBfu, const vector<uint32_t>& precisionPerEachBlocks)
+static inline bool CheckBfus(uint16_t* numBfu, const vector<uint32_t>& precisionPerEachBlocks, bool fast)
 {
     ASSERT(*numBfu);
     uint16_t curLastBfu = *numBfu - 1;
     //assert(curLastBfu < precisionPerEachBlocks.size());
     ASSERT(*numBfu == precisionPerEachBlocks.size());
     if (precisionPerEachBlocks[curLastBfu] == 0) {
+        while (fast && curLastBfu > 1 && precisionPerEachBlocks[curLastBfu - 1] == 0) {
+            curLastBfu--;
+        }
         *numBfu = curLastBfu;
         return true;
     }
@@ -205,7 +216,7 @@ bool ConsiderEnergyErr(const vector<float>& err, vector<uint32_t>& bits)
 }
 
 std::pair<uint8_t, vector<uint32_t>> TAtrac3BitStreamWriter::CreateAllocation(const TSingleChannelElement& sce,
-    const uint16_t targetBits, int mt[TAtrac3Data::MaxSpecs], float laudness)
+    const uint16_t targetBits, int mt[TAtrac3Data::MaxSpecs], float laudness, TRateControl& rateControl)
 {
     const vector<TScaledBlock>& scaledBlocks = sce.ScaledBlocks;
     if (scaledBlocks.empty()) {
@@ -227,49 +238,69 @@ std::pair<uint8_t, vector<uint32_t>> TAtrac3BitStreamWriter::CreateAllocation(co
 
     vector<uint32_t> precisionPerEachBlocks(numBfu);
     vector<float> energyErr(numBfu);
+    uint32_t iterations = 0;
+
+    // Bit consumption of allocation for given shift, mantissas are left in mt
+    auto probe = [&](float shift, vector<uint32_t>* alloc) {
+        iterations++;
+        *alloc = CalcBitsAllocation(scaledBlocks, numBfu, spread, shift, laudness);
+        energyErr.clear();
+        energyErr.resize(numBfu);
+        std::pair<uint8_t, uint32_t> consumption;
+
+        do {
+            consumption = CalcSpecsBitsConsumption(sce, *alloc, mt, energyErr);
+        } while (EnergyErrCorrection && ConsiderEnergyErr(energyErr, *alloc));
+
+        auto bitsUsedByTonal = EncodeTonalComponents(sce, *alloc, nullptr);
+        //std::cerr << consumption.second << " |tonal: " << bitsUsedByTonal << " target: " << targetBits << " shift " << shift << " numBfu: " << numBfu << std::endl;
+        consumption.second += bitsUsedByTonal;
+        return consumption;
+    };
+
     uint8_t mode;
     bool cont = true;
     while (cont) {
         precisionPerEachBlocks.resize(numBfu);
-        double maxShift = 20;
-        double minShift = -8;
-        for (;;) {
-            double shift = (maxShift + minShift) / 2;
-            vector<uint32_t> tmpAlloc = CalcBitsAllocation(scaledBlocks, numBfu, spread, shift, laudness);
-            energyErr.clear();
-            energyErr.resize(numBfu);
-            std::pair<uint8_t, uint32_t> consumption;
-
+        vector<uint32_t> tmpAlloc;
+        std::pair<uint8_t, uint32_t> consumption;
+        if (WarmRateControl) {
+            rateControl.Start(-8, 20, 6, targetBits, targetBits);
             do {
-                consumption = CalcSpecsBitsConsumption(sce, tmpAlloc, mt, energyErr);
-            } while (ConsiderEnergyErr(energyErr, tmpAlloc));
-
-            auto bitsUsedByTonal = EncodeTonalComponents(sce, tmpAlloc, nullptr);
-            //std::cerr << consumption.second << " |tonal: " << bitsUsedByTonal << " target: " << targetBits << " shift " << shift << " max | min " << maxShift << " " << minShift << " numBfu: " << numBfu << std::endl;
-            consumption.second += bitsUsedByTonal;
-
-            if (consumption.second < targetBits) {
-                if (maxShift - minShift < 0.1) {
-                    precisionPerEachBlocks = tmpAlloc;
-                    mode = consumption.first;
-                    if (numBfu > 1) {
-                        cont = !BfuIdxConst && CheckBfus(&numBfu, precisionPerEachBlocks);
-                    } else {
-                        cont = false;
+                consumption = probe(rateControl.Get(), &tmpAlloc);
+            } while (!rateControl.Submit(consumption.second));
+            if (rateControl.GetResult() != rateControl.Get()) {
+                consumption = probe(rateControl.GetResult(), &tmpAlloc);
+            }
+        } else {
+            double maxShift = 20;
+            double minShift = -8;
+            for (;;) {
+                double shift = (maxShift + minShift) / 2;
+                consumption = probe(shift, &tmpAlloc);
+
+                if (consumption.second < targetBits) {
+                    if (maxShift - minShift < ShiftPrecision) {
+                        break;
                     }
+                    maxShift = shift - 0.01;
+                } else if (consumption.second > targetBits) {
+                    minShift = shift + 0.01;
+                } else {
                     break;
                 }
-                maxShift = shift - 0.01;
-            } else if (consumption.second > targetBits) {
-                minShift = shift + 0.01;
-            } else {
-                precisionPerEachBlocks = tmpAlloc;
-                mode = consumption.first;
-                cont = !BfuIdxConst && CheckBfus(&numBfu, precisionPerEachBlocks);;
-                break;
             }
         }
+        precisionPerEachBlocks = tmpAlloc;
+        mode = consumption.first;
+        if (numBfu > 1) {
+            cont = !BfuIdxConst && CheckBfus(&numBfu, precisionPerEachBlocks, FastBfuNumSearch);
+        } else {
+            cont = false;
+        }
     }
+    RateControlStat.Add(iterations);
+    TStageStat::AddIterations(EStage::BitAlloc, iterations);
     //std::cerr << "==" << std::endl;
     return { mode, precisionPerEachBlocks };
 }
@@ -579,6 +610,7 @@ static int32_t CalcMSBytesShift(uint32_t frameSz,
 
 void TAtrac3BitStreamWriter::WriteSoundUnit(const vector<TSingleChannelElement>& singleChannelElements, float laudness)
 {
+    TStageScope stage(EStage::Bitstream);
 
     ASSERT(singleChannelElements.size() == 1 || singleChannelElements.size() == 2);
 
@@ -634,7 +666,8 @@ void TAtrac3BitStreamWriter::WriteSoundUnit(const vector<TSingleChannelElement>&
 
     for (uint32_t channel = 0; channel < singleChannelElements.size(); channel++) {
         const TSingleChannelElement& sce = singleChannelElements[channel];
-        allocations[channel] = CreateAllocation(sce, bitsToAlloc[channel], mt[channel], laudness);
+        TStageScope bitAlloc(EStage::BitAlloc);
+        allocations[channel] = CreateAllocation(sce, bitsToAlloc[channel], mt[channel], laudness, RateControl[channel]);
     }
 
     for (uint32_t channel = 0; channel < singleChannelElements.size(); channel++) {
@@ -665,7 +698,10 @@ void TAtrac3BitStreamWriter::WriteSoundUnit(const vector<TSingleChannelElement>&
         std::copy_n(OutBuffer.begin(), sz, OutBuffer.begin() + sz);
     }
 
-    Container->WriteFrame(OutBuffer);
+    {
+        TStageScope write(EStage::Container);
+        Container->WriteFrame(OutBuffer);
+    }
     OutBuffer.clear();
 }
 
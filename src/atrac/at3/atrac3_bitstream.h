@@ -20,6 +20,7 @@
 #include "atrac3.h"
 #include <compressed_io.h>
 #include <atrac/atrac_scale.h>
+#include <bs_encode/rate_control.h>
 #include <vector>
 #include <utility>
 
@@ -57,6 +58,12 @@ private:
     ICompressedOutput* Container;
     const TContainerParams Params;
     const uint32_t BfuIdxConst;
+    const bool WarmRateControl;
+    const float ShiftPrecision;
+    const bool EnergyErrCorrection;
+    const bool FastBfuNumSearch;
+    TRateControl RateControl[2];
+    TRateControlStat RateControlStat;
     std::vector<char> OutBuffer;
 
     uint32_t CLCEnc(const uint32_t selector, const int mantissas[TAtrac3Data::MaxSpecsPerBlock],
@@ -69,7 +76,8 @@ private:
                                              uint32_t bfuNum, float spread, float shift, float loudness);
 
     std::pair<uint8_t, std::vector<uint32_t>> CreateAllocation(const TSingleChannelElement& sce,
-                                                               uint16_t targetBits, int mt[TAtrac3Data::MaxSpecs], float laudness);
+                                                               uint16_t targetBits, int mt[TAtrac3Data::MaxSpecs], float laudness,
+                                                               TRateControl& rateControl);
 
     std::pair<uint8_t, uint32_t> CalcSpecsBitsConsumption(const TSingleChannelElement& sce,
                                                           const std::vector<uint32_t>& precisionPerEachBlocks,
@@ -86,9 +94,12 @@ private:
                                    const std::vector<uint32_t>& allocTable,
                                    NBitStream::TBitStream* bitStream);
 public:
-    TAtrac3BitStreamWriter(ICompressedOutput* container, const TContainerParams& params, uint32_t bfuIdxConst);
+    TAtrac3BitStreamWriter(ICompressedOutput* container, const TContainerParams& params, uint32_t bfuIdxConst,
+                           bool warmRateControl = false, float shiftPrecision = 0.1,
+                           bool energyErrCorrection = true, bool fastBfuNumSearch = false);
 
     void WriteSoundUnit(const std::vector<TSingleChannelElement>& singleChannelElements, float laudness);
+    const TRateControlStat& GetRateControlStat() const { return RateControlStat; }
 };
 
 } // namespace NAtrac3
@@ -25,7 +25,12 @@
 #include "at3p_mdct.h"
 #include "at3p_tables.h"
 #include <atrac/atrac_scale.h>
+#include <lib/bitstream/bitstream.h>
+#include <lib/parallel/thread_pool.h>
+#include <silence.h>
+#include <stage_stat.h>
 
+#include <algorithm>
 #include <cassert>
 #include <vector>
 #include <unordered_map>
@@ -36,17 +41,67 @@ namespace NAtracDEnc {
 
 class TAt3PEnc::TImpl {
 public:
-    TImpl(ICompressedOutput* out, int channels, TSettings settings)
-        : BitStream(out, 2048)
+    TImpl(int channels, TSettings settings, uint16_t frameSz)
+        : BitStream(nullptr, frameSz)
         , ChannelCtx(channels)
-        , GhaProcessor(MakeGhaProcessor0(channels == 2))
+        , GhaProcessor(settings.NoTonal ? nullptr : MakeGhaProcessor0(channels == 2, MakeGhaSettings(settings)))
+        , Lanes((settings.ParallelChannels && channels == 2) ? 2 : 1)
         , Settings(settings)
+        // The state (PQF, look-ahead and residual buffers, MDCT overlap and tones) depends
+        // on less than two frames and the delay, with the margin for the frame which brought it to rest
+        , Silence(channels, TAt3PEnc::NumSamples, 2 * (2 * TAt3PEnc::NumSamples + TAt3PEnc::Delay))
+        , SilentUnit(MakeSilentUnit(channels, frameSz))
     {
         delay.NumToneBands = 0;
     }
 
-    TPCMEngine::EProcessResult EncodeFrame(const float* data, int channels);
+    // data points to the first channel of the unit in the interleaved input with stride channels
+    TPCMEngine::EProcessResult EncodeFrame(const float* data, int stride, NBitStream::TBitStream& bs);
+    uint64_t GetSkippedFrames() const { return SkippedFrames; }
 private:
+    // Channel unit for zero spectrum without tones, encoded by own bitstream
+    // to keep the rate control of the main one untouched
+    NBitStream::TBitStream MakeSilentUnit(int channels, uint16_t frameSz) {
+        TAt3PBitStream bitStream(nullptr, frameSz);
+        const vector<float> zero(TAt3PEnc::NumSamples);
+        std::vector<TAt3PBitStream::TSingleChannelElement> sces(channels);
+        for (auto& sce : sces) {
+            sce.ScaledBlocks = Scaler.ScaleFrame(zero, NAt3p::TScaleTable::TBlockSizeMod());
+        }
+        NBitStream::TBitStream bs;
+        bitStream.EncodeUnit(channels, nullptr, sces, bs);
+        return bs;
+    }
+
+    static TGhaSettings MakeGhaSettings(const TSettings& settings) {
+        TGhaSettings res;
+        switch (settings.Speed) {
+            case ESpeed::Fastest:
+                res.Subbands = 2;
+                res.MaxTones = 16;
+                res.MaxRounds = 2;
+                res.ResidualThreshold = 1.2f;
+                res.LookAheadCheck = false;
+                res.WarmStart = true;
+                break;
+            case ESpeed::Fast:
+                res.Subbands = 4;
+                res.MaxTones = 32;
+                res.MaxRounds = 4;
+                res.ResidualThreshold = 1.1f;
+                res.WarmStart = true;
+                break;
+            case ESpeed::Default:
+                break;
+            case ESpeed::Slow:
+                res.ResidualThreshold = 1.02f;
+                break;
+        }
+        res.Threads = settings.GhaThreads;
+        res.WarmStart |= settings.GhaWarmStart;
+        return res;
+    }
+
     struct TChannelCtx {
         TChannelCtx()
             : PqfCtx(at3plus_pqf_create_a_ctx())
@@ -64,43 +119,70 @@ private:
         float Buf1[TAt3PEnc::NumSamples] = {0};
         float Buf2[TAt3PEnc::NumSamples] = {0};
         float PrevBuf[TAt3PEnc::NumSamples] = {0};
+        // MDCT keeps the result in the internal buffer, so each channel has own instance
+        TAt3pMDCT Mdct;
         TAt3pMDCT::THistBuf MdctBuf = {{{0}}};
         std::vector<float> Specs;
     };
 
-    TAt3pMDCT Mdct;
     TScaler<NAt3p::TScaleTable> Scaler;
     TAt3PBitStream BitStream;
     vector<TChannelCtx> ChannelCtx;
+    // Null if the tonal components search is disabled
     std::unique_ptr<IGhaProcessor> GhaProcessor;
+    // Two lanes to process channels of a stereo unit in parallel, one lane if disabled
+    TThreadPool Lanes;
     TAt3PGhaData delay;
     const TSettings Settings;
+    // Silent frames are not encoded, the precomputed channel unit is written instead
+    TSilenceDetector Silence;
+    const NBitStream::TBitStream SilentUnit;
+    uint64_t SkippedFrames = 0;
 };
 
 TPCMEngine::EProcessResult TAt3PEnc::TImpl::
-EncodeFrame(const float* data, int channels)
+EncodeFrame(const float* data, int stride, NBitStream::TBitStream& bs)
 {
-    int needMore = 0;
-    for (int ch = 0; ch < channels; ch++) {
+    const int channels = ChannelCtx.size();
+
+    if (Settings.SkipSilence) {
+        Silence.Push(data, stride);
+        // The frame to write is the previous one, it is silent too. Tones found in it
+        // are written with this frame, so they must be absent
+        if (Silence.IsSilent() && ChannelCtx[0].CurBuf && delay.NumToneBands == 0) {
+            TStageScope stage(EStage::Bitstream);
+            bs = SilentUnit;
+            SkippedFrames++;
+            return TPCMEngine::EProcessResult::PROCESSED;
+        }
+    }
+
+    // Channels meet only at the tonal components search and the bitstream,
+    // so stages before and after the search run on own lanes
+    bool needMore[2] = {false, false};
+    Lanes.ParallelFor(channels, [&](size_t ch, size_t) {
         float src[TAt3PEnc::NumSamples];
         for (size_t i = 0; i < NumSamples; ++i) {
-            src[i] = data[i * channels  + ch];
+            src[i] = data[i * stride + ch];
         }
 
-        at3plus_pqf_do_analyse(ChannelCtx[ch].PqfCtx, src, ChannelCtx[ch].NextBuf);
+        {
+            TStageScope stage(EStage::FilterBank);
+            at3plus_pqf_do_analyse(ChannelCtx[ch].PqfCtx, src, ChannelCtx[ch].NextBuf);
+        }
         if (ChannelCtx[ch].CurBuf == nullptr) {
             assert(ChannelCtx[ch].NextBuf == ChannelCtx[ch].Buf1);
             ChannelCtx[ch].CurBuf = ChannelCtx[ch].Buf2;
             std::swap(ChannelCtx[ch].NextBuf, ChannelCtx[ch].CurBuf);
-            needMore++;
+            needMore[ch] = true;
         }
-    }
+    });
 
-    if (needMore == channels) {
+    if (needMore[0]) {
         return TPCMEngine::EProcessResult::LOOK_AHEAD;
     }
 
-    assert(needMore == 0);
+    assert(channels == 1 || !needMore[1]);
 
     float* b1Prev = ChannelCtx[0].PrevBuf;
     const float* b1Cur = ChannelCtx[0].CurBuf;
@@ -115,17 +197,22 @@ EncodeFrame(const float* data, int channels)
         p = &delay;
     }
 
-    const TAt3PGhaData* tonalBlock = GhaProcessor->DoAnalize({b1Cur, b1Next}, {b2Cur, b2Next}, b1Prev, b2Prev);
+    // Without the search the previous buffers keep the input, it is the residual as is
+    const TAt3PGhaData* tonalBlock = nullptr;
+    if (GhaProcessor) {
+        TStageScope stage(EStage::Gha);
+        tonalBlock = GhaProcessor->DoAnalize({b1Cur, b1Next}, {b2Cur, b2Next}, b1Prev, b2Prev);
+    }
 
     std::vector<TAt3PBitStream::TSingleChannelElement> sces;
     sces.resize(channels);
-    for (int ch = 0; ch < channels; ch++) {
+    Lanes.ParallelFor(channels, [&](size_t ch, size_t) {
         float* x = (ch == 0) ? b1Prev : b2Prev;
         auto& c = ChannelCtx[ch];
         TAt3pMDCT::TPcmBandsData p;
         float tmp[2048];
         //TODO: scale window
-        if (Settings.UseGha & TSettings::GHA_WRITE_RESIUDAL) {
+        if (Settings.NoTonal || (Settings.UseGha & TSettings::GHA_WRITE_RESIUDAL)) {
             for (size_t i = 0; i < 2048; i++) {
                 //TODO: find why we need to add the 0.5db
                 tmp[i] = x[i] / (32768.0 / 1.122018);
@@ -139,15 +226,25 @@ EncodeFrame(const float* data, int channels)
             p[b] = tmp + b * 128;
         }
 
-        Mdct.Do(c.Specs.data(), p, c.MdctBuf, sces[ch].SubbandInfo.Win);
+        {
+            TStageScope stage(EStage::Mdct);
+            c.Mdct.Do(c.Specs.data(), p, c.MdctBuf, sces[ch].SubbandInfo.Win);
+        }
 
+        TStageScope stage(EStage::Scale);
         sces[ch].ScaledBlocks = Scaler.ScaleFrame(c.Specs, NAt3p::TScaleTable::TBlockSizeMod());
-    }
+    });
 
-    BitStream.WriteFrame(channels, p, sces);
+    {
+        // Bit allocation is a search over packing of the whole unit, both are measured together
+        TStageScope stage(EStage::BitAlloc);
+        const uint64_t iterations = BitStream.GetRateControlStat().Iterations;
+        BitStream.EncodeUnit(channels, p, sces, bs);
+        TStageStat::AddIterations(EStage::BitAlloc, BitStream.GetRateControlStat().Iterations - iterations);
+    }
 
     for (int ch = 0; ch < channels; ch++) {
-        if (Settings.UseGha & TSettings::GHA_PASS_INPUT) {
+        if (Settings.NoTonal || (Settings.UseGha & TSettings::GHA_PASS_INPUT)) {
             memcpy(ChannelCtx[ch].PrevBuf, ChannelCtx[ch].CurBuf, sizeof(float) * TAt3PEnc::NumSamples);
         } else {
             memset(ChannelCtx[ch].PrevBuf, 0, sizeof(float) * TAt3PEnc::NumSamples);
@@ -163,19 +260,182 @@ EncodeFrame(const float* data, int channels)
     return TPCMEngine::EProcessResult::PROCESSED;
 }
 
+static uint16_t GetUnitFrameSz(size_t numUnits, int unitChannels, uint16_t frameSz) {
+    // Mono unit of a multichannel frame gets half of the stereo unit size,
+    // the frame size must be multiple of 8
+    return (numUnits == 1 || unitChannels == 2) ? frameSz : (frameSz / 2) & ~7;
+}
+
+// Appends the first bits of src to dst
+static void AppendBits(NBitStream::TBitStream& dst, const NBitStream::TBitStream& src, size_t bits) {
+    const std::vector<char>& bytes = src.GetBytes();
+    size_t i = 0;
+    for (; i + 8 <= bits; i += 8) {
+        dst.Write((uint8_t)bytes[i / 8], 8);
+    }
+    if (i < bits) {
+        dst.Write((uint8_t)bytes[i / 8] >> (8 - (bits - i)), bits - i);
+    }
+}
+
 TAt3PEnc::TAt3PEnc(TCompressedOutputPtr&& out, int channels, TSettings settings)
     : Out(std::move(out))
     , Channels(channels)
-    , Impl(new TImpl(Out.get(), Channels, settings))
+    , FrameSz(GetMultichannelFrameSz(channels, settings.FrameSz))
 {
+    const std::vector<int> units = GetChannelUnits(channels);
+    if (units.empty()) {
+        throw std::runtime_error("unsupported number of channels for ATRAC3PLUS");
+    }
+
+    int firstChannel = 0;
+    for (int unitChannels : units) {
+        const uint16_t unitFrameSz = GetUnitFrameSz(units.size(), unitChannels, settings.FrameSz);
+        Units.push_back({std::unique_ptr<TImpl>(new TImpl(unitChannels, settings, unitFrameSz)), firstChannel});
+        firstChannel += unitChannels;
+    }
+
+    const std::vector<int> channelMap = GetChannelMap(channels);
+    for (int ch = 0; ch < channels; ch++) {
+        if (channelMap[ch] != ch) {
+            ChannelMap = channelMap;
+            UnitOrderBuf.resize(NumSamples * channels);
+            break;
+        }
+    }
+
+    if (Units.size() > 1) {
+        Pool.reset(new TThreadPool(Units.size()));
+    }
+}
+
+TAt3PEnc::~TAt3PEnc() = default;
+
+TPCMEngine::EProcessResult TAt3PEnc::EncodeFrame(const float* data)
+{
+    if (!ChannelMap.empty()) {
+        for (size_t i = 0; i < NumSamples; i++) {
+            for (int ch = 0; ch < Channels; ch++) {
+                UnitOrderBuf[i * Channels + ch] = data[i * Channels + ChannelMap[ch]];
+            }
+        }
+        data = UnitOrderBuf.data();
+    }
+
+    std::vector<NBitStream::TBitStream> bs(Units.size());
+    std::vector<TPCMEngine::EProcessResult> res(Units.size());
+
+    auto encodeUnit = [&](size_t unit, size_t) {
+        res[unit] = Units[unit].Impl->EncodeFrame(data + Units[unit].FirstChannel, Channels, bs[unit]);
+    };
+
+    if (Pool) {
+        Pool->ParallelFor(Units.size(), encodeUnit);
+    } else {
+        encodeUnit(0, 0);
+    }
+
+    // All units are fed with the same number of samples
+    if (res[0] == TPCMEngine::EProcessResult::LOOK_AHEAD) {
+        return res[0];
+    }
+
+    NBitStream::TBitStream frame;
+    // First bit must be zero
+    frame.Write(0, 1);
+
+    // Each unit ends with the terminator, it is kept only for the last one
+    for (size_t i = 0; i < bs.size(); i++) {
+        const size_t terminatorBits = (i + 1 == bs.size()) ? 0 : 2;
+        AppendBits(frame, bs[i], bs[i].GetSizeInBits() - terminatorBits);
+    }
+
+    assert(frame.GetSizeInBits() <= FrameSz * 8u);
+
+    std::vector<char> buf = frame.GetBytes();
+    buf.resize(FrameSz);
+    TStageScope stage(EStage::Container);
+    Out->WriteFrame(buf);
+
+    return TPCMEngine::EProcessResult::PROCESSED;
+}
+
+uint64_t TAt3PEnc::GetSkippedFrames() const {
+    uint64_t res = 0;
+    for (const auto& unit : Units) {
+        res += unit.Impl->GetSkippedFrames();
+    }
+    return res;
 }
 
 TPCMEngine::TProcessLambda TAt3PEnc::GetLambda() {
     return [this](float* data, const TPCMEngine::ProcessMeta&) {
-        return Impl->EncodeFrame(data, Channels);
+        return EncodeFrame(data);
     };
 }
 
+std::vector<int> TAt3PEnc::GetChannelUnits(int channels) {
+    // Channel unit layouts expected by the decoder, 5 channels has no layout
+    switch (channels) {
+        case 1: return {1};
+        case 2: return {2};
+        case 3: return {2, 1};
+        case 4: return {2, 1, 1};
+        case 6: return {2, 1, 2, 1};
+        case 7: return {2, 1, 2, 1, 1};
+        case 8: return {2, 1, 2, 2, 1};
+        default: return {};
+    }
+}
+
+std::vector<int> TAt3PEnc::GetChannelMap(int channels) {
+    // The decoder routes channel k of the units to the output channel map[k],
+    // LFE is carried by the last mono unit
+    switch (channels) {
+        case 6: return {0, 1, 2, 4, 5, 3};
+        case 7: return {0, 1, 2, 4, 5, 6, 3};
+        case 8: return {0, 1, 2, 4, 5, 6, 7, 3};
+        default: {
+            std::vector<int> res(std::max(channels, 0));
+            for (int ch = 0; ch < channels; ch++) {
+                res[ch] = ch;
+            }
+            return res;
+        }
+    }
+}
+
+uint16_t TAt3PEnc::GetMultichannelFrameSz(int channels, uint16_t frameSz) {
+    const std::vector<int> units = GetChannelUnits(channels);
+    uint16_t res = 0;
+    for (int unitChannels : units) {
+        res += GetUnitFrameSz(units.size(), unitChannels, frameSz);
+    }
+    return res;
+}
+
+uint16_t TAt3PEnc::GetFrameSzForBitrate(uint32_t bitrate) {
+    struct TBitrate {
+        uint32_t Kbps;
+        uint16_t FrameSz;
+    };
+    static const TBitrate bitrates[] = {
+        {48, 280}, {64, 376}, {96, 560}, {128, 744}, {160, 936},
+        {192, 1120}, {256, 1488}, {320, 1864}, {352, 2048}
+    };
+    static const size_t num = sizeof(bitrates) / sizeof(bitrates[0]);
+
+    if (bitrate == 0) {
+        return bitrates[num - 1].FrameSz;
+    }
+    for (size_t i = 0; i < num; i++) {
+        if (bitrates[i].Kbps >= bitrate) {
+            return bitrates[i].FrameSz;
+        }
+    }
+    return bitrates[num - 1].FrameSz;
+}
+
 static void SetGha(const std::string& str, TAt3PEnc::TSettings& settings) {
     int mask = std::stoi(str);
     if (mask > 7 || mask < 0) {
@@ -192,12 +452,47 @@ static void SetGha(const std::string& str, TAt3PEnc::TSettings& settings) {
     settings.UseGha = mask;
 }
 
+static void SetGhaThreads(const std::string& str, TAt3PEnc::TSettings& settings) {
+    int threads = std::stoi(str);
+    if (threads > 64 || threads < 1) {
+        throw std::runtime_error("invalid number of GHA threads");
+    }
+
+    settings.GhaThreads = threads;
+}
+
+static void SetGhaWarmStart(const std::string& str, TAt3PEnc::TSettings& settings) {
+    int warm = std::stoi(str);
+    if (warm > 1 || warm < 0) {
+        throw std::runtime_error("invalid value of GHA warm start flag");
+    }
+
+    settings.GhaWarmStart = warm;
+}
+
+static void SetNoTonal(const std::string& str, TAt3PEnc::TSettings& settings) {
+    int noTonal = std::stoi(str);
+    if (noTonal > 1 || noTonal < 0) {
+        throw std::runtime_error("invalid value of the no tonal components flag");
+    }
+
+    settings.NoTonal = noTonal;
+}
+
+static void SetSpeed(const std::string& str, TAt3PEnc::TSettings& settings) {
+    settings.Speed = ParseSpeed(str);
+}
+
 
 
 void TAt3PEnc::ParseAdvancedOpt(const char* opt, TSettings& settings) {
     typedef void (*processFn)(const std::string& str, TSettings& settings);
     static std::unordered_map<std::string, processFn> keys {
-        {"ghadbg", &SetGha}
+        {"ghadbg", &SetGha},
+        {"ghathreads", &SetGhaThreads},
+        {"ghawarm", &SetGhaWarmStart},
+        {"notonal", &SetNoTonal},
+        {"speed", &SetSpeed}
     };
 
     if (opt == nullptr)
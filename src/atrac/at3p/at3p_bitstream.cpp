@@ -20,14 +20,18 @@
 #include "at3p_bitstream.h"
 #include "at3p_gha.h"
 #include "at3p_tables.h"
+#include <atrac/atrac_psy_common.h>
 #include <env.h>
 #include <util.h>
 
 #include "ff/atrac3plus_data.h"
 
+#include <algorithm>
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <stdexcept>
+#include <string>
 
 namespace NAtracDEnc {
 
@@ -92,28 +96,53 @@ TTonePackResult CreateFreqBitPack(const TAt3PGhaData::TWaveParam* const param, i
     }
 }
 
-uint32_t TDumper::GetConsumption() const noexcept
+// Min number of quant units which cover the given tone bands,
+// tones are synthesized only in the subbands covered by the quant units
+static uint32_t GetToneQuantUnits(uint32_t numToneBands) noexcept
 {
-    return std::accumulate(Buf.begin(), Buf.end(), 0,
-        [](uint32_t acc, const std::pair<uint16_t, uint8_t>& x) noexcept -> uint32_t { return acc + x.second; });
+    uint32_t numQuantUnits = 1;
+    while (atrac3p_qu_to_subband[numQuantUnits - 1] + 1u < numToneBands) {
+        numQuantUnits++;
+    }
+    return numQuantUnits;
 }
 
-IBitStreamPartEncoder::EStatus TConfigure::Encode(void* frameData, TBitAllocHandler&)
+void TConfigure::Setup(TSpecFrame* frame, float shift)
 {
-    TSpecFrame* frame = TSpecFrame::Cast(frameData);
-
-    frame->WordLen.resize(frame->NumQuantUnits);
+    static const uint8_t fixedAllocTable[32] = {
+        7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7,
+        7, 6, 6, 6, 6, 6, 6, 6,
+        6, 6, 5, 5, 4, 3, 2, 1
+    };
+
+    const size_t chNum = frame->Chs.size();
+    frame->WordLen.resize(frame->MaxQuantUnits);
+    frame->UsedQuantUnits = 0;
+
+    for (size_t i = 0; i < frame->MaxQuantUnits; i++) {
+        int wl[2] = {0, 0};
+        for (size_t ch = 0; ch < chNum; ch++) {
+            const float sf = frame->Chs[ch].Sce.ScaledBlocks.at(i).ScaleFactorIndex;
+            const int tmp = Spread[ch] * (sf / 3.2f) + (1.0f - Spread[ch]) * fixedAllocTable[i] - shift;
+            wl[ch] = std::min(std::max(tmp, 0), 7);
+        }
+        if (chNum == 1) {
+            wl[1] = wl[0];
+        }
+        frame->WordLen[i].first = wl[0];
+        frame->WordLen[i].second = wl[1];
+        if (wl[0] || wl[1]) {
+            frame->UsedQuantUnits = i + 1;
+        }
+    }
 
-    for (size_t i = 0; i < frame->WordLen.size(); i++) {
-        static uint8_t allocTable[32] = {
-            7, 7, 7, 7, 7, 7, 7, 7,
-            7, 7, 7, 7, 7, 7, 7, 7,
-            7, 6, 6, 6, 6, 6, 6, 6,
-            6, 6, 5, 5, 4, 3, 2, 1
-        };
-        frame->WordLen[i].first = allocTable[i];
-        frame->WordLen[i].second = allocTable[i];
+    uint32_t numQuantUnits = std::max(frame->UsedQuantUnits, 1u);
+    if (frame->TonalBlock) {
+        numQuantUnits = std::max(numQuantUnits, GetToneQuantUnits(frame->TonalBlock->NumToneBands));
     }
+    frame->NumQuantUnits = numQuantUnits;
+    frame->WordLen.resize(frame->NumQuantUnits);
 
     frame->SfIdx.resize(frame->NumQuantUnits);
 
@@ -124,6 +153,24 @@ IBitStreamPartEncoder::EStatus TConfigure::Encode(void* frameData, TBitAllocHand
     }
 
     frame->SpecTabIdx.resize(frame->NumQuantUnits);
+}
+
+IBitStreamPartEncoder::EStatus TConfigure::Encode(void* frameData, TBitAllocHandler& ba)
+{
+    TSpecFrame* frame = TSpecFrame::Cast(frameData);
+
+    // The search is started once per frame, next attempts continue it
+    if (!AllocStarted || frame->RestartAlloc) {
+        for (size_t ch = 0; ch < frame->Chs.size(); ch++) {
+            Spread[ch] = AnalizeScaleFactorSpread(frame->Chs[ch].Sce.ScaledBlocks);
+        }
+        ba.Start(frame->SizeBits, MinShift, MaxShift);
+        AllocStarted = true;
+        frame->RestartAlloc = false;
+    }
+
+    frame->Shift = ba.Continue();
+    Setup(frame, frame->Shift);
 
     Insert(frame->NumQuantUnits - 1, 5);
     Insert(0, 1); //mute flag
@@ -133,6 +180,13 @@ IBitStreamPartEncoder::EStatus TConfigure::Encode(void* frameData, TBitAllocHand
     return EStatus::Ok;
 }
 
+void TConfigure::AddCost(TSpecFrame* frame, TQuantUnitsCost& cost)
+{
+    for (size_t n = 1; n <= frame->NumQuantUnits; n++) {
+        cost[n] += 5 + 1;
+    }
+}
+
 size_t FindBestWlDeltaEncode(const int8_t* delta, uint32_t sz, size_t tableStart, size_t tableEndl) noexcept {
     size_t best = 0;
     size_t consumed = std::numeric_limits<size_t>::max();
@@ -246,10 +300,66 @@ IBitStreamPartEncoder::EStatus TWordLenEncoder::Encode(void* frameData, TBitAllo
     return EStatus::Ok;
 }
 
+void TWordLenEncoder::AddCost(TSpecFrame* frame, TQuantUnitsCost& cost)
+{
+    // The same choice of table as FindBestWlDeltaEncode does, but for each prefix of deltas
+    auto bestTabBits = [](const uint32_t bits[4], int8_t maxDelta) noexcept {
+        size_t tableStart, tableEnd;
+        if (maxDelta >= 3) {
+            tableStart = 2;
+            tableEnd = 3;
+        } else if (maxDelta == 2) {
+            tableStart = 1;
+            tableEnd = 1;
+        } else {
+            tableStart = 0;
+            tableEnd = 0;
+        }
+        uint32_t best = bits[tableStart];
+        for (size_t i = tableStart + 1; i <= tableEnd; i++) {
+            best = std::min(best, bits[i]);
+        }
+        return best;
+    };
+
+    const auto& wordLen = frame->WordLen;
+    uint32_t bitsCh0[4] = {0};
+    uint32_t bitsInterCh[4] = {0};
+    int8_t maxDeltaCh0 = 0;
+    int8_t maxInterChDelta;
+
+    {
+        int8_t t = wordLen[0].second - wordLen[0].first;
+        maxInterChDelta = abs(t);
+        for (size_t tab = 0; tab < 4; tab++) {
+            bitsInterCh[tab] += HuffTabs.WordLens[tab][t & 7].Len;
+        }
+    }
+
+    for (size_t n = 1; n <= frame->NumQuantUnits; n++) {
+        if (n > 1) {
+            const size_t i = n - 1;
+            int8_t deltaCh0 = wordLen[i].first - wordLen[i-1].first;
+            int8_t t = wordLen[i].second - wordLen[i].first;
+            maxDeltaCh0 |= abs(deltaCh0);
+            maxInterChDelta |= abs(t);
+            for (size_t tab = 0; tab < 4; tab++) {
+                bitsCh0[tab] += HuffTabs.WordLens[tab][deltaCh0 & 7].Len;
+                bitsInterCh[tab] += HuffTabs.WordLens[tab][t & 7].Len;
+            }
+        }
+
+        cost[n] += 2 + 2 + 2 + 2 + 3 + bestTabBits(bitsCh0, maxDeltaCh0);
+        if (frame->Chs.size() == 2) {
+            cost[n] += 2 + 2 + 2 + bestTabBits(bitsInterCh, maxInterChDelta);
+        }
+    }
+}
+
 IBitStreamPartEncoder::EStatus TSfIdxEncoder::Encode(void* frameData, TBitAllocHandler&) {
     auto specFrame = TSpecFrame::Cast(frameData);
 
-    if (specFrame->SfIdx.empty()) {
+    if (specFrame->SfIdx.empty() || specFrame->UsedQuantUnits == 0) {
         return EStatus::Ok;
     }
 
@@ -258,11 +368,11 @@ IBitStreamPartEncoder::EStatus TSfIdxEncoder::Encode(void* frameData, TBitAllocH
         Insert(0, 2); // 0 - constant number of bits
 
         if (ch == 0) {
-            for (size_t i = 0; i < specFrame->NumQuantUnits; i++) {
+            for (size_t i = 0; i < specFrame->UsedQuantUnits; i++) {
                 Insert(specFrame->SfIdx[i].first, 6);
             }
         } else {
-            for (size_t i = 0; i < specFrame->NumQuantUnits; i++) {
+            for (size_t i = 0; i < specFrame->UsedQuantUnits; i++) {
                 Insert(specFrame->SfIdx[i].second, 6);
             }
         }
@@ -271,34 +381,58 @@ IBitStreamPartEncoder::EStatus TSfIdxEncoder::Encode(void* frameData, TBitAllocH
     return EStatus::Ok;
 }
 
+void TSfIdxEncoder::AddCost(TSpecFrame* frame, TQuantUnitsCost& cost)
+{
+    const size_t chNum = frame->Chs.size();
+    uint32_t usedQuantUnits = 0;
+    for (size_t n = 1; n <= frame->NumQuantUnits; n++) {
+        if (frame->WordLen[n - 1].first || frame->WordLen[n - 1].second) {
+            usedQuantUnits = n;
+        }
+        if (usedQuantUnits) {
+            cost[n] += chNum * (2 + 6 * usedQuantUnits);
+        }
+    }
+}
+
 void TQuantUnitsEncoder::EncodeCodeTab(bool useFullTable, size_t channels,
-    size_t numQuantUnits, const std::vector<std::pair<uint8_t, uint8_t>>& specTabIdx,
-    std::vector<std::pair<uint16_t, uint8_t>>& data)
+    size_t numQuantUnits, const std::vector<std::pair<uint8_t, uint8_t>>& wordLen,
+    const std::vector<std::pair<uint8_t, uint8_t>>& specTabIdx,
+    NBitStream::TBitBuffer& data)
 {
-    data.emplace_back(useFullTable, 1); // use full table
+    data.Write(useFullTable, 1); // use full table
 
     for (size_t ch = 0; ch < channels; ch++) {
 
-        data.emplace_back(0, 1); // table type
+        data.Write(0, 1); // table type
 
-        data.emplace_back(0, 2); // 0 - constant number of bits
+        data.Write(0, 2); // 0 - constant number of bits
 
-        data.emplace_back(0, 1); // num_coded_vals equal to used_quant_units
+        data.Write(0, 1); // num_coded_vals equal to used_quant_units
 
+        // No table for units without spectrum, the second channel has 1 bit flag
+        // instead (0 - copy the spectrum of the first channel)
         if (ch == 0) {
             for (size_t i = 0; i < numQuantUnits; i++) {
-                data.emplace_back(specTabIdx[i].first, useFullTable + 2);
+                if (wordLen[i].first) {
+                    data.Write(specTabIdx[i].first, useFullTable + 2);
+                }
             }
         } else {
             for (size_t i = 0; i < numQuantUnits; i++) {
-                data.emplace_back(specTabIdx[i].second, useFullTable + 2);
+                if (wordLen[i].second) {
+                    data.Write(specTabIdx[i].second, useFullTable + 2);
+                } else if (wordLen[i].first) {
+                    data.Write(1, 1);
+                }
             }
         }
     }
 }
 
-void TQuantUnitsEncoder::EncodeQuSpectra(const int* qspec, const size_t num_spec, const size_t idx,
-    std::vector<std::pair<uint16_t, uint8_t>>& data) {
+// Calls out(code, len) for each code of the quantized spectrum
+template<class TOut>
+static void VisitQuSpectra(const int* qspec, const size_t num_spec, const size_t idx, TOut&& out) {
     const Atrac3pSpecCodeTab *tab = &atrac3p_spectra_tabs[idx];
     const std::array<TVlcElement, 256>& vlcTab = HuffTabs.VlcSpecs[idx];
 
@@ -312,7 +446,7 @@ void TQuantUnitsEncoder::EncodeQuSpectra(const int* qspec, const size_t num_spec
             // TODO: Acording to FFmpeg it should be possible
             // to skip group, if all rest of coeffs is zero
             // but this should be checked with real AT3P decoder
-            data.emplace_back(1, 1);
+            out(1, 1);
         }
 
         for (size_t j = 0; j < groupSize; j++) {
@@ -342,13 +476,13 @@ void TQuantUnitsEncoder::EncodeQuSpectra(const int* qspec, const size_t num_spec
 
             const TVlcElement& el = vlcTab.at(val);
 
-            data.emplace_back(el.Code, el.Len);
+            out(el.Code, el.Len);
             for (size_t i = 0; i < 4; i++) {
                 if (signs[i] != 0) {
                     if (signs[i] > 0) {
-                        data.emplace_back(0, 1);
+                        out(0, 1);
                     } else {
-                        data.emplace_back(1, 1);
+                        out(1, 1);
                     }
                 }
             }
@@ -356,121 +490,169 @@ void TQuantUnitsEncoder::EncodeQuSpectra(const int* qspec, const size_t num_spec
     }
 }
 
-size_t TQuantUnitsEncoder::TUnit::MakeKey(size_t ch, size_t qu, size_t worlen) {
-    ASSERT(qu < 32);
-    ASSERT(worlen < 8);
-    return (ch << 8) | (qu << 3) | worlen;
+void TQuantUnitsEncoder::EncodeQuSpectra(const int* qspec, const size_t num_spec, const size_t idx,
+    NBitStream::TBitBuffer& data) {
+    VisitQuSpectra(qspec, num_spec, idx,
+        [&data](uint16_t code, uint8_t len) noexcept { data.Write(code, len); });
 }
 
-TQuantUnitsEncoder::TUnit::TUnit(size_t qu, size_t wordlen)
-    : Wordlen(wordlen)
-    , Multiplier(1.0f / atrac3p_mant_tab[wordlen])
-{
-    Mantisas.resize(TScaleTable::SpecsPerBlock[qu]);
+uint32_t TQuantUnitsEncoder::GetQuSpectraBits(const int* qspec, const size_t num_spec, const size_t idx) {
+    uint32_t bits = 0;
+    VisitQuSpectra(qspec, num_spec, idx,
+        [&bits](uint16_t, uint8_t len) noexcept { bits += len; });
+    return bits;
 }
 
-size_t TQuantUnitsEncoder::TUnit::GetOrCompute(const float* val, std::vector<std::pair<uint16_t, uint8_t>>& res)
+TQuantUnitsEncoder::TQuantUnitsEncoder()
 {
-    QuantMantisas(val, 0, Mantisas.size(), Multiplier, false, Mantisas.data());
-
-    std::vector<std::pair<uint16_t, uint8_t>> tmp;
-
-    size_t bestTab = 0;
-    size_t consumed = std::numeric_limits<size_t>::max();
+    static_assert(MaxSpecsPerUnit == TScaleTable::SpecsPerBlock[31], "unexpected max unit size");
+}
 
-    for (size_t i = 0, tabIndex = Wordlen - 1; i < 8; i++, tabIndex += 7) {
+size_t TQuantUnitsEncoder::TUnit::GetOrCompute(const float* val, size_t qu, size_t wordlen,
+    uint32_t generation, int* mantisas)
+{
+    if (Generation == generation) {
+        return TabIdx;
+    }
 
-        EncodeQuSpectra(Mantisas.data(), Mantisas.size(), tabIndex, tmp);
+    const size_t numSpecs = TScaleTable::SpecsPerBlock[qu];
+    QuantMantisas(val, 0, numSpecs, 1.0f / atrac3p_mant_tab[wordlen], false, mantisas);
 
-        size_t t = std::accumulate(tmp.begin(), tmp.end(), 0,
-            [](size_t acc, const std::pair<uint8_t, uint16_t>& x) noexcept -> size_t
-                { return acc + x.second; });
+    uint32_t consumed = std::numeric_limits<uint32_t>::max();
 
+    // Only the best table is written
+    for (size_t i = 0, tabIndex = wordlen - 1; i < 8; i++, tabIndex += 7) {
+        const uint32_t t = GetQuSpectraBits(mantisas, numSpecs, tabIndex);
         if (t < consumed) {
             consumed = t;
-            ConsumedBits = t;
-            bestTab = i;
-            res.clear();
-            res.swap(tmp);
-            tmp.clear();
-        } else {
-            tmp.clear();
+            TabIdx = i;
         }
     }
-    return bestTab;
+
+    Bits.Clear();
+    EncodeQuSpectra(mantisas, numSpecs, wordlen - 1 + 7 * TabIdx, Bits);
+
+    Generation = generation;
+    return TabIdx;
 }
 
-IBitStreamPartEncoder::EStatus TQuantUnitsEncoder::Encode(void* frameData, TBitAllocHandler&)
+void TQuantUnitsEncoder::NextGeneration() noexcept
 {
-    auto specFrame = TSpecFrame::Cast(frameData);
-    std::vector<
-            std::vector<std::pair<uint16_t, uint8_t>>> data;
-    for (size_t ch = 0; ch < specFrame->Chs.size(); ch++) {
-        auto& chData = specFrame->Chs.at(ch);
-        auto scaledBlocks = chData.Sce.ScaledBlocks;
+    if (++Generation == 0) {
+        for (auto& unit : Units) {
+            unit.ResetGeneration();
+        }
+        Generation = 1;
+    }
+}
 
-        for (size_t qu = 0; qu < specFrame->NumQuantUnits; qu++) {
-            size_t len = (ch == 0) ?
-                specFrame->WordLen.at(qu).first :
-                specFrame->WordLen.at(qu).second;
+size_t TQuantUnitsEncoder::EncodeUnit(const TSpecFrame* frame, size_t ch, size_t qu)
+{
+    const size_t len = (ch == 0) ?
+        frame->WordLen.at(qu).first :
+        frame->WordLen.at(qu).second;
 
-            size_t key = TUnit::MakeKey(ch, qu, len);
+    const float* values = frame->Chs[ch].Sce.ScaledBlocks.at(qu).Values.data();
 
-            TUnit* unit;
-            //  try_emplace
-            auto it = UnitBuffers.find(key);
-            if (it == UnitBuffers.end()) {
-                unit = &(UnitBuffers.emplace(key, TUnit(qu, len)).first->second);
-            } else {
-                unit = &it->second;
-            }
+    return GetUnit(ch, qu, len).GetOrCompute(values, qu, len, Generation, Mantisas.data());
+}
 
-            const float* values = scaledBlocks.at(qu).Values.data();
+IBitStreamPartEncoder::EStatus TQuantUnitsEncoder::Encode(void* frameData, TBitAllocHandler&)
+{
+    auto specFrame = TSpecFrame::Cast(frameData);
 
-            data.push_back(std::vector<std::pair<uint16_t, uint8_t>>());
-            auto tabIdx = unit->GetOrCompute(values, data.back());
+    const size_t numQuantUnits = specFrame->UsedQuantUnits;
+    if (numQuantUnits == 0) {
+        return EStatus::Ok;
+    }
 
+    // Units already encoded by the previous attempts of this frame
+    // are taken from the cache
+    for (size_t ch = 0; ch < specFrame->Chs.size(); ch++) {
+        for (size_t qu = 0; qu < numQuantUnits; qu++) {
+            const size_t len = (ch == 0) ?
+                specFrame->WordLen[qu].first :
+                specFrame->WordLen[qu].second;
+            if (len == 0) {
+                continue;
+            }
+            const size_t tabIdx = EncodeUnit(specFrame, ch, qu);
             if (ch == 0) {
                 specFrame->SpecTabIdx[qu].first = tabIdx;
             } else {
                 specFrame->SpecTabIdx[qu].second = tabIdx;
             }
         }
-        if (true /*frame.NumUsedQuantUnits > 2*/) {
-            size_t numPwrSpec = atrac3p_subband_to_num_powgrps[atrac3p_qu_to_subband[specFrame->NumQuantUnits - 1]];
-            data.push_back(std::vector<std::pair<uint16_t, uint8_t>>());
-            auto& t = data.back();
+    }
+
+    EncodeCodeTab(true, specFrame->Chs.size(), numQuantUnits, specFrame->WordLen, specFrame->SpecTabIdx, Buf);
+
+    for (size_t ch = 0; ch < specFrame->Chs.size(); ch++) {
+        for (size_t qu = 0; qu < numQuantUnits; qu++) {
+            const size_t len = (ch == 0) ?
+                specFrame->WordLen[qu].first :
+                specFrame->WordLen[qu].second;
+            if (len) {
+                Insert(GetUnit(ch, qu, len).GetBits());
+            }
+        }
+        // Power compensation levels, present only if more than 2 units are used
+        if (numQuantUnits > 2) {
+            size_t numPwrSpec = atrac3p_subband_to_num_powgrps[atrac3p_qu_to_subband[numQuantUnits - 1]];
             for (size_t i = 0; i < numPwrSpec; i++) {
-                t.emplace_back(15, 4);
+                Insert(15, 4);
             }
         }
     }
 
-    {
-        std::vector<std::pair<uint16_t, uint8_t>> tabIdxData;
-        EncodeCodeTab(true, specFrame->Chs.size(), specFrame->NumQuantUnits, specFrame->SpecTabIdx, tabIdxData);
-        for (size_t i = 0; i < tabIdxData.size(); i++) {
-            Insert(tabIdxData[i].first, tabIdxData[i].second);
-        }
-    }
+    return EStatus::Ok;
+}
 
-    for (const auto& x : data) {
-        for (size_t i = 0; i < x.size(); i++) {
-            Insert(x[i].first, x[i].second);
+void TQuantUnitsEncoder::AddCost(TSpecFrame* frame, TQuantUnitsCost& cost)
+{
+    const size_t chNum = frame->Chs.size();
+    uint32_t usedQuantUnits = 0;
+    // Code tables and spectrum of the units up to the current one
+    uint32_t unitsBits = 0;
+    for (size_t n = 1; n <= frame->NumQuantUnits; n++) {
+        const size_t qu = n - 1;
+        const auto& wl = frame->WordLen[qu];
+        for (size_t ch = 0; ch < chNum; ch++) {
+            const size_t len = (ch == 0) ? wl.first : wl.second;
+            if (len) {
+                EncodeUnit(frame, ch, qu);
+                unitsBits += 3 + GetUnit(ch, qu, len).GetConsumedBits();
+            } else if (ch == 1 && wl.first) {
+                unitsBits += 1;
+            }
+        }
+        if (wl.first || wl.second) {
+            usedQuantUnits = n;
+        }
+        if (usedQuantUnits == 0) {
+            continue;
+        }
+        cost[n] += 1 + chNum * (1 + 2 + 1) + unitsBits;
+        if (usedQuantUnits > 2) {
+            const size_t numPwrSpec = atrac3p_subband_to_num_powgrps[atrac3p_qu_to_subband[usedQuantUnits - 1]];
+            cost[n] += chNum * 4 * numPwrSpec;
         }
     }
-
-    return EStatus::Ok;
 }
 
 static std::vector<IBitStreamPartEncoder::TPtr> CreateEncParts()
 {
+    std::vector<TDumper*> stages;
+    stages.push_back(new TConfigure());
+    stages.push_back(new TWordLenEncoder());
+    stages.push_back(new TSfIdxEncoder());
+    stages.push_back(new TQuantUnitsEncoder());
+
     vector<IBitStreamPartEncoder::TPtr> parts;
-    parts.emplace_back(new TConfigure());
-    parts.emplace_back(new TWordLenEncoder());
-    parts.emplace_back(new TSfIdxEncoder());
-    parts.emplace_back(new TQuantUnitsEncoder());
-    parts.emplace_back(new TTonalComponentEncoder());
+    for (TDumper* stage : stages) {
+        parts.emplace_back(stage);
+    }
+    parts.emplace_back(new TTonalComponentEncoder(std::move(stages)));
 
     return parts;
 }
@@ -628,35 +810,26 @@ void TTonalComponentEncoder::WriteTonalBlock(size_t channels, const TAt3PGhaData
     }
 }
 
-IBitStreamPartEncoder::EStatus TTonalComponentEncoder::CheckFrameDone(TSpecFrame* frame, TBitAllocHandler& ba) noexcept
+uint32_t TTonalComponentEncoder::GetWinFlagsBits(const TSpecFrame* frame, uint32_t numQuantUnits) noexcept
 {
-    uint32_t totalConsumption = BitsUsed + ba.GetCurGlobalConsumption();
-
-    if (totalConsumption > frame->SizeBits) {
-        if (frame->NumQuantUnits == 32) {
-            frame->NumQuantUnits = 28;
+    const uint8_t sbNum = atrac3p_qu_to_subband[numQuantUnits - 1] + 1;
+    uint32_t bits = 0;
+    for (const auto& ch : frame->Chs) {
+        const TAt3pMDCTWin& winType = ch.Sce.SubbandInfo.Win;
+        if (winType.IsAllSine()) {
+            bits += 1;
+        } else if (winType.IsAllSteep(sbNum)) {
+            bits += 2;
         } else {
-            frame->NumQuantUnits--;
+            bits += 2 + sbNum;
         }
-        return EStatus::Repeat;
     }
-    return EStatus::Ok;
+    return bits;
 }
 
-IBitStreamPartEncoder::EStatus TTonalComponentEncoder::Encode(void* frameData, TBitAllocHandler& ba)
+void TTonalComponentEncoder::WriteAll(TSpecFrame* specFrame)
 {
-    auto specFrame = TSpecFrame::Cast(frameData);
     auto tonalBlock = specFrame->TonalBlock;
-
-    // Check tonal component already encoded
-    if (BitsUsed != 0) {
-        if (tonalBlock && tonalBlock->NumToneBands > specFrame->NumQuantUnits) {
-            std::cerr << "TODO" << std::endl;
-            abort();
-        }
-        return CheckFrameDone(specFrame, ba);
-    }
-
     const size_t chNum = specFrame->Chs.size();
 
     if (chNum == 2) {
@@ -694,28 +867,111 @@ IBitStreamPartEncoder::EStatus TTonalComponentEncoder::Encode(void* frameData, T
     Insert(0, 1); // no noise info
     // Terminator
     Insert(3, 2);
+}
 
-    BitsUsed = GetConsumption();
+IBitStreamPartEncoder::EStatus TTonalComponentEncoder::Encode(void* frameData, TBitAllocHandler& ba)
+{
+    auto specFrame = TSpecFrame::Cast(frameData);
+    auto tonalBlock = specFrame->TonalBlock;
+
+    if (tonalBlock && tonalBlock->NumToneBands > specFrame->NumQuantUnits) {
+        std::cerr << "TODO" << std::endl;
+        abort();
+    }
+
+    WriteAll(specFrame);
+
+    // The last stage, consumption of the whole frame is known here
+    const uint32_t consumption = GetConsumption() + ba.GetCurGlobalConsumption();
+    ba.Submit(consumption);
+
+    // Consumption does not grow with the shift, so if the frame does not fit
+    // with the max shift (all word lengths are zero) no shift fits it. The frame
+    // is too big because of the tonal block and the quant units the tones require,
+    // reduce it and start the search again.
+    if (consumption > specFrame->SizeBits && specFrame->Shift >= TConfigure::MaxShift) {
+        Buf.Clear();
+        if (!ReduceFrame(specFrame)) {
+            throw std::runtime_error("ATRAC3PLUS: unable to fit the frame in to "
+                + std::to_string(specFrame->SizeBits) + " bits");
+        }
+        // Stages before this one are reset by the encoder
+        return EStatus::Repeat;
+    }
+
+    return EStatus::Ok;
+}
 
-    return CheckFrameDone(specFrame, ba);
+void TTonalComponentEncoder::AddCost(TSpecFrame* frame, TQuantUnitsCost& cost)
+{
+    // Only window flags depend on the number of quant units
+    WriteAll(frame);
+    const uint32_t bits = GetConsumption() - GetWinFlagsBits(frame, frame->NumQuantUnits);
+    Buf.Clear();
+
+    for (size_t n = 1; n <= frame->NumQuantUnits; n++) {
+        cost[n] += bits + GetWinFlagsBits(frame, n);
+    }
 }
 
-void TAt3PBitStream::WriteFrame(int channels, const TAt3PGhaData* tonalBlock, const std::vector<TSingleChannelElement>& sces)
+bool TTonalComponentEncoder::ReduceFrame(TSpecFrame* frame)
+{
+    // Cost of the frame without the tonal part, the word lengths are the ones
+    // of the current attempt, so the chosen frame fits with the max shift
+    TQuantUnitsCost base = {};
+    for (TDumper* stage : PrevStages) {
+        stage->AddCost(frame, base);
+    }
+
+    const TAt3PGhaData* tonalBlock = frame->TonalBlock;
+    const uint32_t numToneBands = tonalBlock ? tonalBlock->NumToneBands : 0;
+    if (tonalBlock) {
+        ReducedTonal = *tonalBlock;
+    }
+
+    // Keep as many tone bands as fit, the number of quant units follows them
+    for (uint32_t bands = numToneBands; bands-- > 0;) {
+        ReducedTonal.NumToneBands = bands;
+        frame->TonalBlock = bands ? &ReducedTonal : nullptr;
+
+        const uint32_t numQuantUnits = std::max(frame->UsedQuantUnits,
+            bands ? GetToneQuantUnits(bands) : 1u);
+
+        TQuantUnitsCost cost = base;
+        AddCost(frame, cost);
+        if (cost[numQuantUnits] <= frame->SizeBits) {
+            frame->RestartAlloc = true;
+            return true;
+        }
+    }
+
+    frame->TonalBlock = tonalBlock;
+    return false;
+}
+
+void TAt3PBitStream::EncodeUnit(int channels, const TAt3PGhaData* tonalBlock, const std::vector<TSingleChannelElement>& sces,
+    NBitStream::TBitStream& bitStream)
 {
-    NBitStream::TBitStream bitStream;
-    // First bit must be zero
-    bitStream.Write(0, 1);
     // Channel block type
     // 0 - MONO block
     // 1 - STEREO block
     // 2 - Nobody know
     bitStream.Write(channels - 1, 2);
 
-    const uint32_t initialNumQuantUnits = 32;
+    const uint32_t maxNumQuantUnits = 32;
 
-    TSpecFrame frame(FrameSzToAllocBits, initialNumQuantUnits, channels, tonalBlock, sces);
+    TSpecFrame frame(FrameSzToAllocBits, maxNumQuantUnits, channels, tonalBlock, sces);
 
     Encoder.Do(&frame, bitStream);
+}
+
+void TAt3PBitStream::WriteFrame(int channels, const TAt3PGhaData* tonalBlock, const std::vector<TSingleChannelElement>& sces)
+{
+    NBitStream::TBitStream bitStream;
+    // First bit must be zero
+    bitStream.Write(0, 1);
+
+    EncodeUnit(channels, tonalBlock, sces, bitStream);
 
     std::vector<char> buf = bitStream.GetBytes();
 
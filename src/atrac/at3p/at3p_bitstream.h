@@ -28,6 +28,7 @@ namespace NAtracDEnc {
 struct TScaledBlock;
 
 struct TAt3PGhaData;
+struct TSpecFrame;
 
 enum class ETonePackOrder : bool {
     ASC = false,
@@ -55,8 +56,13 @@ public:
         TSubbandInfos SubbandInfo;
         std::vector<TScaledBlock> ScaledBlocks;
     };
+    // frameSz - size of the whole frame or, for a multichannel frame, the part of it given to the channel unit
     TAt3PBitStream(ICompressedOutput* container, uint16_t frameSz);
     void WriteFrame(int channels, const TAt3PGhaData* tonalData, const std::vector<TSingleChannelElement>& scaledBlocks);
+    // Appends the channel unit (unit type, unit data and terminator) to bs, the container is not used
+    void EncodeUnit(int channels, const TAt3PGhaData* tonalData, const std::vector<TSingleChannelElement>& scaledBlocks,
+        NBitStream::TBitStream& bs);
+    const TRateControlStat& GetRateControlStat() const noexcept { return Encoder.GetRateControlStat(); }
 private:
     ICompressedOutput* Container;
     TBitStreamEncoder Encoder;
@@ -0,0 +1,65 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "at3p_bitstream_impl.h"
+#include "at3p_tables.h"
+
+#include <benchmark/benchmark.h>
+
+using namespace NAtracDEnc;
+
+namespace {
+
+void FillSces(std::vector<TAt3PBitStream::TSingleChannelElement>& sces) {
+    uint32_t seed = 1;
+    for (auto& sce : sces) {
+        for (size_t qu = 0; qu < NAt3p::TScaleTable::MaxBfus; qu++) {
+            TScaledBlock block(40);
+            block.Values.resize(NAt3p::TScaleTable::SpecsPerBlock[qu]);
+            for (float& v : block.Values) {
+                seed = seed * 1664525u + 1013904223u;
+                v = ((int32_t)seed >> 8) / (float)(1 << 23);
+            }
+            sce.ScaledBlocks.push_back(block);
+        }
+    }
+}
+
+// Configure (word lengths) + quant units stages, as done for each frame
+// once the number of quant units is chosen
+void BM_QuantUnitsEncode(benchmark::State& state) {
+    const size_t channels = state.range(0);
+    std::vector<TAt3PBitStream::TSingleChannelElement> sces(channels);
+    FillSces(sces);
+
+    std::vector<IBitStreamPartEncoder::TPtr> encoders;
+    encoders.emplace_back(new TConfigure());
+    encoders.emplace_back(new TQuantUnitsEncoder());
+    TBitStreamEncoder encoder(std::move(encoders));
+
+    for (auto _ : state) {
+        TSpecFrame frame(~0u, 32, channels, nullptr, sces);
+        NBitStream::TBitStream bs;
+        encoder.Do(&frame, bs);
+        benchmark::DoNotOptimize(bs.GetSizeInBits());
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_QuantUnitsEncode)->Arg(1)->Arg(2);
@@ -23,6 +23,7 @@
 #include <lib/bitstream/bitstream.h>
 #include <lib/bs_encode/encode.h>
 #include <atrac/atrac_scale.h>
+#include <array>
 #include <vector>
 
 namespace NAtracDEnc {
@@ -36,6 +37,7 @@ struct TSpecFrame {
                const TAt3PGhaData* tonalBlock,
                const std::vector<TAt3PBitStream::TSingleChannelElement>& sces)
         : SizeBits(sz)
+        , MaxQuantUnits(numQuantUnits)
         , NumQuantUnits(numQuantUnits)
         , TonalBlock(tonalBlock)
         , AllocatedBits(0)
@@ -47,8 +49,16 @@ struct TSpecFrame {
     }
 
     const uint32_t SizeBits;
+    const uint32_t MaxQuantUnits;
     uint32_t NumQuantUnits;
+    // Quant units up to the last one with non zero word length in any channel,
+    // only these units have scale factors and spectrum in the bitstream
+    uint32_t UsedQuantUnits = 0;
     const TAt3PGhaData* TonalBlock;
+    // Allocation shift of the current attempt
+    float Shift = 0;
+    // Set by the fallback, the allocation search is started again for the reduced frame
+    bool RestartAlloc = false;
     std::vector<std::pair<uint8_t, uint8_t>> WordLen;
     std::vector<std::pair<uint8_t, uint8_t>> SfIdx;
     std::vector<std::pair<uint8_t, uint8_t>> SpecTabIdx;
@@ -65,35 +75,59 @@ struct TSpecFrame {
     static TSpecFrame* Cast(void* p) { return reinterpret_cast<TSpecFrame*>(p); }
 };
 
+// Bits consumed by the frame part for each possible number of quant units,
+// index is NumQuantUnits
+using TQuantUnitsCost = std::array<uint32_t, 33>;
+
 class TDumper : public IBitStreamPartEncoder {
 public:
+    // Adds consumption of the stage for each NumQuantUnits in [1, frame->NumQuantUnits]
+    // to the cost, word lengths of the current attempt are used. Lets the frame be
+    // reduced to the size it fits without repeating the encoding for each candidate.
+    virtual void AddCost(TSpecFrame* frame, TQuantUnitsCost& cost) = 0;
+
     void Dump(NBitStream::TBitStream& bs) override {
-        for (const auto& pair : Buf) {
-            bs.Write(pair.first, pair.second);
-        }
-        Buf.clear();
+        bs.Write(Buf);
+        Buf.Clear();
     }
     void Reset() noexcept override {
-        Buf.clear();
+        Buf.Clear();
+    }
+    uint32_t GetConsumption() const noexcept override {
+        return Buf.GetSizeInBits();
     }
-    uint32_t GetConsumption() const noexcept override;
 protected:
 
     // value, nbits
-    void Insert(uint16_t value, uint8_t nbits) { Buf.emplace_back(std::make_pair(value, nbits)); }
-    std::vector<std::pair<uint16_t, uint8_t>> Buf;
+    void Insert(uint16_t value, uint8_t nbits) { Buf.Write(value, nbits); }
+    void Insert(const NBitStream::TBitBuffer& bits) { Buf.Append(bits); }
+    NBitStream::TBitBuffer Buf;
 };
 
+// Chooses word lengths of the frame for the allocation shift given by the rate control,
+// the consumption of the whole frame is submitted by the last stage
 class TConfigure : public TDumper {
 public:
     TConfigure() = default;
     EStatus Encode(void* frameData, TBitAllocHandler& ba) override;
+    void AddCost(TSpecFrame* frame, TQuantUnitsCost& cost) override;
+    void Dump(NBitStream::TBitStream& bs) override {
+        TDumper::Dump(bs);
+        AllocStarted = false;
+    }
+    static constexpr float MinShift = -8;
+    static constexpr float MaxShift = 24;
+private:
+    void Setup(TSpecFrame* frame, float shift);
+    bool AllocStarted = false;
+    float Spread[2] = {0, 0};
 };
 
 class TWordLenEncoder : public TDumper {
 public:
     TWordLenEncoder() = default;
     EStatus Encode(void* frameData, TBitAllocHandler& ba) override;
+    void AddCost(TSpecFrame* frame, TQuantUnitsCost& cost) override;
 private:
     void VlEncode(const std::array<NAt3p::TVlcElement, 8>& wlTab, size_t idx, size_t sz, const int8_t* data) noexcept;
 };
@@ -102,53 +136,78 @@ class TSfIdxEncoder : public TDumper {
 public:
     TSfIdxEncoder() = default;
     EStatus Encode(void* frameData, TBitAllocHandler& ba) override;
-private:
+    void AddCost(TSpecFrame* frame, TQuantUnitsCost& cost) override;
 };
 
 class TQuantUnitsEncoder : public TDumper {
 public:
-    TQuantUnitsEncoder() = default;
+    TQuantUnitsEncoder();
     EStatus Encode(void* frameData, TBitAllocHandler& ba) override;
+    void AddCost(TSpecFrame* frame, TQuantUnitsCost& cost) override;
+    void Dump(NBitStream::TBitStream& bs) override {
+        TDumper::Dump(bs);
+        NextGeneration();
+    }
     static void EncodeQuSpectra(const int* qspec, const size_t num_spec, const size_t idx,
-        std::vector<std::pair<uint16_t, uint8_t>>& data);
+        NBitStream::TBitBuffer& data);
+    static uint32_t GetQuSpectraBits(const int* qspec, const size_t num_spec, const size_t idx);
     static void EncodeCodeTab(bool useFullTable, size_t channels,
-        size_t numQuantUnits, const std::vector<std::pair<uint8_t, uint8_t>>& specTabIdx,
-        std::vector<std::pair<uint16_t, uint8_t>>& data);
+        size_t numQuantUnits, const std::vector<std::pair<uint8_t, uint8_t>>& wordLen,
+        const std::vector<std::pair<uint8_t, uint8_t>>& specTabIdx,
+        NBitStream::TBitBuffer& data);
 
 private:
+    static constexpr size_t MaxChannels = 2;
+    static constexpr size_t MaxWordLen = 8;
+    static constexpr size_t MaxSpecsPerUnit = 128;
+
     class TUnit {
     public:
-        static size_t MakeKey(size_t ch, size_t qu, size_t worlen);
-        TUnit(size_t qu, size_t wordlen);
-        size_t GetOrCompute(const float* val, std::vector<std::pair<uint16_t, uint8_t>>& res);
-        const std::vector<int>& GetMantisas() const { return Mantisas; }
+        // Returns index of the best spectrum table, the result is computed
+        // once per generation (frame)
+        size_t GetOrCompute(const float* val, size_t qu, size_t wordlen, uint32_t generation,
+            int* mantisas);
+        const NBitStream::TBitBuffer& GetBits() const { return Bits; }
+        uint16_t GetConsumedBits() const { return Bits.GetSizeInBits(); }
+        void ResetGeneration() noexcept { Generation = 0; }
 
     private:
-        uint32_t Wordlen;
-        float Multiplier;
-        uint16_t ConsumedBits; // Number of bits consumed by QuSpectr
-
-        std::vector<int> Mantisas;
+        uint32_t Generation = 0;
+        uint8_t TabIdx = 0;
+        NBitStream::TBitBuffer Bits; // QuSpectr encoded with the best table
     };
-    // The key is <ch_id, unit_id, wordlen>
-    // will be used to cache unit encoding result duting bit allocation
-    std::map<size_t, TUnit> UnitBuffers;
+    TUnit& GetUnit(size_t ch, size_t qu, size_t wordlen) noexcept {
+        return Units[(ch * 32 + qu) * MaxWordLen + wordlen];
+    }
+    size_t EncodeUnit(const TSpecFrame* frame, size_t ch, size_t qu);
+    void NextGeneration() noexcept;
+
+    // Encoding results cache for each <ch_id, unit_id, wordlen>, the entry is valid
+    // if its generation matches the current one, so the cache is invalidated
+    // by the increment of the generation at the end of the frame
+    std::array<TUnit, MaxChannels * 32 * MaxWordLen> Units;
+    uint32_t Generation = 1;
+    std::array<int, MaxSpecsPerUnit> Mantisas;
 };
 
 class TTonalComponentEncoder : public TDumper {
 public:
-    TTonalComponentEncoder() = default;
+    // Stages written before this one, non owning
+    explicit TTonalComponentEncoder(std::vector<TDumper*> prevStages)
+        : PrevStages(std::move(prevStages))
+    {}
     EStatus Encode(void* frameData, TBitAllocHandler& ba) override;
-    //TODO: find the common way
-    void Dump(NBitStream::TBitStream& bs) override {
-        TDumper::Dump(bs);
-        BitsUsed = 0;
-    }
+    void AddCost(TSpecFrame* frame, TQuantUnitsCost& cost) override;
 private:
-    EStatus CheckFrameDone(TSpecFrame* frame, TBitAllocHandler& ba) noexcept;
+    void WriteAll(TSpecFrame* frame);
+    bool ReduceFrame(TSpecFrame* frame);
+    static uint32_t GetWinFlagsBits(const TSpecFrame* frame, uint32_t numQuantUnits) noexcept;
     void WriteTonalBlock(size_t channels, const TAt3PGhaData* tonalBlock);
     void WriteSubbandFlags(const bool* flags, size_t numFlags);
-    size_t BitsUsed = 0;
+
+    std::vector<TDumper*> PrevStages;
+    // Tonal block of the frame with the tone bands which fit
+    TAt3PGhaData ReducedTonal;
 };
 
 
@@ -1,6 +1,11 @@
 #include "at3p_bitstream.h"
 #include "at3p_bitstream_impl.h"
+#include <atrac3p.h>
+#include "at3p_tables.h"
+#include "ff/atrac3plus_data.h"
+#include <atrac/atrac_scale.h>
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <cmath>
 
 using namespace NAtracDEnc;
@@ -137,3 +142,339 @@ TEST(AT3PBitstream, Wordlen) {
     EXPECT_EQ(bs.GetSizeInBits(), 28);
 }
 
+
+namespace {
+
+class TFrameCollector : public ICompressedOutput {
+public:
+    void WriteFrame(std::vector<char> data) override { Frames.push_back(std::move(data)); }
+    std::string GetName() const override { return {}; }
+    size_t GetChannelNum() const override { return 2; }
+    std::vector<std::vector<char>> Frames;
+};
+
+std::vector<TAt3PBitStream::TSingleChannelElement> MakeNoiseFrame(int channels, uint32_t seed) {
+    TScaler<NAt3p::TScaleTable> scaler;
+    std::vector<TAt3PBitStream::TSingleChannelElement> sces(channels);
+    std::vector<float> specs(2048);
+    for (auto& sce : sces) {
+        for (size_t i = 0; i < specs.size(); i++) {
+            seed = seed * 1664525u + 1013904223u;
+            specs[i] = ((int32_t)seed / 2147483648.0f) * 0.5f;
+        }
+        sce.ScaledBlocks = scaler.ScaleFrame(specs, NAt3p::TScaleTable::TBlockSizeMod());
+    }
+    return sces;
+}
+
+size_t EncodeNoise(uint16_t frameSz) {
+    TFrameCollector out;
+    TAt3PBitStream bs(&out, frameSz);
+    for (uint32_t i = 0; i < 4; i++) {
+        bs.WriteFrame(2, nullptr, MakeNoiseFrame(2, i));
+    }
+
+    size_t numQuantUnits = 0;
+    for (const auto& frame : out.Frames) {
+        EXPECT_EQ(frame.size(), frameSz);
+        // start bit, 2 bits of channel configuration, 5 bits of number of quant units
+        numQuantUnits += (frame[0] & 0x1f) + 1;
+    }
+    EXPECT_EQ(bs.GetRateControlStat().Frames, 4);
+    return numQuantUnits;
+}
+
+}
+
+TEST(AT3PBitstream, RateControlFitsFrameSize) {
+    const size_t low = EncodeNoise(TAt3PEnc::GetFrameSzForBitrate(48));
+    const size_t high = EncodeNoise(TAt3PEnc::GetFrameSzForBitrate(352));
+    EXPECT_LT(low, high);
+}
+
+TEST(AT3PBitstream, OversizedTonalBlockIsReduced) {
+    // 16 tone bands with 3 tones each do not fit in to the frame even without spectrum
+    TAt3PGhaData tonal;
+    tonal.NumToneBands = 16;
+    tonal.SecondIsLeader = false;
+    for (size_t i = 0; i < 16; i++) {
+        tonal.ToneSharing[i] = false;
+        tonal.Waves[0].WaveSbInfos.push_back(TAt3PGhaData::TWaveSbInfo{i * 3, 3});
+        for (uint32_t j = 0; j < 3; j++) {
+            tonal.Waves[0].WaveParams.push_back(TAt3PGhaData::TWaveParam{100 + j * 300, 63, 0, 31});
+        }
+    }
+
+    const uint16_t frameSz = 96;
+    TFrameCollector out;
+    TAt3PBitStream bs(&out, frameSz);
+    bs.WriteFrame(1, &tonal, MakeNoiseFrame(1, 0));
+
+    ASSERT_EQ(out.Frames.size(), 1);
+    EXPECT_EQ(out.Frames[0].size(), frameSz);
+    // Quant units cover only the tone bands which fit
+    const size_t numQuantUnits = (out.Frames[0][0] & 0x1f) + 1;
+    EXPECT_GT(atrac3p_qu_to_subband[numQuantUnits - 1] + 1, 1);
+    EXPECT_LT(atrac3p_qu_to_subband[numQuantUnits - 1] + 1, 16);
+}
+
+namespace {
+
+// Compares the cost reported by the stages with the consumption of the encoded frame
+class TCostChecker : public IBitStreamPartEncoder {
+public:
+    TCostChecker(std::vector<TDumper*> stages)
+        : Stages(std::move(stages))
+        , Tonal({})
+    {}
+    EStatus Encode(void* frameData, TBitAllocHandler& ba) override {
+        auto frame = TSpecFrame::Cast(frameData);
+        TQuantUnitsCost cost = {};
+        for (TDumper* stage : Stages) {
+            stage->AddCost(frame, cost);
+        }
+        Tonal.AddCost(frame, cost);
+        EXPECT_EQ(cost[frame->NumQuantUnits], ba.GetCurGlobalConsumption());
+        Checked++;
+        return EStatus::Ok;
+    }
+    void Dump(NBitStream::TBitStream&) override {}
+    uint32_t GetConsumption() const noexcept override { return 0; }
+    size_t Checked = 0;
+private:
+    std::vector<TDumper*> Stages;
+    TTonalComponentEncoder Tonal;
+};
+
+}
+
+TEST(AT3PBitstream, StageCostMatchesConsumption) {
+    TAt3PGhaData tonal;
+    tonal.NumToneBands = 4;
+    tonal.SecondIsLeader = false;
+    for (size_t i = 0; i < 4; i++) {
+        tonal.ToneSharing[i] = false;
+        for (size_t ch = 0; ch < 2; ch++) {
+            tonal.Waves[ch].WaveSbInfos.push_back(TAt3PGhaData::TWaveSbInfo{i * 2, 2});
+            for (uint32_t j = 0; j < 2; j++) {
+                tonal.Waves[ch].WaveParams.push_back(TAt3PGhaData::TWaveParam{200 + j * 500, 40, 0, 7});
+            }
+        }
+    }
+
+    for (int channels = 1; channels <= 2; channels++) {
+        for (uint16_t frameSz : {TAt3PEnc::GetFrameSzForBitrate(48), TAt3PEnc::GetFrameSzForBitrate(352)}) {
+            std::vector<TDumper*> stages = {
+                new TConfigure(), new TWordLenEncoder(), new TSfIdxEncoder(), new TQuantUnitsEncoder()};
+            std::vector<IBitStreamPartEncoder::TPtr> parts;
+            for (TDumper* stage : stages) {
+                parts.emplace_back(stage);
+            }
+            parts.emplace_back(new TTonalComponentEncoder(stages));
+            auto checker = new TCostChecker(stages);
+            parts.emplace_back(checker);
+            TBitStreamEncoder encoder(std::move(parts));
+
+            for (uint32_t i = 0; i < 4; i++) {
+                const auto sces = MakeNoiseFrame(channels, i);
+                TSpecFrame frame(frameSz * 8 - 3, 32, channels, (i & 1) ? &tonal : nullptr, sces);
+                NBitStream::TBitStream bs;
+                encoder.Do(&frame, bs);
+            }
+            EXPECT_EQ(checker->Checked, 4);
+        }
+    }
+}
+
+TEST(AT3PBitstream, FrameSzForBitrate) {
+    EXPECT_EQ(TAt3PEnc::GetFrameSzForBitrate(0), 2048);
+    EXPECT_EQ(TAt3PEnc::GetFrameSzForBitrate(352), 2048);
+    EXPECT_EQ(TAt3PEnc::GetFrameSzForBitrate(1000), 2048);
+    EXPECT_EQ(TAt3PEnc::GetFrameSzForBitrate(48), 280);
+    EXPECT_EQ(TAt3PEnc::GetFrameSzForBitrate(100), 744);
+    EXPECT_EQ(TAt3PEnc::GetBitrate(TAt3PEnc::GetFrameSzForBitrate(128)) / 1000, 128);
+    // Multichannel frames
+    EXPECT_EQ(TAt3PEnc::GetBitrate(6144), 1058400);
+    EXPECT_EQ(TAt3PEnc::GetBitrate(8192), 1411200);
+}
+
+TEST(AT3PBitstream, MultichannelLayout) {
+    EXPECT_EQ(TAt3PEnc::GetChannelUnits(1), std::vector<int>({1}));
+    EXPECT_EQ(TAt3PEnc::GetChannelUnits(2), std::vector<int>({2}));
+    EXPECT_EQ(TAt3PEnc::GetChannelUnits(6), std::vector<int>({2, 1, 2, 1}));
+    EXPECT_EQ(TAt3PEnc::GetChannelUnits(8), std::vector<int>({2, 1, 2, 2, 1}));
+    EXPECT_TRUE(TAt3PEnc::GetChannelUnits(5).empty());
+    EXPECT_TRUE(TAt3PEnc::GetChannelUnits(9).empty());
+
+    EXPECT_EQ(TAt3PEnc::GetMultichannelFrameSz(1, 2048), 2048);
+    EXPECT_EQ(TAt3PEnc::GetMultichannelFrameSz(2, 2048), 2048);
+    EXPECT_EQ(TAt3PEnc::GetMultichannelFrameSz(6, 2048), 6144);
+    // Max frame size of the container
+    EXPECT_EQ(TAt3PEnc::GetMultichannelFrameSz(8, 2048), 8192);
+    EXPECT_EQ(TAt3PEnc::GetMultichannelFrameSz(3, 280) % 8, 0);
+}
+
+TEST(AT3PBitstream, MultichannelFrame) {
+    const int channels = 6;
+    auto out = new TFrameCollector();
+    TAt3PEnc::TSettings settings;
+    settings.UseGha = TAt3PEnc::TSettings::GHA_PASS_INPUT | TAt3PEnc::TSettings::GHA_WRITE_RESIUDAL;
+    settings.FrameSz = TAt3PEnc::GetFrameSzForBitrate(128);
+    TAt3PEnc enc(TCompressedOutputPtr(out), channels, settings);
+    auto lambda = enc.GetLambda();
+
+    uint32_t seed = 1;
+    std::vector<float> data(TAt3PEnc::NumSamples * channels);
+    for (size_t frame = 0; frame < 4; frame++) {
+        for (auto& x : data) {
+            seed = seed * 1664525u + 1013904223u;
+            x = (int32_t)seed / 2147483648.0f * 8192.0f;
+        }
+        const auto res = lambda(data.data(), TPCMEngine::ProcessMeta{channels});
+        EXPECT_EQ(res, frame ? TPCMEngine::EProcessResult::PROCESSED : TPCMEngine::EProcessResult::LOOK_AHEAD);
+    }
+
+    ASSERT_EQ(out->Frames.size(), 3);
+    for (const auto& frame : out->Frames) {
+        EXPECT_EQ(frame.size(), TAt3PEnc::GetMultichannelFrameSz(channels, settings.FrameSz));
+        // Start bit and the stereo unit type
+        EXPECT_EQ((uint8_t)frame[0] >> 5, 1);
+    }
+}
+
+namespace {
+
+// Last frame of the encoded input where only the given channel is not silent, -1 - all channels are silent
+std::vector<char> EncodeSingleChannel(int channels, uint16_t frameSz, int loudChannel) {
+    auto out = new TFrameCollector();
+    TAt3PEnc::TSettings settings;
+    settings.UseGha = TAt3PEnc::TSettings::GHA_PASS_INPUT | TAt3PEnc::TSettings::GHA_WRITE_RESIUDAL;
+    settings.FrameSz = frameSz;
+    TAt3PEnc enc(TCompressedOutputPtr(out), channels, settings);
+    auto lambda = enc.GetLambda();
+
+    std::vector<float> data(TAt3PEnc::NumSamples * channels);
+    // Enough frames for the silent units to be written without encoding
+    for (size_t frame = 0; frame < 10; frame++) {
+        for (size_t i = 0; i < TAt3PEnc::NumSamples; i++) {
+            const size_t n = frame * TAt3PEnc::NumSamples + i;
+            for (int ch = 0; ch < channels; ch++) {
+                data[i * channels + ch] = (ch == loudChannel) ? 0.5f * sinf(n * 0.05f) : 0.0f;
+            }
+        }
+        lambda(data.data(), TPCMEngine::ProcessMeta{(uint16_t)channels});
+    }
+    return out->Frames.back();
+}
+
+size_t GetSilentUnitBits(int channels, uint16_t frameSz) {
+    TScaler<NAt3p::TScaleTable> scaler;
+    const std::vector<float> zero(TAt3PEnc::NumSamples);
+    std::vector<TAt3PBitStream::TSingleChannelElement> sces(channels);
+    for (auto& sce : sces) {
+        sce.ScaledBlocks = scaler.ScaleFrame(zero, NAt3p::TScaleTable::TBlockSizeMod());
+    }
+    TAt3PBitStream bitStream(nullptr, frameSz);
+    NBitStream::TBitStream bs;
+    bitStream.EncodeUnit(channels, nullptr, sces, bs);
+    return bs.GetSizeInBits();
+}
+
+size_t FindFirstDiffBit(const std::vector<char>& a, const std::vector<char>& b) {
+    for (size_t i = 0; i < a.size() * 8; i++) {
+        const int x = ((uint8_t)a[i / 8] >> (7 - i % 8)) & 1;
+        const int y = ((uint8_t)b[i / 8] >> (7 - i % 8)) & 1;
+        if (x != y) {
+            return i;
+        }
+    }
+    return a.size() * 8;
+}
+
+}
+
+TEST(AT3PBitstream, MultichannelChannelMap) {
+    // Output channel for each channel of the units in order, as routed by the decoder
+    const int decoderMap[6] = {0, 1, 2, 4, 5, 3};
+    const int channels = 6;
+    const std::vector<int> units = TAt3PEnc::GetChannelUnits(channels);
+    const uint16_t frameSz = TAt3PEnc::GetFrameSzForBitrate(128);
+
+    // Unit boundaries in the frame of silent units: start bit, units without terminators
+    std::vector<size_t> unitStart;
+    std::vector<int> channelUnit;
+    size_t pos = 1;
+    for (size_t unit = 0; unit < units.size(); unit++) {
+        unitStart.push_back(pos);
+        const uint16_t unitFrameSz = (units[unit] == 2) ? frameSz : (frameSz / 2) & ~7;
+        pos += GetSilentUnitBits(units[unit], unitFrameSz) - 2;
+        for (int i = 0; i < units[unit]; i++) {
+            channelUnit.push_back(unit);
+        }
+    }
+
+    const std::vector<char> silent = EncodeSingleChannel(channels, frameSz, -1);
+    for (int k = 0; k < channels; k++) {
+        const int wavChannel = decoderMap[k];
+        const std::vector<char> frame = EncodeSingleChannel(channels, frameSz, wavChannel);
+        ASSERT_EQ(frame.size(), silent.size());
+        // The first unit which is not silent carries the channel
+        const size_t diff = FindFirstDiffBit(frame, silent);
+        const size_t unit = std::upper_bound(unitStart.begin(), unitStart.end(), diff) - unitStart.begin() - 1;
+        EXPECT_EQ(unit, channelUnit[k]) << "WAV channel " << wavChannel;
+    }
+}
+
+namespace {
+
+uint64_t EncodeWithSilence(const std::vector<float>& pcm, bool skipSilence, bool warmStart,
+    std::vector<std::vector<char>>& frames)
+{
+    auto out = new TFrameCollector();
+    TAt3PEnc::TSettings settings;
+    settings.SkipSilence = skipSilence;
+    settings.GhaWarmStart = warmStart;
+    settings.FrameSz = TAt3PEnc::GetFrameSzForBitrate(132);
+    TAt3PEnc enc(TCompressedOutputPtr(out), 2, settings);
+    auto lambda = enc.GetLambda();
+
+    std::vector<float> data(TAt3PEnc::NumSamples * 2);
+    for (size_t pos = 0; pos + data.size() <= pcm.size(); pos += data.size()) {
+        std::copy(pcm.begin() + pos, pcm.begin() + pos + data.size(), data.begin());
+        lambda(data.data(), TPCMEngine::ProcessMeta{2});
+    }
+    frames = std::move(out->Frames);
+    return enc.GetSkippedFrames();
+}
+
+}
+
+TEST(AT3PBitstream, SkipSilenceKeepsOtherFrames) {
+    // Signal, 12 silent frames, signal
+    const size_t numFrames = 24;
+    std::vector<float> pcm(numFrames * TAt3PEnc::NumSamples * 2);
+    for (size_t i = 0; i < pcm.size() / 2; i++) {
+        if (i >= 6 * TAt3PEnc::NumSamples && i < 18 * TAt3PEnc::NumSamples) {
+            continue;
+        }
+        const double t = i / 44100.0;
+        pcm[i * 2] = 0.3 * sin(2 * M_PI * 440 * t) + 0.1 * sin(2 * M_PI * 3000 * t);
+        pcm[i * 2 + 1] = 0.4 * sin(2 * M_PI * (200 * t + 2000 * t * t));
+    }
+
+    for (bool warmStart : {false, true}) {
+        std::vector<std::vector<char>> skipped;
+        std::vector<std::vector<char>> encoded;
+        const uint64_t numSkipped = EncodeWithSilence(pcm, true, warmStart, skipped);
+        EXPECT_EQ(EncodeWithSilence(pcm, false, warmStart, encoded), 0u);
+
+        EXPECT_GT(numSkipped, 2u);
+        ASSERT_EQ(skipped.size(), encoded.size());
+        // The state is left at rest by skipped frames, so frames after the silence are the same
+        for (size_t i = 0; i < skipped.size(); i++) {
+            if (i < 6 || i > 18) {
+                EXPECT_TRUE(skipped[i] == encoded[i]) << "frame " << i << " warm start " << warmStart;
+            }
+        }
+    }
+}
@@ -20,8 +20,10 @@
 #include "ff/atrac3plus.h"
 
 #include <util.h>
+#include <trace.h>
 #include <atrac/atrac_psy_common.h>
 #include <libgha/include/libgha.h>
+#include <lib/parallel/thread_pool.h>
 
 #include <memory>
 
@@ -29,10 +31,8 @@
 #include <cstring>
 #include <cmath>
 #include <iostream>
-#include <map>
 #include <vector>
 
-using std::map;
 using std::vector;
 using std::isnan;
 using std::pair;
@@ -67,21 +67,86 @@ class TGhaProcessor : public IGhaProcessor {
     static constexpr size_t GHA_SUBBAND_BUF_SZ = SAMPLES_PER_SUBBAND + LOOK_AHEAD;
     static constexpr size_t CHANNEL_BUF_SZ = SUBBANDS * GHA_SUBBAND_BUF_SZ;
 
-    using TGhaInfoMap = map<uint32_t, struct gha_info>;
     using TWavesChannel = TAt3PGhaData::TWavesChannel;
     using TAmpSfTab = std::array<float, 64>;
 
+    // Tones of one subband sorted by the frequency index.
+    // Subband is marked as done after 15 tones, so the capacity is enough.
+    struct TSubbandTones {
+        static constexpr size_t CAPACITY = 16;
+        struct TTone {
+            uint32_t Index; // Frequency index with the subband number, see GhaFreqToIndex
+            struct gha_info Info;
+        };
+
+        TTone Tones[CAPACITY];
+        size_t Num = 0;
+
+        const TTone* begin() const { return Tones; }
+        const TTone* end() const { return Tones + Num; }
+        bool Empty() const { return Num == 0; }
+        void Clear() { Num = 0; }
+
+        // First tone with index not less than the given one or end()
+        const TTone* LowerBound(uint32_t index) const {
+            return std::lower_bound(begin(), end(), index,
+                [](const TTone& t, uint32_t i) { return t.Index < i; });
+        }
+
+        bool Contains(uint32_t index) const {
+            const TTone* it = LowerBound(index);
+            return it != end() && it->Index == index;
+        }
+
+        // Returns false if a tone with the same index is present
+        bool Insert(uint32_t index, const struct gha_info& info) {
+            TTone* it = Tones + (LowerBound(index) - Tones);
+            if (it != end() && it->Index == index) {
+                return false;
+            }
+            ASSERT(Num < CAPACITY);
+            std::move_backward(it, Tones + Num, Tones + Num + 1);
+            *it = TTone{index, info};
+            Num++;
+            return true;
+        }
+
+        void Erase(uint32_t index) {
+            TTone* it = Tones + (LowerBound(index) - Tones);
+            if (it != end() && it->Index == index) {
+                std::move(it + 1, Tones + Num, it);
+                Num--;
+            }
+        }
+    };
+
     struct TChannelData {
         const float* SrcBuf;
         const float* SrcBufNext;
         float Buf[CHANNEL_BUF_SZ];
-        pair<uint32_t, uint32_t> Envelopes[SUBBANDS] = {{TAt3PGhaData::INIT,TAt3PGhaData::INIT}};
-        bool Gapless[SUBBANDS] = {false};
-        uint8_t SubbandDone[SUBBANDS] = {0};
-        TGhaInfoMap GhaInfos;
-        float MaxToneMagnitude[SUBBANDS] = {0}; // Max magnitude of sine in the band. Used to stop processing when next extracted sine become significant less then max one
-        float LastResuidalEnergy[SUBBANDS] = {0}; // Resuidal energy on the last round for subband. It is the second criteria to stop processing, we expect resuidal becaming less on the each round
+        pair<uint32_t, uint32_t> Envelopes[SUBBANDS];
+        bool Gapless[SUBBANDS];
+        uint8_t SubbandDone[SUBBANDS];
+        TSubbandTones Tones[SUBBANDS];
+        float MaxToneMagnitude[SUBBANDS]; // Max magnitude of sine in the band. Used to stop processing when next extracted sine become significant less then max one
+        float LastResuidalEnergy[SUBBANDS]; // Resuidal energy on the last round for subband. It is the second criteria to stop processing, we expect resuidal becaming less on the each round
         uint16_t LastAddedFreqIdx[SUBBANDS];
+        bool Seeded[SUBBANDS]; // Subband holds tones of the previous frame which are not adjusted yet
+
+        // Prepare for the next frame, Buf is filled by the caller
+        void Reset(const float* src, const float* srcNext) {
+            SrcBuf = src;
+            SrcBufNext = srcNext;
+            for (size_t sb = 0; sb < SUBBANDS; sb++) {
+                Envelopes[sb] = {TAt3PGhaData::INIT, TAt3PGhaData::INIT};
+                Gapless[sb] = false;
+                SubbandDone[sb] = 0;
+                Tones[sb].Clear();
+                MaxToneMagnitude[sb] = 0;
+                LastResuidalEnergy[sb] = 0;
+                Seeded[sb] = false;
+            }
+        }
 
         void MarkSubbandDone(size_t sb) {
             SubbandDone[sb] = 16;
@@ -90,17 +155,48 @@ class TGhaProcessor : public IGhaProcessor {
         bool IsSubbandDone(size_t sb) const {
             return SubbandDone[sb] == 16;
         }
+
+        // Closest tones of the channel around the index, nullptr if there is no such tone
+        const TSubbandTones::TTone* FindNotLess(uint32_t index) const {
+            const TSubbandTones& tones = Tones[index >> 10];
+            const TSubbandTones::TTone* it = tones.LowerBound(index);
+            if (it != tones.end()) {
+                return it;
+            }
+            for (size_t sb = (index >> 10) + 1; sb < SUBBANDS; sb++) {
+                if (!Tones[sb].Empty()) {
+                    return Tones[sb].begin();
+                }
+            }
+            return nullptr;
+        }
+
+        const TSubbandTones::TTone* FindLess(uint32_t index) const {
+            const TSubbandTones& tones = Tones[index >> 10];
+            const TSubbandTones::TTone* it = tones.LowerBound(index);
+            if (it != tones.begin()) {
+                return it - 1;
+            }
+            for (size_t sb = index >> 10; sb-- > 0;) {
+                if (!Tones[sb].Empty()) {
+                    return Tones[sb].end() - 1;
+                }
+            }
+            return nullptr;
+        }
     };
 
     struct TChannelGhaCbCtx {
-        TChannelGhaCbCtx(TChannelData* data, size_t sb)
+        TChannelGhaCbCtx(TChannelData* data, size_t sb, float threshold)
             : Data(data)
             , Sb(sb)
+            , Threshold(threshold)
             , AdjustStatus(EAdjustStatus::Ok)
             , FrameSz(0)
         {}
         TChannelData* Data;
         size_t Sb;
+        const float Threshold;
 
         enum class EAdjustStatus {
             Error,
@@ -110,13 +206,48 @@ class TGhaProcessor : public IGhaProcessor {
         size_t FrameSz;
     };
 
+    // Search step of one subband of one channel. The step reads and updates only
+    // the state of its own subband, except the found tones: they are applied to the
+    // channel tones later (ApplySubbandStep) in the order of serial processing,
+    // because the new tone is checked against tones of the neighbour subbands.
+    struct TSubbandStep {
+        enum class EAdjust {
+            NoTones,
+            Updated, // Tones contains adjusted tones of the subband
+            Removed, // last added tone must be removed, subband is done
+            Dropped  // tones of the previous frame do not fit, the subband is searched from scratch
+        };
+
+        TChannelData* Data;
+        size_t Sb;
+        EAdjust Adjust;
+        struct gha_info Tones[TSubbandTones::CAPACITY];
+        size_t NumTones;
+        bool HasCandidate;
+        bool Added;
+        uint32_t AdjustCalls;
+        uint32_t AnalyzeCalls;
+        struct gha_info Candidate;
+        // To restore if the step is dropped due to the tones limit
+        pair<uint32_t, uint32_t> Envelope;
+    };
+
 public:
-    TGhaProcessor(bool stereo)
-        : LibGhaCtx(gha_create_ctx(128))
-        , Stereo(stereo)
+    TGhaProcessor(bool stereo, const TGhaSettings& settings)
+        : Stereo(stereo)
+        , Settings(CheckSettings(settings))
     {
-        gha_set_max_magnitude(LibGhaCtx, 32768);
-        gha_set_upsample(LibGhaCtx, 1);
+        const size_t threads = Settings.Threads;
+        if (threads > 1) {
+            Pool.reset(new TThreadPool(threads));
+        }
+        // Each worker needs own context, the context holds working buffers
+        for (size_t i = 0; i < threads; i++) {
+            gha_ctx_t ctx = gha_create_ctx(128);
+            gha_set_max_magnitude(ctx, 32768);
+            gha_set_upsample(ctx, 1);
+            GhaCtxs.push_back(ctx);
+        }
 
         if (!StaticInited) {
             ff_atrac3p_init_dsp_static();
@@ -150,33 +281,48 @@ public:
 
     ~TGhaProcessor()
     {
-        gha_free_ctx(LibGhaCtx);
+        for (gha_ctx_t ctx : GhaCtxs) {
+            gha_free_ctx(ctx);
+        }
     }
 
     const TAt3PGhaData* DoAnalize(TBufPtr b1, TBufPtr b2, float *w1, float *w2) override;
+    const TGhaStat& GetStat() const override { return Stat; }
 
 private:
     void ApplyFilter(const TAt3PGhaData*, float *b1, float *b2);
+    static TGhaSettings CheckSettings(TGhaSettings settings);
     static void FillSubbandAth(float* out);
     static TAmpSfTab CreateAmpSfTab();
     static void CheckResuidalAndApply(float* resuidal, size_t size, void* self) noexcept;
     static void GenWaves(const TAt3PGhaData::TWaveParam* param, size_t numWaves, size_t reg_offset, float* out, size_t outLimit);
 
     void AdjustEnvelope(pair<uint32_t, uint32_t>& envelope, const pair<uint32_t, uint32_t>& src, uint32_t history);
-    uint32_t FillFolowerRes(const TGhaInfoMap& lGha, const TChannelData* src, TGhaInfoMap::const_iterator& it, uint32_t leaderSb);
+    void FillFolowerRes(const TChannelData& leader, const TChannelData& folower, uint32_t sb);
 
     uint32_t AmplitudeToSf(float amp) const;
-    bool CheckNextFrame(const float* nextSrc, const vector<gha_info>& ghaInfos) const;
+    bool CheckNextFrame(const float* nextSrc, const struct gha_info* ghaInfos, size_t numTones) const;
 
-    bool DoRound(TChannelData& data, size_t& totalTones) const;
+    bool DoRound(size_t channels, size_t& totalTones);
+    void DoSubbandStep(TSubbandStep& step, gha_ctx_t ctx) const;
+    int ApplySubbandStep(TSubbandStep& step) const;
+    void SeedFromPrevFrame(size_t ch, TChannelData& data, size_t& totalTones) const;
     bool PsyPreCheck(size_t sb, const struct gha_info& gha, const TChannelData& data) const;
-    void FillResultBuf(const vector<TChannelData>& data);
-
-    gha_ctx_t LibGhaCtx;
+    void FillResultBuf(size_t channels);
+
+    vector<gha_ctx_t> GhaCtxs;
+    std::unique_ptr<TThreadPool> Pool;
+    // Search state of the current frame, reused to avoid allocations
+    TChannelData ChannelData[2];
+    std::array<TSubbandStep, 2 * SUBBANDS> Steps;
+    TGhaStat Stat;
     TAt3PGhaData ResultBuf;
     TAt3PGhaData ResultBufHistory;
 
     const bool Stereo;
+    const TGhaSettings Settings;
+    // Tones found in the previous frame, used as the start point if WarmStart
+    TSubbandTones PrevTones[2][SUBBANDS];
 
     static float SubbandAth[SUBBANDS];
     static float SineTab[2048];
@@ -191,6 +337,14 @@ float TGhaProcessor::SubbandAth[SUBBANDS];
 float TGhaProcessor::SineTab[2048];
 TGhaProcessor::TAmpSfTab TGhaProcessor::AmpSfTab;
 
+TGhaSettings TGhaProcessor::CheckSettings(TGhaSettings settings)
+{
+    settings.Threads = std::max<size_t>(settings.Threads, 1);
+    settings.MaxTones = std::min<size_t>(std::max<size_t>(settings.MaxTones, 1), 48);
+    settings.Subbands = std::min<size_t>(std::max<size_t>(settings.Subbands, 1), SUBBANDS);
+    return settings;
+}
+
 void TGhaProcessor::FillSubbandAth(float* out)
 {
     const auto ath = CalcATH(16 * 1024, 44100);
@@ -216,17 +370,32 @@ TGhaProcessor::TAmpSfTab TGhaProcessor::CreateAmpSfTab()
 
 void TGhaProcessor::GenWaves(const TAt3PGhaData::TWaveParam* param, size_t numWaves, size_t reg_offset, float* out, size_t outLimit)
 {
-    for (size_t w = 0; w < numWaves; w++, param++) {
-        //std::cerr << "GenWaves : " << w << "  FreqIndex: " <<  param->FreqIndex << " phaseIndex: " << param->PhaseIndex << " ampSf " << param->AmpSf << std::endl;
-        auto amp = AmpSfTab[param->AmpSf];
-        auto inc = param->FreqIndex;
-        auto pos = ((int)PhaseIndexToOffset(param->PhaseIndex) + ((int)reg_offset ^ 128) * inc) & 2047;
-
-        for (size_t i = 0; i < outLimit; i++) {
-            //std::cerr << "inc: " << inc << " pos: " << pos << std::endl;
-            out[i] += SineTab[pos] * amp;
-            pos     = (pos + inc) & 2047;
+    // All waves are accumulated block by block in the same order as wave by wave.
+    // Table positions inside the block do not depend on each other,
+    // so the loops are vectorizable.
+    constexpr size_t BLOCK = 16;
+    ASSERT(outLimit % BLOCK == 0);
+
+    for (size_t i = 0; i < outLimit; i += BLOCK) {
+        float acc[BLOCK];
+        float wave[BLOCK];
+        std::copy(out + i, out + i + BLOCK, acc);
+
+        for (size_t w = 0; w < numWaves; w++) {
+            //std::cerr << "GenWaves : " << w << "  FreqIndex: " <<  param[w].FreqIndex << " phaseIndex: " << param[w].PhaseIndex << " ampSf " << param[w].AmpSf << std::endl;
+            const float amp = AmpSfTab[param[w].AmpSf];
+            const uint32_t inc = param[w].FreqIndex;
+            const uint32_t pos = PhaseIndexToOffset(param[w].PhaseIndex) + (((uint32_t)reg_offset ^ 128) + i) * inc;
+
+            for (size_t j = 0; j < BLOCK; j++) {
+                wave[j] = SineTab[(pos + j * inc) & 2047];
+            }
+            for (size_t j = 0; j < BLOCK; j++) {
+                acc[j] += wave[j] * amp;
+            }
         }
+
+        std::copy(acc, acc + BLOCK, out + i);
     }
 }
 
@@ -247,16 +416,25 @@ void TGhaProcessor::CheckResuidalAndApply(float* resuidal, size_t size, void* d)
     if (size != SAMPLES_PER_SUBBAND)
         abort();
 
-    for (size_t i = 0; i < SAMPLES_PER_SUBBAND; i += 4) {
-        float energyIn = 0.0;
-        float energyOut = 0.0;
-        for (size_t j = 0; j < 4; j++) {
-            energyIn += srcBuf[i + j] * srcBuf[i + j];
-            energyOut += resuidal[i + j] * resuidal[i + j];
+    // RMS of each group of 4 samples. Groups are computed in parallel (one group per
+    // vector lane), the summation order inside the group is kept.
+    constexpr size_t GROUPS = SAMPLES_PER_SUBBAND / 4;
+    float rmsIn[GROUPS] = {0.0};
+    float rmsOut[GROUPS] = {0.0};
+    for (size_t j = 0; j < 4; j++) {
+        for (size_t g = 0; g < GROUPS; g++) {
+            rmsIn[g] += srcBuf[g * 4 + j] * srcBuf[g * 4 + j];
+            rmsOut[g] += resuidal[g * 4 + j] * resuidal[g * 4 + j];
         }
+    }
+    for (size_t g = 0; g < GROUPS; g++) {
+        rmsIn[g] = sqrt(rmsIn[g]/4);
+        rmsOut[g] = sqrt(rmsOut[g]/4);
+    }
 
-        energyIn = sqrt(energyIn/4);
-        energyOut = sqrt(energyOut/4);
+    for (size_t i = 0; i < SAMPLES_PER_SUBBAND; i += 4) {
+        const float energyIn = rmsIn[i / 4];
+        const float energyOut = rmsOut[i / 4];
         resuidalEnergy += energyOut;
 
         if (energyIn / energyOut < 1) {
@@ -292,7 +470,7 @@ void TGhaProcessor::CheckResuidalAndApply(float* resuidal, size_t size, void* d)
         return;
     }
 
-    const float threshold = 1.05; //TODO: tune it
+    const float threshold = ctx->Threshold; //TODO: tune it
     if (static_cast<bool>(ctx->Data->LastResuidalEnergy[sb]) == false) {
         ctx->Data->LastResuidalEnergy[sb] = resuidalEnergy;
     } else if (ctx->Data->LastResuidalEnergy[sb] < resuidalEnergy * threshold) {
@@ -429,39 +607,67 @@ void TGhaProcessor::ApplyFilter(const TAt3PGhaData* d, float* b1, float* b2)
 
 const TAt3PGhaData* TGhaProcessor::DoAnalize(TBufPtr b1, TBufPtr b2, float* w1, float* w2)
 {
-    vector<TChannelData> data((size_t)Stereo + 1);
-    bool progress[2] = {false};
+    const size_t channels = (size_t)Stereo + 1;
 
-    for (size_t ch = 0; ch < data.size(); ch++) {
+    for (size_t ch = 0; ch < channels; ch++) {
         const float* bCur = (ch == 0) ? b1[0] : b2[0];
         const float* bNext = (ch == 0) ? b1[1] : b2[1];
-        data[ch].SrcBuf = bCur;
-        data[ch].SrcBufNext = bNext;
+        TChannelData& data = ChannelData[ch];
+        data.Reset(bCur, bNext);
 
-        for (size_t sb = 0; sb < SUBBANDS; sb++, bCur += SAMPLES_PER_SUBBAND, bNext += SAMPLES_PER_SUBBAND) {
+        for (size_t sb = 0; sb < Settings.Subbands; sb++, bCur += SAMPLES_PER_SUBBAND, bNext += SAMPLES_PER_SUBBAND) {
             constexpr auto copyCurSz = sizeof(float) * SAMPLES_PER_SUBBAND;
             constexpr auto copyNextSz = sizeof(float) * LOOK_AHEAD;
-            memcpy(&data[ch].Buf[0] + sb * GHA_SUBBAND_BUF_SZ                      , bCur, copyCurSz);
-            memcpy(&data[ch].Buf[0] + sb * GHA_SUBBAND_BUF_SZ + SAMPLES_PER_SUBBAND, bNext, copyNextSz);
+            memcpy(&data.Buf[0] + sb * GHA_SUBBAND_BUF_SZ                      , bCur, copyCurSz);
+            memcpy(&data.Buf[0] + sb * GHA_SUBBAND_BUF_SZ + SAMPLES_PER_SUBBAND, bNext, copyNextSz);
         }
         //for (int i = 0; i < SAMPLES_PER_SUBBAND + LOOK_AHEAD; i++) {
-            //std::cerr << i << " " << data[0].Buf[i] << std::endl;
+            //std::cerr << i << " " << data.Buf[i] << std::endl;
         //}
     }
 
     size_t totalTones = 0;
+    if (Settings.WarmStart) {
+        for (size_t ch = 0; ch < channels; ch++) {
+            SeedFromPrevFrame(ch, ChannelData[ch], totalTones);
+        }
+    }
+
+    bool progress = false;
+    size_t rounds = 0;
     do {
-        for (size_t ch = 0; ch < data.size(); ch++) {
-            progress[ch] = DoRound(data[ch], totalTones);
+        TTraceScope round("gha_round");
+        progress = DoRound(channels, totalTones);
+        Stat.Rounds++;
+        rounds++;
+    } while (progress && totalTones < Settings.MaxTones && rounds != Settings.MaxRounds);
+
+    Stat.Frames++;
+
+    // The first tone of a subband found in the last round has not been adjusted,
+    // so the subband has no envelope yet. It happens if the search is stopped by the limits.
+    for (size_t ch = 0; ch < channels; ch++) {
+        TChannelData& data = ChannelData[ch];
+        for (size_t sb = 0; sb < Settings.Subbands; sb++) {
+            if (!data.Tones[sb].Empty() && data.Envelopes[sb].first == TAt3PGhaData::INIT) {
+                totalTones -= data.Tones[sb].Num;
+                data.Tones[sb].Clear();
+            }
         }
-    } while ((progress[0] || progress[1]) && totalTones < 48);
+    }
+
+    if (Settings.WarmStart) {
+        for (size_t ch = 0; ch < channels; ch++) {
+            std::copy(ChannelData[ch].Tones, ChannelData[ch].Tones + SUBBANDS, PrevTones[ch]);
+        }
+    }
 
     if (totalTones == 0) {
         ApplyFilter(nullptr, w1, w2);
         return nullptr;
     }
 
-    FillResultBuf(data);
+    FillResultBuf(channels);
 
     ResultBufHistory = ResultBuf;
 
@@ -470,34 +676,44 @@ const TAt3PGhaData* TGhaProcessor::DoAnalize(TBufPtr b1, TBufPtr b2, float* w1,
     return  &ResultBuf;
 }
 
-bool TGhaProcessor::CheckNextFrame(const float* nextSrc, const vector<gha_info>& ghaInfos) const
+bool TGhaProcessor::CheckNextFrame(const float* nextSrc, const struct gha_info* ghaInfos, size_t numTones) const
 {
-    vector<TAt3PGhaData::TWaveParam> t;
-    t.reserve(ghaInfos.size());
-    for (const auto& x : ghaInfos) {
-        t.emplace_back(TAt3PGhaData::TWaveParam
+    TAt3PGhaData::TWaveParam t[TSubbandTones::CAPACITY];
+    for (size_t i = 0; i < numTones; i++) {
+        const auto& x = ghaInfos[i];
+        t[i] = TAt3PGhaData::TWaveParam
             {
                 // TODO: do not do it twice
                 GhaFreqToIndex(x.frequency, 0),
                 AmplitudeToSf(x.magnitude),
                 1,
                 GhaPhaseToIndex(x.phase)
-            }
-        );
+            };
     }
 
     float buf[LOOK_AHEAD] = {0.0};
 
-    GenWaves(t.data(), t.size(), 0, buf, LOOK_AHEAD);
+    GenWaves(t, numTones, 0, buf, LOOK_AHEAD);
+
+    // Partial sums, one per vector lane
+    constexpr size_t LANES = 8;
+    float before[LANES] = {0.0};
+    float after[LANES] = {0.0};
+
+    for (size_t i = 0; i < LOOK_AHEAD; i += LANES) {
+        for (size_t j = 0; j < LANES; j++) {
+            before[j] += nextSrc[i + j] * nextSrc[i + j];
+            float t = nextSrc[i + j] - buf[i + j];
+            after[j] += t * t;
+            //std::cerr << buf[i + j] << " === " << nextSrc[i + j] << std::endl;
+        }
+    }
 
     float energyBefore = 0.0;
     float energyAfter = 0.0;
-
-    for (size_t i = 0; i < LOOK_AHEAD; i++) {
-        energyBefore += nextSrc[i] * nextSrc[i];
-        float t = nextSrc[i] - buf[i];
-        energyAfter += t * t;
-        //std::cerr << buf[i] << " === " << nextSrc[i] << std::endl;
+    for (size_t j = 0; j < LANES; j++) {
+        energyBefore += before[j];
+        energyAfter += after[j];
     }
 
     // std::cerr << "ENERGY: before: " << energyBefore << " after: " << energyAfter << std::endl;
@@ -505,144 +721,248 @@ bool TGhaProcessor::CheckNextFrame(const float* nextSrc, const vector<gha_info>&
     return energyAfter < energyBefore;
 }
 
-bool TGhaProcessor::DoRound(TChannelData& data, size_t& totalTones) const
+void TGhaProcessor::SeedFromPrevFrame(size_t ch, TChannelData& data, size_t& totalTones) const
 {
-    bool progress = false;
     for (size_t sb = 0; sb < SUBBANDS; sb++) {
-        if (data.IsSubbandDone(sb)) {
-            continue;
+        for (const auto& x : PrevTones[ch][sb]) {
+            struct gha_info info = x.Info;
+            // Continue the tone from the end of the previous frame
+            info.phase = fmod(info.phase + info.frequency * SAMPLES_PER_SUBBAND, 2 * M_PI);
+            data.Tones[sb].Insert(x.Index, info);
+            data.LastAddedFreqIdx[sb] = x.Index;
+            data.SubbandDone[sb]++;
+            data.Seeded[sb] = true;
+            totalTones++;
         }
+    }
+}
 
-        if (totalTones >= 48) {
-            return false;
+bool TGhaProcessor::DoRound(size_t channels, size_t& totalTones)
+{
+    size_t numSteps = 0;
+    for (size_t ch = 0; ch < channels; ch++) {
+        TChannelData& data = ChannelData[ch];
+        for (size_t sb = 0; sb < Settings.Subbands; sb++) {
+            if (data.IsSubbandDone(sb)) {
+                continue;
+            }
+            TSubbandStep& step = Steps[numSteps++];
+            step.Data = &data;
+            step.Sb = sb;
+            step.Envelope = data.Envelopes[sb];
         }
+    }
 
-        const float* srcB = data.SrcBuf + (sb * SAMPLES_PER_SUBBAND);
-        {
-            auto cit = data.GhaInfos.lower_bound(sb << 10);
-            vector<gha_info> tmp;
-            for(auto it = cit; it != data.GhaInfos.end() && it->first < (sb + 1) << 10; it++) {
-                // std::cerr << sb << " before: freq: " << it->second.frequency << " magn: " << it->second.magnitude << std::endl;
-                tmp.push_back(it->second);
+    // Steps are independent, so all of them are done concurrently. Steps which
+    // are after the tones limit would not be done in the serial processing,
+    // their results are dropped.
+    if (Pool) {
+        Pool->ParallelFor(numSteps, [this](size_t i, size_t worker) {
+            DoSubbandStep(Steps[i], GhaCtxs[worker]);
+        });
+    }
+
+    bool progress = false;
+    for (size_t i = 0; i < numSteps; i++) {
+        TSubbandStep& step = Steps[i];
+        if (totalTones >= Settings.MaxTones) {
+            if (Pool) {
+                for (; i < numSteps; i++) {
+                    Steps[i].Data->Envelopes[Steps[i].Sb] = Steps[i].Envelope;
+                }
             }
-            if (tmp.size() > 0) {
-                TChannelGhaCbCtx ctx(&data, sb);
-                do {
-                    int ar = gha_adjust_info(srcB, tmp.data(), tmp.size(), LibGhaCtx, CheckResuidalAndApply, &ctx, ctx.FrameSz);
-                    if (ar < 0) {
-                        ctx.AdjustStatus = TChannelGhaCbCtx::EAdjustStatus::Error;
-                    };
-                } while (ctx.AdjustStatus == TChannelGhaCbCtx::EAdjustStatus::Repeat);
-
-                if (ctx.AdjustStatus == TChannelGhaCbCtx::EAdjustStatus::Ok) {
-                    std::sort(tmp.begin(), tmp.end(), [](const gha_info& a, const gha_info& b) {return a.frequency < b.frequency;});
-
-                    bool dupFound = false;
-                    {
-                        auto idx1 = GhaFreqToIndex(tmp[0].frequency, sb);
-                        for (size_t i = 1; i < tmp.size(); i++) {
-                            auto idx2 = GhaFreqToIndex(tmp[i].frequency, sb);
-                            if (idx2 == idx1) {
-                                dupFound = true;
-                                break;
-                            } else {
-                                idx1 = idx2;
-                            }
-                        }
+            return false;
+        }
+
+        if (!Pool) {
+            DoSubbandStep(step, GhaCtxs[0]);
+        }
+
+        totalTones += ApplySubbandStep(step);
+        Stat.AdjustCalls += step.AdjustCalls;
+        Stat.AnalyzeCalls += step.AnalyzeCalls;
+        if (step.Added) {
+            progress = true;
+        }
+    }
+    return progress;
+}
+
+void TGhaProcessor::DoSubbandStep(TSubbandStep& step, gha_ctx_t ghaCtx) const
+{
+    TChannelData& data = *step.Data;
+    const size_t sb = step.Sb;
+
+    step.Adjust = TSubbandStep::EAdjust::NoTones;
+    step.HasCandidate = false;
+    step.AdjustCalls = 0;
+    step.AnalyzeCalls = 0;
+
+    const bool seeded = data.Seeded[sb];
+    data.Seeded[sb] = false;
+
+    const float* srcB = data.SrcBuf + (sb * SAMPLES_PER_SUBBAND);
+    {
+        struct gha_info* tmp = step.Tones;
+        size_t& numTones = step.NumTones;
+        numTones = 0;
+        for (const auto& x : data.Tones[sb]) {
+            // std::cerr << sb << " before: freq: " << x.Info.frequency << " magn: " << x.Info.magnitude << std::endl;
+            tmp[numTones++] = x.Info;
+        }
+        if (numTones > 0) {
+            TChannelGhaCbCtx ctx(&data, sb, Settings.ResidualThreshold);
+            do {
+                int ar = gha_adjust_info(srcB, tmp, numTones, ghaCtx, CheckResuidalAndApply, &ctx, ctx.FrameSz);
+                step.AdjustCalls++;
+                if (ar < 0) {
+                    ctx.AdjustStatus = TChannelGhaCbCtx::EAdjustStatus::Error;
+                };
+            } while (ctx.AdjustStatus == TChannelGhaCbCtx::EAdjustStatus::Repeat);
+
+            bool dupFound = false;
+            if (ctx.AdjustStatus == TChannelGhaCbCtx::EAdjustStatus::Ok) {
+                std::sort(tmp, tmp + numTones, [](const gha_info& a, const gha_info& b) {return a.frequency < b.frequency;});
+
+                auto idx1 = GhaFreqToIndex(tmp[0].frequency, sb);
+                for (size_t i = 1; i < numTones; i++) {
+                    auto idx2 = GhaFreqToIndex(tmp[i].frequency, sb);
+                    if (idx2 == idx1) {
+                        dupFound = true;
+                        break;
+                    } else {
+                        idx1 = idx2;
                     }
+                }
+            }
 
-                    if (!dupFound) {
-                        // check is this tone set ok for the next one
-                        if (data.Envelopes[sb].second == SAMPLES_PER_SUBBAND || data.Envelopes[sb].second == TAt3PGhaData::EMPTY_POINT) {
-                            bool cont = CheckNextFrame(data.SrcBufNext + SAMPLES_PER_SUBBAND * sb, tmp);
-
-                            if (data.Gapless[sb] == true && cont == false) {
-                                data.GhaInfos.erase(data.LastAddedFreqIdx[sb]);
-                                totalTones--;
-                                data.MarkSubbandDone(sb);
-                                continue;
-                            } else if (data.Envelopes[sb].second == SAMPLES_PER_SUBBAND && cont == true) {
-                                data.Envelopes[sb].second = TAt3PGhaData::EMPTY_POINT;
-                                data.Gapless[sb] = true;
-                            }
+            if (seeded && (ctx.AdjustStatus != TChannelGhaCbCtx::EAdjustStatus::Ok || dupFound)) {
+                // Tones of the previous frame do not describe this one,
+                // forget them and search the subband from the beginning
+                step.Adjust = TSubbandStep::EAdjust::Dropped;
+                data.SubbandDone[sb] = 0;
+                data.Envelopes[sb] = step.Envelope;
+                data.LastResuidalEnergy[sb] = 0;
+            } else if (ctx.AdjustStatus == TChannelGhaCbCtx::EAdjustStatus::Ok) {
+                if (!dupFound) {
+                    // check is this tone set ok for the next one
+                    if (Settings.LookAheadCheck &&
+                        (data.Envelopes[sb].second == SAMPLES_PER_SUBBAND || data.Envelopes[sb].second == TAt3PGhaData::EMPTY_POINT)) {
+                        bool cont = CheckNextFrame(data.SrcBufNext + SAMPLES_PER_SUBBAND * sb, tmp, numTones);
+
+                        if (data.Gapless[sb] == true && cont == false) {
+                            step.Adjust = TSubbandStep::EAdjust::Removed;
+                            data.MarkSubbandDone(sb);
+                            return;
+                        } else if (data.Envelopes[sb].second == SAMPLES_PER_SUBBAND && cont == true) {
+                            data.Envelopes[sb].second = TAt3PGhaData::EMPTY_POINT;
+                            data.Gapless[sb] = true;
                         }
+                    }
 
-                        auto it = cit;
-                        for (size_t i = 0; i < tmp.size(); i++) {
-                            // std::cerr << sb << " after: freq: " << tmp[i].frequency << " magn: " << tmp[i].magnitude << std::endl;
-                            it = data.GhaInfos.erase(it);
-                        }
-                        for (const auto& x : tmp) {
-                            data.MaxToneMagnitude[sb] = std::max(data.MaxToneMagnitude[sb], x.magnitude);
-                            const auto newIndex = GhaFreqToIndex(x.frequency, sb);
-                            data.GhaInfos.insert({newIndex, x});
-                        }
-                    } else {
-                        // std::cerr << "jackpot! same freq index after adjust call, sb: " << sb << " " << std::endl;
-                        data.GhaInfos.erase(data.LastAddedFreqIdx[sb]);
-                        totalTones--;
-                        data.MarkSubbandDone(sb);
-                        continue;
+                    step.Adjust = TSubbandStep::EAdjust::Updated;
+                    for (size_t i = 0; i < numTones; i++) {
+                        data.MaxToneMagnitude[sb] = std::max(data.MaxToneMagnitude[sb], tmp[i].magnitude);
                     }
                 } else {
-                    data.GhaInfos.erase(data.LastAddedFreqIdx[sb]);
-                    totalTones--;
+                    // std::cerr << "jackpot! same freq index after adjust call, sb: " << sb << " " << std::endl;
+                    step.Adjust = TSubbandStep::EAdjust::Removed;
                     data.MarkSubbandDone(sb);
-                    continue;
+                    return;
                 }
+            } else {
+                step.Adjust = TSubbandStep::EAdjust::Removed;
+                data.MarkSubbandDone(sb);
+                return;
             }
         }
+    }
 
-        float* b = &data.Buf[sb * GHA_SUBBAND_BUF_SZ];
-        struct gha_info res;
+    float* b = &data.Buf[sb * GHA_SUBBAND_BUF_SZ];
 
-        gha_analyze_one(b, &res, LibGhaCtx);
+    gha_analyze_one(b, &step.Candidate, ghaCtx);
+    step.AnalyzeCalls++;
 
-        auto freqIndex = GhaFreqToIndex(res.frequency, sb);
-        if (PsyPreCheck(sb, res, data) == false) {
-            data.MarkSubbandDone(sb);
-        } else {
-            if (data.SubbandDone[sb] == 0) {
-                bool ins = data.GhaInfos.insert({freqIndex, res}).second;
-                data.LastAddedFreqIdx[sb] = freqIndex;
-                ASSERT(ins);
-            } else {
-                const auto it = data.GhaInfos.lower_bound(freqIndex);
-                const size_t minFreqDistanse = 20; // Now we unable to handle tones with close frequency
-                if (it != data.GhaInfos.end()) {
-                    if (it->first == freqIndex) {
-                        data.MarkSubbandDone(sb);
-                        continue;
-                    }
+    if (PsyPreCheck(sb, step.Candidate, data) == false) {
+        data.MarkSubbandDone(sb);
+    } else {
+        step.HasCandidate = true;
+    }
+}
 
-                    if (it->first - freqIndex < minFreqDistanse) {
-                        data.MarkSubbandDone(sb);
-                        continue;
-                    }
-                }
-                if (it != data.GhaInfos.begin()) {
-                    auto prev = it;
-                    prev--;
-                    if (freqIndex - prev->first < minFreqDistanse) {
-                        data.MarkSubbandDone(sb);
-                        continue;
-                    }
-                }
-                if (data.SubbandDone[sb] == 15) {
-                    data.MarkSubbandDone(sb);
-                    continue;
-                }
-                data.GhaInfos.insert(it, {freqIndex, res});
-                data.LastAddedFreqIdx[sb] = freqIndex;
+int TGhaProcessor::ApplySubbandStep(TSubbandStep& step) const
+{
+    TChannelData& data = *step.Data;
+    const size_t sb = step.Sb;
+    int delta = 0;
+
+    step.Added = false;
+
+    switch (step.Adjust) {
+        case TSubbandStep::EAdjust::Removed:
+            data.Tones[sb].Erase(data.LastAddedFreqIdx[sb]);
+            return -1;
+        case TSubbandStep::EAdjust::Dropped:
+            delta -= data.Tones[sb].Num;
+            data.Tones[sb].Clear();
+            break;
+        case TSubbandStep::EAdjust::Updated:
+        {
+            data.Tones[sb].Clear();
+            for (size_t i = 0; i < step.NumTones; i++) {
+                // std::cerr << sb << " after: freq: " << step.Tones[i].frequency << " magn: " << step.Tones[i].magnitude << std::endl;
+                const auto newIndex = GhaFreqToIndex(step.Tones[i].frequency, sb);
+                data.Tones[sb].Insert(newIndex, step.Tones[i]);
             }
-
-            data.SubbandDone[sb]++;
-            totalTones++;
-            progress = true;
+            break;
         }
+        case TSubbandStep::EAdjust::NoTones:
+            break;
+    }
 
+    if (!step.HasCandidate) {
+        return delta;
     }
-    return progress;
+
+    const struct gha_info& res = step.Candidate;
+    auto freqIndex = GhaFreqToIndex(res.frequency, sb);
+    if (data.SubbandDone[sb] == 0) {
+        bool ins = data.Tones[sb].Insert(freqIndex, res);
+        data.LastAddedFreqIdx[sb] = freqIndex;
+        ASSERT(ins);
+    } else {
+        // Neighbour tones may belong to the adjacent subbands
+        const auto next = data.FindNotLess(freqIndex);
+        const size_t minFreqDistanse = 20; // Now we unable to handle tones with close frequency
+        if (next) {
+            if (next->Index == freqIndex) {
+                data.MarkSubbandDone(sb);
+                return delta;
+            }
+
+            if (next->Index - freqIndex < minFreqDistanse) {
+                data.MarkSubbandDone(sb);
+                return delta;
+            }
+        }
+        const auto prev = data.FindLess(freqIndex);
+        if (prev) {
+            if (freqIndex - prev->Index < minFreqDistanse) {
+                data.MarkSubbandDone(sb);
+                return delta;
+            }
+        }
+        if (data.SubbandDone[sb] == 15) {
+            data.MarkSubbandDone(sb);
+            return delta;
+        }
+        data.Tones[sb].Insert(freqIndex, res);
+        data.LastAddedFreqIdx[sb] = freqIndex;
+    }
+
+    data.SubbandDone[sb]++;
+    step.Added = true;
+    return delta + 1;
 }
 
 bool TGhaProcessor::PsyPreCheck(size_t sb, const struct gha_info& gha, const TChannelData& data) const
@@ -688,164 +1008,101 @@ void TGhaProcessor::AdjustEnvelope(pair<uint32_t, uint32_t>& envelope, const pai
     }
 }
 
-void TGhaProcessor::FillResultBuf(const vector<TChannelData>& data)
+void TGhaProcessor::FillResultBuf(size_t channels)
 {
     uint32_t usedContiguousSb[2] = {0, 0};
-    uint32_t numTones[2] = {0, 0};
 
     // TODO: This can be improved. Bitstream allows to set leader/folower flag for each band.
-    for (size_t ch = 0; ch < data.size(); ch++) {
-        int cur = -1;
-        for (const auto& info : data[ch].GhaInfos) {
-            int sb = info.first >> 10;
-            if (sb == cur + 1) {
-                usedContiguousSb[ch]++;
-                numTones[ch]++;
-                cur = sb;
-            } else if (sb == cur) {
-                numTones[ch]++;
-                continue;
-            } else {
-                break;
-            }
+    for (size_t ch = 0; ch < channels; ch++) {
+        while (usedContiguousSb[ch] < SUBBANDS && !ChannelData[ch].Tones[usedContiguousSb[ch]].Empty()) {
+            usedContiguousSb[ch]++;
         }
     }
 
     bool leader = usedContiguousSb[1] > usedContiguousSb[0];
 
-    std::vector<TWavesChannel> history;
-    history.reserve(data.size());
-
-    history.push_back(ResultBuf.Waves[0]);
-
     ResultBuf.SecondIsLeader = leader;
     ResultBuf.NumToneBands = usedContiguousSb[leader];
 
-    TGhaInfoMap::const_iterator leaderStartIt;
-    TGhaInfoMap::const_iterator folowerIt;
-    if (data.size() == 2) {
+    if (channels == 2) {
         TWavesChannel& fWaves = ResultBuf.Waves[1];
 
-        history.push_back(fWaves);
-
         fWaves.WaveParams.clear();
         fWaves.WaveSbInfos.clear();
         // Yes, see bitstream code
         fWaves.WaveSbInfos.resize(usedContiguousSb[leader]);
-        folowerIt = data[!leader].GhaInfos.begin();
-        leaderStartIt = data[leader].GhaInfos.begin();
     }
 
-    const auto& ghaInfos = data[leader].GhaInfos;
+    const TChannelData& lData = ChannelData[leader];
     TWavesChannel& waves = ResultBuf.Waves[0];
     waves.WaveParams.clear();
     waves.WaveSbInfos.clear();
     waves.WaveSbInfos.resize(usedContiguousSb[leader]);
-    auto it = ghaInfos.begin();
-    uint32_t prevSb = 0;
-    uint32_t index = 0;
 
-    if (usedContiguousSb[leader] == 0) {
-        return;
-    }
+    for (uint32_t sb = 0; sb < usedContiguousSb[leader]; sb++) {
+        waves.WaveSbInfos[sb].WaveIndex = waves.WaveParams.size();
+        for (const auto& x : lData.Tones[sb]) {
+            const auto freqIndex = x.Index & 1023;
+            const auto phaseIndex = GhaPhaseToIndex(x.Info.phase);
+            const auto ampSf = AmplitudeToSf(x.Info.magnitude);
 
-    while (it != ghaInfos.end()) {
-        const auto sb = ((it->first) >> 10);
-        if (sb >= usedContiguousSb[leader]) {
-            break;
+            waves.WaveSbInfos[sb].WaveNums++;
+            waves.WaveParams.push_back(TAt3PGhaData::TWaveParam{freqIndex, ampSf, 1, phaseIndex});
         }
 
-        const auto freqIndex = it->first & 1023;
-        const auto phaseIndex = GhaPhaseToIndex(it->second.phase);
-        const auto ampSf = AmplitudeToSf(it->second.magnitude);
-
-        waves.WaveSbInfos[sb].WaveNums++;
-        if (sb != prevSb) {
-            uint32_t histStop = TAt3PGhaData::INIT;
-            if (ResultBufHistory.Waves[0].WaveSbInfos.size() > prevSb) {
-                histStop = ResultBufHistory.Waves[0].WaveSbInfos[prevSb].Envelope.second;
-            }
-            AdjustEnvelope(waves.WaveSbInfos[prevSb].Envelope, data[leader].Envelopes[prevSb], histStop);
-
-            // update index sb -> wave position index
-            waves.WaveSbInfos[sb].WaveIndex = index;
-
-            // process folower if present
-            if (data.size() == 2) {
-                FillFolowerRes(data[leader].GhaInfos, &data[!leader], folowerIt, prevSb);
-                leaderStartIt = it;
-            }
-
-            prevSb = sb;
+        uint32_t histStop = TAt3PGhaData::INIT;
+        if (ResultBufHistory.Waves[0].WaveSbInfos.size() > sb) {
+            histStop = ResultBufHistory.Waves[0].WaveSbInfos[sb].Envelope.second;
         }
-        waves.WaveParams.push_back(TAt3PGhaData::TWaveParam{freqIndex, ampSf, 1, phaseIndex});
-        it++;
-        index++;
-    }
-
-    uint32_t histStop = (uint32_t)-2;
-    if (ResultBufHistory.Waves[0].WaveSbInfos.size() > prevSb) {
-        histStop = ResultBufHistory.Waves[0].WaveSbInfos[prevSb].Envelope.second;
-    }
-
-    TGhaProcessor::AdjustEnvelope(waves.WaveSbInfos[prevSb].Envelope, data[leader].Envelopes[prevSb], histStop);
+        AdjustEnvelope(waves.WaveSbInfos[sb].Envelope, lData.Envelopes[sb], histStop);
 
-    if (data.size() == 2) {
-        FillFolowerRes(data[leader].GhaInfos, &data[!leader], folowerIt, prevSb);
+        // process folower if present
+        if (channels == 2) {
+            FillFolowerRes(lData, ChannelData[!leader], sb);
+        }
     }
 }
 
-uint32_t TGhaProcessor::FillFolowerRes(const TGhaInfoMap& lGhaInfos, const TChannelData* src, TGhaInfoMap::const_iterator& it, const uint32_t curSb)
+void TGhaProcessor::FillFolowerRes(const TChannelData& leader, const TChannelData& folower, const uint32_t sb)
 {
     uint32_t histStop = (uint32_t)-2;
-    if (ResultBufHistory.Waves[1].WaveSbInfos.size() > curSb) {
-        histStop = ResultBufHistory.Waves[1].WaveSbInfos[curSb].Envelope.second;
+    if (ResultBufHistory.Waves[1].WaveSbInfos.size() > sb) {
+        histStop = ResultBufHistory.Waves[1].WaveSbInfos[sb].Envelope.second;
     }
 
-    const TGhaInfoMap& fGhaInfos = src->GhaInfos;
-
     TWavesChannel& waves = ResultBuf.Waves[1];
 
     uint32_t folowerSbMode = 0; // 0 - no tones, 1 - sharing band, 2 - own tones set
-    uint32_t nextSb = 0;
     uint32_t added = 0;
 
-    while (it != fGhaInfos.end()) {
-        uint32_t sb = ((it->first) >> 10);
-        if (sb > curSb) {
-            nextSb = sb;
-            break;
-        }
-
+    for (const auto& x : folower.Tones[sb]) {
         // search same indedx in the leader and set coresponding bit
-        folowerSbMode |= uint8_t(lGhaInfos.find(it->first) == lGhaInfos.end()) + 1u;
+        folowerSbMode |= uint8_t(!leader.Tones[sb].Contains(x.Index)) + 1u;
 
-        const auto freqIndex = it->first & 1023;
-        const auto phaseIndex = GhaPhaseToIndex(it->second.phase);
-        const auto ampSf = AmplitudeToSf(it->second.magnitude);
+        const auto freqIndex = x.Index & 1023;
+        const auto phaseIndex = GhaPhaseToIndex(x.Info.phase);
+        const auto ampSf = AmplitudeToSf(x.Info.magnitude);
 
         waves.WaveParams.push_back(TAt3PGhaData::TWaveParam{freqIndex, ampSf, 1, phaseIndex});
 
-        it++;
         added++;
     }
 
     switch (folowerSbMode) {
         case 0:
-            ResultBuf.ToneSharing[curSb] = false;
-            waves.WaveSbInfos[curSb].WaveNums = 0;
+            ResultBuf.ToneSharing[sb] = false;
+            waves.WaveSbInfos[sb].WaveNums = 0;
             break;
         case 1:
-            ResultBuf.ToneSharing[curSb] = true;
+            ResultBuf.ToneSharing[sb] = true;
             waves.WaveParams.resize(waves.WaveParams.size() - added);
             break;
         default:
-            ResultBuf.ToneSharing[curSb] = false;
-            waves.WaveSbInfos[curSb].WaveIndex = waves.WaveParams.size() - added;
-            waves.WaveSbInfos[curSb].WaveNums = added;
-            AdjustEnvelope(waves.WaveSbInfos[curSb].Envelope, src->Envelopes[curSb], histStop);
+            ResultBuf.ToneSharing[sb] = false;
+            waves.WaveSbInfos[sb].WaveIndex = waves.WaveParams.size() - added;
+            waves.WaveSbInfos[sb].WaveNums = added;
+            AdjustEnvelope(waves.WaveSbInfos[sb].Envelope, folower.Envelopes[sb], histStop);
     }
-    return nextSb;
 }
 
 uint32_t TGhaProcessor::AmplitudeToSf(float amp) const
@@ -859,9 +1116,9 @@ uint32_t TGhaProcessor::AmplitudeToSf(float amp) const
 
 } // namespace
 
-std::unique_ptr<IGhaProcessor> MakeGhaProcessor0(bool stereo)
+std::unique_ptr<IGhaProcessor> MakeGhaProcessor0(bool stereo, const TGhaSettings& settings)
 {
-    return std::unique_ptr<TGhaProcessor>(new TGhaProcessor(stereo));
+    return std::unique_ptr<TGhaProcessor>(new TGhaProcessor(stereo, settings));
 }
 
 } // namespace NAtracDEnc
@@ -66,14 +66,40 @@ struct TAt3PGhaData {
     }
 };
 
+struct TGhaSettings {
+    // Number of threads used for the tone search, results do not depend on it
+    size_t Threads = 1;
+    // Start the tone search from the tones of the previous frame
+    bool WarmStart = false;
+    // Limit of tones in the frame, the bitstream allows up to 48
+    size_t MaxTones = 48;
+    // Limit of search rounds, each round adds up to one tone in each subband. 0 - no limit
+    size_t MaxRounds = 0;
+    // Number of the lowest subbands to search tones in, up to 8
+    size_t Subbands = 8;
+    // Tones of the subband are rejected if they decrease the residual less than this ratio
+    float ResidualThreshold = 1.05f;
+    // Check tones against the next frame to continue them without a stop point
+    bool LookAheadCheck = true;
+};
+
+// Work done by the tone search since the processor was created
+struct TGhaStat {
+    uint64_t Frames = 0;
+    uint64_t Rounds = 0;
+    uint64_t AdjustCalls = 0;
+    uint64_t AnalyzeCalls = 0;
+};
+
 class IGhaProcessor {
 public:
     using TBufPtr = std::array<const float*, 2>;
     virtual ~IGhaProcessor() {}
     virtual const TAt3PGhaData* DoAnalize(TBufPtr b1, TBufPtr b2, float* w1, float* w2) = 0;
+    virtual const TGhaStat& GetStat() const = 0;
 };
 
-std::unique_ptr<IGhaProcessor> MakeGhaProcessor0(bool stereo);
+std::unique_ptr<IGhaProcessor> MakeGhaProcessor0(bool stereo, const TGhaSettings& settings = TGhaSettings());
 
 } // namespace NAtracDEnc
 
@@ -0,0 +1,124 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "at3p_gha.h"
+#include "ff/atrac3plus.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace NAtracDEnc;
+
+namespace {
+
+// Dense stereo tonal signal, 5 tones in each of 8 subbands of both channels,
+// so every frame is analyzed up to the limit of 48 tones
+void GenDenseTones(std::vector<float> bufs[2], size_t frames) {
+    for (size_t ch = 0; ch < 2; ch++) {
+        bufs[ch].assign(2048 * (frames + 1), 0.0f);
+        for (size_t f = 0; f <= frames; f++) {
+            for (size_t sb = 0; sb < 8; sb++) {
+                for (size_t t = 0; t < 5; t++) {
+                    const double freq = (150.0 + 250.0 * t + 37.0 * sb + 11.0 * ch) / (44100.0 / 16.0);
+                    const double amp = 6000.0 / (t + 1);
+                    for (size_t i = 0; i < 128; i++) {
+                        const double n = f * 128 + i;
+                        bufs[ch][f * 2048 + sb * 128 + i] += amp * sin(2 * M_PI * freq * n + t + sb);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Tone search and tone subtraction of one stereo frame with 48 tones
+void BM_GhaAnalize(benchmark::State& state) {
+    const size_t frames = 8;
+    std::vector<float> bufs[2];
+    GenDenseTones(bufs, frames);
+
+    auto processor = MakeGhaProcessor0(true);
+    std::vector<float> w1(2048);
+    std::vector<float> w2(2048);
+    size_t f = 0;
+    size_t tones = 0;
+    for (auto _ : state) {
+        const float* b1 = &bufs[0][f * 2048];
+        const float* b2 = &bufs[1][f * 2048];
+        const TAt3PGhaData* res = processor->DoAnalize({b1, b1 + 2048}, {b2, b2 + 2048}, w1.data(), w2.data());
+        if (res) {
+            tones = res->Waves[0].WaveParams.size() + res->Waves[1].WaveParams.size();
+        }
+        benchmark::DoNotOptimize(w1.data());
+        benchmark::DoNotOptimize(w2.data());
+        f = (f + 1) % frames;
+    }
+    state.counters["tones"] = tones;
+}
+
+// Synthesis of 48 tones (3 tones in each of 8 subbands of both channels)
+// overlapped with 48 tones of the previous frame, as done to get the residual
+void BM_GenerateTones(benchmark::State& state) {
+    ff_atrac3p_init_dsp_static();
+
+    static Atrac3pChanUnitCtx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.waves_info = &ctx.wave_synth_hist[0];
+    ctx.waves_info_prev = &ctx.wave_synth_hist[1];
+
+    for (Atrac3pWaveSynthParams* synth : {ctx.waves_info, ctx.waves_info_prev}) {
+        synth->tones_present = 1;
+        synth->amplitude_mode = 1;
+        synth->num_tone_bands = 8;
+        for (int i = 0; i < 48; i++) {
+            synth->waves[i].freq_index = 37 + 61 * i % 1000;
+            synth->waves[i].amp_sf = 40 + i % 16;
+            synth->waves[i].phase_index = i % 32;
+        }
+    }
+
+    for (size_t ch = 0; ch < 2; ch++) {
+        Atrac3pChanParams& chan = ctx.channels[ch];
+        chan.tones_info = &chan.tones_info_hist[0][0];
+        chan.tones_info_prev = &chan.tones_info_hist[1][0];
+        for (size_t sb = 0; sb < 8; sb++) {
+            for (Atrac3pWavesData* info : {&chan.tones_info[sb], &chan.tones_info_prev[sb]}) {
+                info->num_wavs = 3;
+                info->start_index = (ch * 8 + sb) * 3;
+            }
+        }
+    }
+
+    std::vector<float> out(2 * 2048);
+    for (auto _ : state) {
+        for (size_t ch = 0; ch < 2; ch++) {
+            for (size_t sb = 0; sb < 8; sb++) {
+                ff_atrac3p_generate_tones(&ctx, ch, sb, &out[ch * 2048 + sb * 128]);
+            }
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_GhaAnalize);
+BENCHMARK(BM_GenerateTones);
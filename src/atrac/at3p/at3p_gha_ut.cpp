@@ -785,3 +785,156 @@ TEST(AT3PGHA, 999hz948_long_frame_mono) {
 TEST(AT3PGHA, 1345hz826_long_frame_mono) {
     CheckReduction(1345.826, 1000);
 }
+
+static void ExpectSameGha(const TAt3PGhaData* a, const TAt3PGhaData* b, size_t channels) {
+    ASSERT_EQ(a == nullptr, b == nullptr);
+    if (!a) {
+        return;
+    }
+    ASSERT_EQ(a->NumToneBands, b->NumToneBands);
+    EXPECT_EQ(a->SecondIsLeader, b->SecondIsLeader);
+    for (size_t ch = 0; ch < channels; ch++) {
+        for (size_t sb = 0; sb < a->NumToneBands; sb++) {
+            if (ch) {
+                EXPECT_EQ(a->ToneSharing[sb], b->ToneSharing[sb]);
+                if (a->ToneSharing[sb]) {
+                    continue;
+                }
+            }
+            ASSERT_EQ(a->GetNumWaves(ch, sb), b->GetNumWaves(ch, sb));
+            EXPECT_EQ(a->GetEnvelope(ch, sb), b->GetEnvelope(ch, sb));
+            const auto wa = a->GetWaves(ch, sb);
+            const auto wb = b->GetWaves(ch, sb);
+            for (size_t i = 0; i < wa.second; i++) {
+                EXPECT_EQ(wa.first[i].FreqIndex, wb.first[i].FreqIndex);
+                EXPECT_EQ(wa.first[i].AmpSf, wb.first[i].AmpSf);
+                EXPECT_EQ(wa.first[i].PhaseIndex, wb.first[i].PhaseIndex);
+            }
+        }
+    }
+}
+
+// Dense stereo tonal signal, more tones than allowed in the frame,
+// so the parallel search have to drop steps the same way as the serial one.
+TEST(AT3PGHA, parallel_same_as_serial_stereo) {
+    const size_t frames = 6;
+    vector<float> bufs[2];
+    for (size_t ch = 0; ch < 2; ch++) {
+        bufs[ch].resize(2048 * (frames + 1));
+        for (size_t f = 0; f <= frames; f++) {
+            for (size_t sb = 0; sb < 8; sb++) {
+                for (size_t t = 0; t < 5; t++) {
+                    const double freq = (150.0 + 250.0 * t + 37.0 * sb + 11.0 * ch) / (44100.0 / 16.0);
+                    const double amp = 6000.0 / (t + 1);
+                    for (size_t i = 0; i < 128; i++) {
+                        const double n = f * 128 + i;
+                        bufs[ch][f * 2048 + sb * 128 + i] += amp * sin(2 * M_PI * freq * n + t + sb);
+                    }
+                }
+            }
+        }
+    }
+
+    TGhaSettings settings;
+    settings.Threads = 4;
+    auto serial = MakeGhaProcessor0(true);
+    auto parallel = MakeGhaProcessor0(true, settings);
+    for (size_t f = 0; f < frames; f++) {
+        const float* b1 = &bufs[0][f * 2048];
+        const float* b2 = &bufs[1][f * 2048];
+        float w[4][2048] = {{0}};
+        const TAt3PGhaData* a = serial->DoAnalize({b1, b1 + 2048}, {b2, b2 + 2048}, w[0], w[1]);
+        const TAt3PGhaData* b = parallel->DoAnalize({b1, b1 + 2048}, {b2, b2 + 2048}, w[2], w[3]);
+        ExpectSameGha(a, b, 2);
+        EXPECT_EQ(0, memcmp(w[0], w[2], sizeof(w[0])));
+        EXPECT_EQ(0, memcmp(w[1], w[3], sizeof(w[1])));
+    }
+}
+
+// Stationary tones: the warm search starts from the tones of the previous frame,
+// so only the adjust of these tones and one final probe is needed per subband.
+TEST(AT3PGHA, warm_start_stationary_mono) {
+    const size_t frames = 16;
+    vector<float> buf(2048 * (frames + 1));
+    for (size_t f = 0; f <= frames; f++) {
+        for (size_t sb = 0; sb < 4; sb++) {
+            for (size_t t = 0; t < 2; t++) {
+                const double freq = (300.0 + 700.0 * t + 53.0 * sb) / (44100.0 / 16.0);
+                const double amp = 8000.0 / (t + 1);
+                for (size_t i = 0; i < 128; i++) {
+                    const double n = f * 128 + i;
+                    buf[f * 2048 + sb * 128 + i] += amp * sin(2 * M_PI * freq * n + t + sb);
+                }
+            }
+        }
+    }
+
+    TGhaSettings settings;
+    settings.WarmStart = true;
+    auto cold = MakeGhaProcessor0(false);
+    auto warm = MakeGhaProcessor0(false, settings);
+    for (size_t f = 0; f < frames; f++) {
+        const float* b = &buf[f * 2048];
+        float w[4][2048] = {{0}};
+        const TAt3PGhaData* a = cold->DoAnalize({b, b + 2048}, {nullptr, nullptr}, w[0], w[1]);
+        const TAt3PGhaData* c = warm->DoAnalize({b, b + 2048}, {nullptr, nullptr}, w[2], w[3]);
+        ASSERT_TRUE(a);
+        ASSERT_TRUE(c);
+        ASSERT_EQ(a->NumToneBands, c->NumToneBands);
+        for (size_t sb = 0; sb < a->NumToneBands; sb++) {
+            EXPECT_EQ(a->GetNumWaves(0, sb), c->GetNumWaves(0, sb));
+        }
+    }
+
+    const TGhaStat& coldStat = cold->GetStat();
+    const TGhaStat& warmStat = warm->GetStat();
+    EXPECT_EQ(coldStat.Frames, frames);
+    EXPECT_EQ(warmStat.Frames, frames);
+    EXPECT_LT(warmStat.Rounds, coldStat.Rounds);
+    EXPECT_LT(warmStat.AnalyzeCalls, coldStat.AnalyzeCalls);
+    EXPECT_LT(warmStat.AdjustCalls, coldStat.AdjustCalls);
+}
+
+TEST(AT3PGHA, settings_limits) {
+    vector<float> bufs[2];
+    for (size_t ch = 0; ch < 2; ch++) {
+        bufs[ch].resize(2048 * 2);
+        for (size_t sb = 0; sb < 8; sb++) {
+            for (size_t t = 0; t < 5; t++) {
+                const double freq = (150.0 + 250.0 * t + 37.0 * sb + 11.0 * ch) / (44100.0 / 16.0);
+                const double amp = 6000.0 / (t + 1);
+                for (size_t f = 0; f < 2; f++) {
+                    for (size_t i = 0; i < 128; i++) {
+                        const double n = f * 128 + i;
+                        bufs[ch][f * 2048 + sb * 128 + i] += amp * sin(2 * M_PI * freq * n + t + sb);
+                    }
+                }
+            }
+        }
+    }
+
+    TGhaSettings settings;
+    settings.Subbands = 2;
+    settings.MaxTones = 7;
+    settings.MaxRounds = 3;
+    auto processor = MakeGhaProcessor0(true, settings);
+    const float* b1 = bufs[0].data();
+    const float* b2 = bufs[1].data();
+    float w[2][2048] = {{0}};
+    const TAt3PGhaData* res = processor->DoAnalize({b1, b1 + 2048}, {b2, b2 + 2048}, w[0], w[1]);
+    ASSERT_TRUE(res);
+    EXPECT_LE(res->NumToneBands, 2);
+    size_t tones = 0;
+    for (size_t ch = 0; ch < 2; ch++) {
+        for (size_t sb = 0; sb < res->NumToneBands; sb++) {
+            if (ch && res->ToneSharing[sb]) {
+                continue;
+            }
+            EXPECT_LE(res->GetNumWaves(ch, sb), 3);
+            tones += res->GetNumWaves(ch, sb);
+        }
+    }
+    EXPECT_GT(tones, 0);
+    EXPECT_LE(tones, 7);
+    EXPECT_LE(processor->GetStat().Rounds, 3);
+}
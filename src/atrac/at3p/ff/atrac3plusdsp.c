@@ -33,6 +33,7 @@
 
 #define TWOPI (2 * M_PI)
 #define DEQUANT_PHASE(ph) (((ph) & 0x1F) << 6)
+#define SYNTH_BLOCK 16 ///< samples synthesized at once
 
 static float sine_table[2048]; ///< wave table
 static float hann_window[256]; ///< Hann windowing function
@@ -79,25 +80,40 @@ static void waves_synth(Atrac3pWaveSynthParams *synth_param,
                         Atrac3pWaveEnvelope *envelope,
                         int invert_phase, int reg_offset, float *out)
 {
-    int i, wn, inc, pos;
-    double amp;
+    int i, j, wn, pos;
+    int inc[48], start[48];
+    double amp[48];
+    float acc[SYNTH_BLOCK], wave[SYNTH_BLOCK];
     Atrac3pWaveParam *wave_param = &synth_param->waves[waves_info->start_index];
 
     for (wn = 0; wn < waves_info->num_wavs; wn++, wave_param++) {
         /* amplitude dequantization */
-        amp = amp_sf_tab[wave_param->amp_sf] *
-              (!synth_param->amplitude_mode
-               ? (wave_param->amp_index + 1) / 15.13f
-               : 1.0f);
-
-        inc = wave_param->freq_index;
-        pos = DEQUANT_PHASE(wave_param->phase_index) - (reg_offset ^ 128) * inc & 2047;
-
-        /* waveform generation */
-        for (i = 0; i < 128; i++) {
-            out[i] += sine_table[pos] * amp;
-            pos     = (pos + inc) & 2047;
+        amp[wn] = amp_sf_tab[wave_param->amp_sf] *
+                  (!synth_param->amplitude_mode
+                   ? (wave_param->amp_index + 1) / 15.13f
+                   : 1.0f);
+
+        inc[wn]   = wave_param->freq_index;
+        start[wn] = DEQUANT_PHASE(wave_param->phase_index) - (reg_offset ^ 128) * inc[wn] & 2047;
+    }
+
+    /* waveform generation, all waves are accumulated block by block in the
+     * same order as wave by wave. Table positions inside of the block do not
+     * depend on each other, so the loops are vectorizable. */
+    for (i = 0; i < 128; i += SYNTH_BLOCK) {
+        for (j = 0; j < SYNTH_BLOCK; j++)
+            acc[j] = out[i + j];
+
+        for (wn = 0; wn < waves_info->num_wavs; wn++) {
+            pos = start[wn] + i * inc[wn];
+            for (j = 0; j < SYNTH_BLOCK; j++)
+                wave[j] = sine_table[(pos + j * inc[wn]) & 2047];
+            for (j = 0; j < SYNTH_BLOCK; j++)
+                acc[j] += wave[j] * amp[wn];
         }
+
+        for (j = 0; j < SYNTH_BLOCK; j++)
+            out[i + j] = acc[j];
     }
 
     /* invert phase if requested */
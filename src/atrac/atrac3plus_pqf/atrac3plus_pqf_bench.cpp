@@ -0,0 +1,45 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "atrac3plus_pqf.h"
+#include <bench_signal.h>
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+using namespace NAtracDEnc;
+
+namespace {
+
+// 16 band analysis of one ATRAC3plus frame (2048 samples)
+void BM_PqfAnalysis(benchmark::State& state) {
+    const std::vector<float> in = GenSignal(ESignal::PinkNoise, 2048, 1);
+    std::vector<float> out(2048);
+    at3plus_pqf_a_ctx_t ctx = at3plus_pqf_create_a_ctx();
+    for (auto _ : state) {
+        at3plus_pqf_do_analyse(ctx, in.data(), out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    at3plus_pqf_free_a_ctx(ctx);
+    state.SetItemsProcessed(state.iterations() * 2048);
+}
+
+} // namespace
+
+BENCHMARK(BM_PqfAnalysis);
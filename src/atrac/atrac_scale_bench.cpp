@@ -0,0 +1,59 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "atrac_scale.h"
+#include "at3/atrac3.h"
+#include <bench_signal.h>
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+using namespace NAtracDEnc;
+using namespace NAtrac3;
+
+namespace {
+
+// Scale factor search and normalization of one BFU, state.range(0) - BFU length
+void BM_Scale(benchmark::State& state) {
+    const uint16_t len = state.range(0);
+    const std::vector<float> in = GenSignal(ESignal::PinkNoise, len, 1);
+    TScaler<TAtrac3Data> scaler;
+    for (auto _ : state) {
+        TScaledBlock block = scaler.Scale(in.data(), len);
+        benchmark::DoNotOptimize(block.Values.data());
+    }
+    state.SetItemsProcessed(state.iterations() * len);
+}
+
+// Quantization of one BFU, state.range(0) - BFU length, state.range(1) - energy adjustment
+void BM_QuantMantisas(benchmark::State& state) {
+    const uint32_t len = state.range(0);
+    const bool ea = state.range(1);
+    const std::vector<float> in = GenSignal(ESignal::WhiteNoise, len, 1);
+    std::vector<int> mantisas(len);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(QuantMantisas(in.data(), 0, len, 7.5f, ea, mantisas.data()));
+    }
+    state.SetItemsProcessed(state.iterations() * len);
+}
+
+} // namespace
+
+BENCHMARK(BM_Scale)->Arg(8)->Arg(32);
+BENCHMARK(BM_QuantMantisas)->Args({8, 0})->Args({32, 0})->Args({32, 1});
@@ -0,0 +1,47 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+namespace NAtracDEnc {
+
+// Speed preset, trades quality for encoding speed.
+// Each codec maps the preset to its own knobs.
+enum class ESpeed {
+    Fastest,
+    Fast,
+    Default,
+    Slow
+};
+
+inline ESpeed ParseSpeed(const std::string& name) {
+    if (name == "fastest")
+        return ESpeed::Fastest;
+    if (name == "fast")
+        return ESpeed::Fast;
+    if (name == "default")
+        return ESpeed::Default;
+    if (name == "slow")
+        return ESpeed::Slow;
+    throw std::runtime_error("unknown speed preset \"" + name + "\", expected fastest, fast, default or slow");
+}
+
+} // namespace NAtracDEnc
@@ -25,6 +25,7 @@
 #include "atrac/at1/atrac1_qmf.h"
 #include "atrac/at1/atrac1_bitalloc.h"
 #include "atrac/atrac_psy_common.h"
+#include "stage_stat.h"
 #include "util.h"
 
 namespace NAtracDEnc {
@@ -33,6 +34,37 @@ using namespace NAtrac1;
 using namespace NMDCT;
 using std::vector;
 
+class TAtrac1Encoder::TDeferredOutput : public ICompressedOutput {
+public:
+    explicit TDeferredOutput(ICompressedOutput* out)
+        : Out(out)
+    {}
+    void WriteFrame(std::vector<char> data) override {
+        Frames.push_back(std::move(data));
+    }
+    std::string GetName() const override { return Out->GetName(); }
+    size_t GetChannelNum() const override { return Out->GetChannelNum(); }
+    void Flush() {
+        for (auto& frame : Frames) {
+            Out->WriteFrame(std::move(frame));
+        }
+        Frames.clear();
+    }
+private:
+    ICompressedOutput* Out;
+    std::vector<std::vector<char>> Frames;
+};
+
+// Sound unit with the smallest BFU amount, all word lengths and scale factors are zero
+static vector<char> MakeSilentFrame() {
+    TFrameCapture capture(1);
+    TAtrac1BitStreamWriter writer(&capture);
+    const uint32_t bfuNum = TAtrac1Data::BfuAmountTab[0];
+    writer.WriteBitStream(vector<uint32_t>(bfuNum, 0), vector<TScaledBlock>(bfuNum, TScaledBlock(0)),
+                          0, TAtrac1Data::TBlockSizeMod());
+    return std::move(capture.Frames.back());
+}
+
 TAtrac1Encoder::TAtrac1Encoder(TCompressedOutputPtr&& aea, TAtrac1EncodeSettings&& settings)
     : Aea(std::move(aea))
     , Settings(std::move(settings))
@@ -40,7 +72,26 @@ TAtrac1Encoder::TAtrac1Encoder(TCompressedOutputPtr&& aea, TAtrac1EncodeSettings
     , PcmBufMid({{{0}}})
     , PcmBufHi({{{0}}})
     , LoudnessCurve(CreateLoudnessCurve(TAtrac1Data::NumSamples))
+    , Lanes((Settings.GetParallelChannels() && Aea->GetChannelNum() == 2) ? 2 : 1)
+    // The state (QMF, MDCT overlap and transient detectors) depends on less than
+    // the previous frame, with the margin for the frame which brought it to rest
+    , Silence(Aea->GetChannelNum(), TAtrac1Data::NumSamples, 2 * (TAtrac1Data::NumSamples + Delay))
+    , SilentFrame(MakeSilentFrame())
+{
+    if (Lanes.GetThreadsNum() > 1) {
+        SecondChannelOut.reset(new TDeferredOutput(Aea.get()));
+    }
+}
+
+TAtrac1Encoder::~TAtrac1Encoder() = default;
+
+TRateControlStat TAtrac1Encoder::GetRateControlStat() const
 {
+    TRateControlStat stat;
+    for (const auto& bitAlloc : BitAllocs) {
+        stat += bitAlloc->GetRateControlStat();
+    }
+    return stat;
 }
 
 TAtrac1Decoder::TAtrac1Decoder(TCompressedInputPtr&& aea)
@@ -141,18 +192,32 @@ TPCMEngine::TProcessLambda TAtrac1Decoder::GetLambda() {
         float sum[512];
         const uint32_t srcChannels = Aea->GetChannelNum();
         for (uint32_t channel = 0; channel < srcChannels; channel++) {
-            std::unique_ptr<ICompressedIO::TFrame> frame(Aea->ReadFrame());
+            std::unique_ptr<ICompressedIO::TFrame> frame;
+            {
+                TStageScope stage(EStage::Container);
+                frame = Aea->ReadFrame();
+            }
 
             TBitStream bitstream(frame->Get(), frame->Size());
 
-            TAtrac1Data::TBlockSizeMod mode(&bitstream);
-            TAtrac1Dequantiser dequantiser;
             vector<float> specs;
             specs.resize(512);;
-            dequantiser.Dequant(&bitstream, mode, &specs[0]);
+            TAtrac1Data::TBlockSizeMod mode;
+            {
+                TStageScope stage(EStage::Bitstream);
+                mode = TAtrac1Data::TBlockSizeMod(&bitstream);
+                TAtrac1Dequantiser dequantiser;
+                dequantiser.Dequant(&bitstream, mode, &specs[0]);
+            }
 
-            IMdct(&specs[0], mode, &PcmBufLow[channel][0], &PcmBufMid[channel][0], &PcmBufHi[channel][0]);
-            SynthesisFilterBank[channel].Synthesis(&sum[0], &PcmBufLow[channel][0], &PcmBufMid[channel][0], &PcmBufHi[channel][0]);
+            {
+                TStageScope stage(EStage::Mdct);
+                IMdct(&specs[0], mode, &PcmBufLow[channel][0], &PcmBufMid[channel][0], &PcmBufHi[channel][0]);
+            }
+            {
+                TStageScope stage(EStage::FilterBank);
+                SynthesisFilterBank[channel].Synthesis(&sum[0], &PcmBufLow[channel][0], &PcmBufMid[channel][0], &PcmBufHi[channel][0]);
+            }
             for (size_t i = 0; i < TAtrac1Data::NumSamples; ++i) {
                 if (sum[i] > PcmValueMax)
                     sum[i] = PcmValueMax;
@@ -172,7 +237,9 @@ TPCMEngine::TProcessLambda TAtrac1Encoder::GetLambda() {
 
     BitAllocs.reserve(srcChannels);
     for (uint32_t ch = 0; ch < srcChannels; ch++) {
-        BitAllocs.emplace_back(new TAtrac1SimpleBitAlloc(Aea.get(), Settings.GetBfuIdxConst(), Settings.GetFastBfuNumSearch()));
+        ICompressedOutput* out = (ch && SecondChannelOut) ? SecondChannelOut.get() : Aea.get();
+        BitAllocs.emplace_back(new TAtrac1SimpleBitAlloc(out, Settings.GetBfuIdxConst(), Settings.GetFastBfuNumSearch(),
+                                                            Settings.GetWarmRateControl(), Settings.GetShiftPrecision()));
     }
 
     struct TChannelData {
@@ -192,16 +259,35 @@ TPCMEngine::TProcessLambda TAtrac1Encoder::GetLambda() {
         TAtrac1Data::TBlockSizeMod blockSz[2];
 
         uint32_t windowMasks[2] = {0};
-        for (uint32_t channel = 0; channel < srcChannels; channel++) {
+        bool silent[2] = {false, false};
+        if (Settings.GetSkipSilence()) {
+            Silence.Push(data, srcChannels);
+            for (uint32_t ch = 0; ch < srcChannels; ch++) {
+                silent[ch] = Silence.IsSilent(ch);
+            }
+        }
+
+        // Channels meet only at loudness tracking, so all stages before it run on own lanes
+        Lanes.ParallelFor(srcChannels, [&](size_t channel, size_t) {
+            if (silent[channel]) {
+                // Filter banks and detectors are at rest, the spectrum is zero
+                (*buf)[channel].Loudness = 0.0;
+                return;
+            }
+
             float src[TAtrac1Data::NumSamples];
             for (size_t i = 0; i < TAtrac1Data::NumSamples; ++i) {
                 src[i] = data[i * srcChannels + channel];
             }
 
-            AnalysisFilterBank[channel].Analysis(&src[0], &PcmBufLow[channel][0], &PcmBufMid[channel][0], &PcmBufHi[channel][0]);
+            {
+                TStageScope stage(EStage::FilterBank);
+                AnalysisFilterBank[channel].Analysis(&src[0], &PcmBufLow[channel][0], &PcmBufMid[channel][0], &PcmBufHi[channel][0]);
+            }
 
             uint32_t& windowMask = windowMasks[channel];
             if (Settings.GetWindowMode() == TAtrac1EncodeSettings::EWindowMode::EWM_AUTO) {
+                TStageScope stage(EStage::Transient);
                 windowMask |= (uint32_t)TransientDetectors.GetDetector(channel, 0).Detect(&PcmBufLow[channel][0]);
 
                 const vector<float>& invMid = InvertSpectr<128>(&PcmBufMid[channel][0]);
@@ -220,7 +306,11 @@ TPCMEngine::TProcessLambda TAtrac1Encoder::GetLambda() {
 
             auto& specs = (*buf)[channel].Specs;
 
-            Mdct(&specs[0], &PcmBufLow[channel][0], &PcmBufMid[channel][0], &PcmBufHi[channel][0], blockSz[channel]);
+            {
+                TStageScope stage(EStage::Mdct);
+                TAtrac1MDCT& mdct = channel ? SecondMdct : *this;
+                mdct.Mdct(&specs[0], &PcmBufLow[channel][0], &PcmBufMid[channel][0], &PcmBufHi[channel][0], blockSz[channel]);
+            }
 
             float l = 0.0;
             for (size_t i = 0; i < specs.size(); i++) {
@@ -228,7 +318,7 @@ TPCMEngine::TProcessLambda TAtrac1Encoder::GetLambda() {
                 l += e * LoudnessCurve[i];
             }
             (*buf)[channel].Loudness = l;
-        }
+        });
 
         if (srcChannels == 2 && windowMasks[0] == 0 && windowMasks[1] == 0) {
             Loudness = TrackLoudness(Loudness, (*buf)[0].Loudness, (*buf)[1].Loudness);
@@ -236,9 +326,27 @@ TPCMEngine::TProcessLambda TAtrac1Encoder::GetLambda() {
             Loudness = TrackLoudness(Loudness, (*buf)[0].Loudness);
         }
 
-        for (uint32_t channel = 0; channel < srcChannels; channel++) {
-            BitAllocs[channel]->Write(Scaler.ScaleFrame((*buf)[channel].Specs, blockSz[channel]), blockSz[channel], Loudness / LoudFactor);
+        Lanes.ParallelFor(srcChannels, [&](size_t channel, size_t) {
+            if (silent[channel]) {
+                TStageScope stage(EStage::Container);
+                ICompressedOutput* out = (channel && SecondChannelOut) ? SecondChannelOut.get() : Aea.get();
+                out->WriteFrame(SilentFrame);
+                return;
+            }
+            vector<TScaledBlock> scaledBlocks;
+            {
+                TStageScope stage(EStage::Scale);
+                scaledBlocks = Scaler.ScaleFrame((*buf)[channel].Specs, blockSz[channel]);
+            }
+            TStageScope stage(EStage::BitAlloc);
+            BitAllocs[channel]->Write(scaledBlocks, blockSz[channel], Loudness / LoudFactor);
+        });
+
+        if (SecondChannelOut) {
+            TStageScope stage(EStage::Container);
+            SecondChannelOut->Flush();
         }
+        SkippedFrames += silent[0] + silent[1];
 
         return TPCMEngine::EProcessResult::PROCESSED;
     };
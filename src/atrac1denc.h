@@ -20,10 +20,13 @@
 #include "pcmengin.h"
 #include "aea.h"
 #include "transient_detector.h"
+#include "silence.h"
 #include "atrac/at1/atrac1.h"
 #include "atrac/at1/atrac1_qmf.h"
 #include "atrac/atrac_scale.h"
 #include "lib/mdct/mdct.h"
+#include "lib/bs_encode/rate_control.h"
+#include "lib/parallel/thread_pool.h"
 
 #include <assert.h>
 #include <vector>
@@ -68,6 +71,14 @@ class TAtrac1Encoder : public IProcessor, public TAtrac1MDCT {
     const std::vector<float> LoudnessCurve;
     std::vector<std::unique_ptr<NAtrac1::IAtrac1BitAlloc>> BitAllocs;
 
+    // Two lanes to process channels of a stereo frame in parallel, one lane if disabled
+    TThreadPool Lanes;
+    // MDCT keeps the result in the internal buffer, so the second channel has own instance
+    TAtrac1MDCT SecondMdct;
+    // Frames of the second channel are kept here until the frame of the first one is written
+    class TDeferredOutput;
+    std::unique_ptr<TDeferredOutput> SecondChannelOut;
+
     class TTransientDetectors {
         std::vector<TTransientDetector> transientDetectorLow;
         std::vector<TTransientDetector> transientDetectorMid;
@@ -101,18 +112,30 @@ class TAtrac1Encoder : public IProcessor, public TAtrac1MDCT {
     static constexpr float LoudFactor = 0.006;
     float Loudness = LoudFactor;
 
+    // Channels of silent frames are not encoded, the precomputed sound unit is written instead
+    TSilenceDetector Silence;
+    const std::vector<char> SilentFrame;
+    uint64_t SkippedFrames = 0;
+
 public:
     TAtrac1Encoder(TCompressedOutputPtr&& aea, NAtrac1::TAtrac1EncodeSettings&& settings);
+    ~TAtrac1Encoder();
     TPCMEngine::TProcessLambda GetLambda() override;
+    TRateControlStat GetRateControlStat() const;
+    // Number of silent sound units (one channel of a frame) written without encoding
+    uint64_t GetSkippedFrames() const { return SkippedFrames; }
+    // Delay of the encoder and decoder pair in samples without the frame look-ahead:
+    // two QMF stages (47 + 2 * 47) and 16 samples of the low band MDCT window tail (4 * 16)
+    static constexpr size_t Delay = 141 + 64;
 };
 
 class TAtrac1Decoder : public IProcessor, public TAtrac1MDCT {
     TCompressedInputPtr Aea;
     const NAtrac1::TAtrac1EncodeSettings Settings;
 
-    float PcmBufLow[2][256 + 16];
-    float PcmBufMid[2][256 + 16];
-    float PcmBufHi[2][512 + 16];
+    float PcmBufLow[2][256 + 16] = {};
+    float PcmBufMid[2][256 + 16] = {};
+    float PcmBufHi[2][512 + 16] = {};
 
     int32_t PcmValueMax = 1;
     int32_t PcmValueMin = -1;
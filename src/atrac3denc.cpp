@@ -19,10 +19,12 @@
 #include "atrac3denc.h"
 #include "transient_detector.h"
 #include "atrac/atrac_psy_common.h"
+#include "stage_stat.h"
 #include <assert.h>
 #include <algorithm>
 #include <iostream>
 #include <cmath>
+#include <stdexcept>
 namespace NAtracDEnc {
 
 using namespace NMDCT;
@@ -89,13 +91,36 @@ void TAtrac3MDCT::Midct(float specs[1024], float* bands[4], TGainDemodulatorArra
     }
 }
 
+static std::vector<TAtrac3Encoder::TOutput> MakeOutputs(TCompressedOutputPtr&& oma, const TContainerParams* params)
+{
+    std::vector<TAtrac3Encoder::TOutput> outputs;
+    outputs.push_back({std::move(oma), params});
+    return outputs;
+}
+
 TAtrac3Encoder::TAtrac3Encoder(TCompressedOutputPtr&& oma, TAtrac3EncoderSettings&& encoderSettings)
-    : Oma(std::move(oma))
+    : TAtrac3Encoder(MakeOutputs(std::move(oma), encoderSettings.ConteinerParams), std::move(encoderSettings))
+{}
+
+TAtrac3Encoder::TAtrac3Encoder(std::vector<TOutput>&& outputs, TAtrac3EncoderSettings&& encoderSettings)
+    : Outputs(std::move(outputs))
     , Params(std::move(encoderSettings))
     , LoudnessCurve(CreateLoudnessCurve(TAtrac3Data::NumSamples))
     , SingleChannelElements(Params.SourceChannels)
+    , Writers(Outputs.size())
+    , Lanes((Params.ParallelChannels && Params.SourceChannels == 2) ? 2 : 1)
     , TransientParamsHistory(Params.SourceChannels, std::vector<TTransientParam>(4))
-{}
+    // The state (QMF, delayed bands, peaks and transient history) depends on less than
+    // the previous frame and its delay, with the margin for the frame which brought it to rest
+    , Silence(Params.SourceChannels, TAtrac3Data::NumSamples, 2 * (TAtrac3Data::NumSamples + Delay))
+{
+    assert(!Outputs.empty() && Outputs[0].Params == Params.ConteinerParams);
+    for (const auto& out : Outputs) {
+        if (out.Params->Js != Params.ConteinerParams->Js) {
+            throw std::runtime_error("ATRAC3 outputs of one encoder must have the same joint stereo mode");
+        }
+    }
+}
 
 TAtrac3Encoder::~TAtrac3Encoder()
 {}
@@ -288,9 +313,58 @@ void TAtrac3Encoder::Matrixing()
     }
 }
 
+TRateControlStat TAtrac3Encoder::GetRateControlStat() const
+{
+    TRateControlStat stat;
+    for (const auto& writer : BitStreamWriters) {
+        if (auto bitStreamWriter = writer.lock()) {
+            stat += bitStreamWriter->GetRateControlStat();
+        }
+    }
+    return stat;
+}
+
+// Sound unit of each output for zero spectrum, encoded by own writers to keep
+// the rate control of the main ones untouched
+vector<vector<char>> TAtrac3Encoder::MakeSilentFrames()
+{
+    using TSce = TAtrac3BitStreamWriter::TSingleChannelElement;
+    const vector<float> zero(TAtrac3Data::NumSamples);
+    vector<TSce> sces(Params.SourceChannels);
+    for (auto& sce : sces) {
+        sce.ScaledBlocks = Scaler.ScaleFrame(zero, TAtrac3Data::TBlockSizeMod());
+        sce.Loudness = 0.0;
+    }
+    if (Params.ConteinerParams->Js && sces.size() == 1) {
+        sces.resize(2);
+        sces[1].SubbandInfo.Info.resize(1);
+    }
+
+    vector<vector<char>> frames;
+    for (const auto& out : Outputs) {
+        TFrameCapture capture(out.Oma->GetChannelNum());
+        TAtrac3BitStreamWriter writer(&capture, *out.Params, Params.BfuIdxConst);
+        writer.WriteSoundUnit(sces, LoudFactor);
+        frames.push_back(std::move(capture.Frames.back()));
+    }
+    return frames;
+}
+
 TPCMEngine::TProcessLambda TAtrac3Encoder::GetLambda()
 {
-    std::shared_ptr<TAtrac3BitStreamWriter> bitStreamWriter(new TAtrac3BitStreamWriter(Oma.get(), *Params.ConteinerParams, Params.BfuIdxConst));
+    using TWriters = vector<std::shared_ptr<TAtrac3BitStreamWriter>>;
+    auto bitStreamWriters = std::make_shared<TWriters>();
+    BitStreamWriters.clear();
+    for (const auto& out : Outputs) {
+        bitStreamWriters->emplace_back(new TAtrac3BitStreamWriter(out.Oma.get(), *out.Params, Params.BfuIdxConst,
+                                                                  Params.WarmRateControl, Params.ShiftPrecision,
+                                                                  Params.EnergyErrCorrection,
+                                                                  Params.FastBfuNumSearch));
+        BitStreamWriters.push_back(bitStreamWriters->back());
+    }
+    if (Params.SkipSilence) {
+        SilentFrames = MakeSilentFrames();
+    }
 
     struct TChannelData {
         TChannelData()
@@ -303,53 +377,74 @@ TPCMEngine::TProcessLambda TAtrac3Encoder::GetLambda()
     using TData = vector<TChannelData>;
     auto buf = std::make_shared<TData>(2);
 
-    return [this, bitStreamWriter, buf](float* data, const TPCMEngine::ProcessMeta& meta) {
+    return [this, bitStreamWriters, buf](float* data, const TPCMEngine::ProcessMeta& meta) {
         using TSce = TAtrac3BitStreamWriter::TSingleChannelElement;
 
-        for (uint32_t channel = 0; channel < meta.Channels; channel++) {
-            float src[TAtrac3Data::NumSamples];
-
-            for (size_t i = 0; i < TAtrac3Data::NumSamples; ++i) {
-                src[i] = data[i * meta.Channels  + channel] / 4.0;
-            }
-
-            {
-                float* p[4] = {PcmBuffer.GetSecond(channel), PcmBuffer.GetSecond(channel+2), PcmBuffer.GetSecond(channel+4), PcmBuffer.GetSecond(channel+6)};
-                AnalysisFilterBank[channel].Analysis(&src[0], p);
-            }
-        }
-
-        if (Params.ConteinerParams->Js && meta.Channels == 2) {
-            Matrixing();
+        bool silent = false;
+        if (Params.SkipSilence) {
+            Silence.Push(data, meta.Channels);
+            silent = Silence.IsSilent();
         }
 
-        for (uint32_t channel = 0; channel < meta.Channels; channel++) {
-            auto& specs = (*buf)[channel].Specs;
-            TSce* sce = &SingleChannelElements[channel];
-
-            sce->SubbandInfo.Reset();
-            if (!Params.NoGainControll) {
-                float* p[4] = {PcmBuffer.GetSecond(channel), PcmBuffer.GetSecond(channel+2), PcmBuffer.GetSecond(channel+4), PcmBuffer.GetSecond(channel+6)};
-                CreateSubbandInfo(p, channel, &sce->SubbandInfo); //4 detectors per band
+        if (silent) {
+            // Filter banks, peaks and transient history are at rest, the spectrum is zero
+            for (size_t channel = 0; channel < meta.Channels; channel++) {
+                SingleChannelElements[channel].Loudness = 0.0;
             }
-
-            float* maxOverlapLevels = PrevPeak[channel];
-
-            {
-                float* p[4] = {PcmBuffer.GetFirst(channel), PcmBuffer.GetFirst(channel+2), PcmBuffer.GetFirst(channel+4), PcmBuffer.GetFirst(channel+6)};
-                Mdct(specs.data(), p, maxOverlapLevels, MakeGainModulatorArray(sce->SubbandInfo));
-            }
-
-            float l = 0;
-            for (size_t i = 0; i < specs.size(); i++) {
-                float e = specs[i] * specs[i];
-                l += e * LoudnessCurve[i];
+        } else {
+            // Channels meet only at matrixing, loudness tracking and the bitstream,
+            // so stages between them run on own lanes
+            Lanes.ParallelFor(meta.Channels, [&](size_t channel, size_t) {
+                float src[TAtrac3Data::NumSamples];
+
+                for (size_t i = 0; i < TAtrac3Data::NumSamples; ++i) {
+                    src[i] = data[i * meta.Channels  + channel] / 4.0;
+                }
+
+                {
+                    TStageScope stage(EStage::FilterBank);
+                    float* p[4] = {PcmBuffer.GetSecond(channel), PcmBuffer.GetSecond(channel+2), PcmBuffer.GetSecond(channel+4), PcmBuffer.GetSecond(channel+6)};
+                    AnalysisFilterBank[channel].Analysis(&src[0], p);
+                }
+            });
+
+            if (Params.ConteinerParams->Js && meta.Channels == 2) {
+                TStageScope stage(EStage::FilterBank);
+                Matrixing();
             }
 
-            sce->Loudness = l;
-
-            //TBlockSize for ATRAC3 - 4 subband, all are long (no short window)
-            sce->ScaledBlocks = Scaler.ScaleFrame(specs, TAtrac3Data::TBlockSizeMod());
+            Lanes.ParallelFor(meta.Channels, [&](size_t channel, size_t) {
+                auto& specs = (*buf)[channel].Specs;
+                TSce* sce = &SingleChannelElements[channel];
+
+                sce->SubbandInfo.Reset();
+                if (!Params.NoGainControll) {
+                    TStageScope stage(EStage::Transient);
+                    float* p[4] = {PcmBuffer.GetSecond(channel), PcmBuffer.GetSecond(channel+2), PcmBuffer.GetSecond(channel+4), PcmBuffer.GetSecond(channel+6)};
+                    CreateSubbandInfo(p, channel, &sce->SubbandInfo); //4 detectors per band
+                }
+
+                float* maxOverlapLevels = PrevPeak[channel];
+
+                {
+                    TStageScope stage(EStage::Mdct);
+                    float* p[4] = {PcmBuffer.GetFirst(channel), PcmBuffer.GetFirst(channel+2), PcmBuffer.GetFirst(channel+4), PcmBuffer.GetFirst(channel+6)};
+                    TAtrac3MDCT& mdct = channel ? SecondMdct : *this;
+                    mdct.Mdct(specs.data(), p, maxOverlapLevels, MakeGainModulatorArray(sce->SubbandInfo));
+                }
+
+                float l = 0;
+                for (size_t i = 0; i < specs.size(); i++) {
+                    float e = specs[i] * specs[i];
+                    l += e * LoudnessCurve[i];
+                }
+
+                sce->Loudness = l;
+
+                //TBlockSize for ATRAC3 - 4 subband, all are long (no short window)
+                TStageScope stage(EStage::Scale);
+                sce->ScaledBlocks = Scaler.ScaleFrame(specs, TAtrac3Data::TBlockSizeMod());
+            });
         }
 
         if (meta.Channels == 2 && !Params.ConteinerParams->Js) {
@@ -370,7 +465,20 @@ TPCMEngine::TProcessLambda TAtrac3Encoder::GetLambda()
             SingleChannelElements[1].SubbandInfo.Info.resize(1);
         }
 
-        bitStreamWriter->WriteSoundUnit(SingleChannelElements, Loudness);
+        if (silent) {
+            TStageScope stage(EStage::Container);
+            for (size_t i = 0; i < Outputs.size(); i++) {
+                Outputs[i].Oma->WriteFrame(SilentFrames[i]);
+            }
+            SkippedFrames++;
+            return TPCMEngine::EProcessResult::PROCESSED;
+        }
+
+        // The front end result does not depend on the bitrate, so each output only
+        // runs own bit allocation on it
+        Writers.ParallelFor(bitStreamWriters->size(), [&](size_t i, size_t) {
+            (*bitStreamWriters)[i]->WriteSoundUnit(SingleChannelElements, Loudness);
+        });
         return TPCMEngine::EProcessResult::PROCESSED;
     };
 }
@@ -22,16 +22,19 @@
 #include "atrac/at3/atrac3.h"
 #include "atrac/at3/atrac3_qmf.h"
 #include "delay_buffer.h"
+#include "silence.h"
 #include "util.h"
 
 #include "atrac/at3/atrac3_bitstream.h"
 #include "atrac/atrac_scale.h"
 #include "lib/mdct/mdct.h"
+#include "lib/parallel/thread_pool.h"
 #include "gain_processor.h"
 
 #include <algorithm>
 #include <functional>
 #include <array>
+#include <memory>
 #include <cmath>
 namespace NAtracDEnc {
 
@@ -80,7 +83,14 @@ protected:
 
 class TAtrac3Encoder : public IProcessor, public TAtrac3MDCT {
     using TAtrac3Data = NAtrac3::TAtrac3Data;
-    TCompressedOutputPtr Oma;
+public:
+    // Output with own bitrate, all outputs of one encoder share the analysis
+    struct TOutput {
+        TCompressedOutputPtr Oma;
+        const NAtrac3::TContainerParams* Params;
+    };
+private:
+    std::vector<TOutput> Outputs;
     const NAtrac3::TAtrac3EncoderSettings Params;
     const std::vector<float> LoudnessCurve;
     TDelayBuffer<float, 8, 256> PcmBuffer; //8 = 2 channels * 4 bands
@@ -91,6 +101,14 @@ class TAtrac3Encoder : public IProcessor, public TAtrac3MDCT {
 
     TScaler<TAtrac3Data> Scaler;
     std::vector<NAtrac3::TAtrac3BitStreamWriter::TSingleChannelElement> SingleChannelElements;
+    std::vector<std::weak_ptr<NAtrac3::TAtrac3BitStreamWriter>> BitStreamWriters;
+    // One thread per output to write bitstreams of a frame in parallel
+    TThreadPool Writers;
+
+    // Two lanes to process channels of a stereo frame in parallel, one lane if disabled
+    TThreadPool Lanes;
+    // MDCT keeps the result in the internal buffer, so the second channel has own instance
+    TAtrac3MDCT SecondMdct;
 public:
     struct TTransientParam {
         int32_t Attack0Location; // Attack position relative to previous frame
@@ -104,6 +122,12 @@ private:
     std::vector<std::vector<TTransientParam>> TransientParamsHistory;
     static constexpr float LoudFactor = 0.006;
     float Loudness = LoudFactor;
+
+    // Silent frames are not encoded, the precomputed sound unit of each output is written instead
+    TSilenceDetector Silence;
+    std::vector<std::vector<char>> SilentFrames;
+    uint64_t SkippedFrames = 0;
+    std::vector<std::vector<char>> MakeSilentFrames();
 #ifdef ATRAC_UT_PUBLIC
 public:
 #endif
@@ -118,7 +142,17 @@ public:
 
 public:
     TAtrac3Encoder(TCompressedOutputPtr&& oma, NAtrac3::TAtrac3EncoderSettings&& encoderSettings);
+    // Encodes the same input to several outputs, the front end (filter bank, gain control,
+    // MDCT and scaling) runs once per frame. Outputs must have the same joint stereo mode,
+    // the first one must be encoderSettings.ConteinerParams
+    TAtrac3Encoder(std::vector<TOutput>&& outputs, NAtrac3::TAtrac3EncoderSettings&& encoderSettings);
     ~TAtrac3Encoder();
     TPCMEngine::TProcessLambda GetLambda() override;
+    TRateControlStat GetRateControlStat() const;
+    // Number of silent frames written without encoding
+    uint64_t GetSkippedFrames() const { return SkippedFrames; }
+    // Delay of the encoder and decoder pair in samples without the frame look-ahead:
+    // two QMF stages (47 + 2 * 47) and the MDCT overlap of 256 samples per band (4 * 256)
+    static constexpr size_t Delay = 141 + 1024;
 };
 }
@@ -0,0 +1,98 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "atrac3denc.h"
+#include "env.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+using namespace NAtracDEnc;
+using namespace NAtrac3;
+
+namespace {
+
+class TNullOutput : public ICompressedOutput {
+public:
+    void WriteFrame(std::vector<char>) override {}
+    std::string GetName() const override { return {}; }
+    size_t GetChannelNum() const override { return 2; }
+};
+
+// Stereo tone exponentially fading from -6 dBFS down to subnormal levels at the end
+std::vector<float> GenFadeOut(size_t frames) {
+    const size_t len = frames * TAtrac3Data::NumSamples;
+    const double decay = std::log(1e-42 / 0.5) / len;
+    std::vector<float> buf(len * 2);
+    for (size_t i = 0; i < len; i++) {
+        const double amp = 0.5 * std::exp(decay * i);
+        buf[i * 2] = amp * std::sin(2 * M_PI * 440 * i / 44100.0);
+        buf[i * 2 + 1] = amp * std::sin(2 * M_PI * 1250 * i / 44100.0);
+    }
+    return buf;
+}
+
+// Encodes the fade-out frame by frame, state.range(0) enables the encoding thread
+// floating point environment (subnormals flushed to zero). The time of the slowest
+// frame relative to the mean one shows spikes of the decaying tails
+void BM_Atrac3FadeOut(benchmark::State& state) {
+    std::unique_ptr<NEnv::TFloatEnvGuard> env;
+    if (state.range(0)) {
+        env.reset(new NEnv::TFloatEnvGuard());
+    }
+
+    const size_t frames = 64;
+    const std::vector<float> pcm = GenFadeOut(frames);
+    std::vector<float> frame(TAtrac3Data::NumSamples * 2);
+    std::vector<double> frameTime(frames, 0.0);
+    TPCMEngine::ProcessMeta meta = {2};
+
+    for (auto _ : state) {
+        // Silence skipping would hide the tail from the encoder
+        TAtrac3Encoder encoder(TCompressedOutputPtr(new TNullOutput()),
+                               TAtrac3EncoderSettings(132300, false, false, 2, 0, false, ESpeed::Default,
+                                                      false, false));
+        auto lambda = encoder.GetLambda();
+        for (size_t f = 0; f < frames; f++) {
+            std::copy(pcm.begin() + f * frame.size(), pcm.begin() + (f + 1) * frame.size(), frame.begin());
+            const auto start = std::chrono::steady_clock::now();
+            lambda(frame.data(), meta);
+            const std::chrono::duration<double, std::micro> t = std::chrono::steady_clock::now() - start;
+            frameTime[f] += t.count();
+        }
+    }
+
+    const double iterations = std::max<double>(state.iterations(), 1);
+    double sum = 0;
+    double max = 0;
+    for (double t : frameTime) {
+        sum += t / iterations;
+        max = std::max(max, t / iterations);
+    }
+    state.counters["frame_mean_us"] = sum / frames;
+    state.counters["frame_max_us"] = max;
+    state.counters["max_to_mean"] = max / (sum / frames);
+}
+
+} // namespace
+
+BENCHMARK(BM_Atrac3FadeOut)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
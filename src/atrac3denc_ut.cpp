@@ -383,3 +383,99 @@ TEST(TAtrac3MDCT, TAtrac3MDCTWindow) {
 }
 
 
+
+namespace {
+
+using TFrames = vector<vector<char>>;
+
+// Frames are kept outside, the output is destroyed with the encoder
+class TFrameCollector : public ICompressedOutput {
+public:
+    explicit TFrameCollector(TFrames* frames)
+        : Frames(frames)
+    {}
+    void WriteFrame(std::vector<char> data) override {
+        Frames->push_back(std::move(data));
+    }
+    std::string GetName() const override { return "ut"; }
+    size_t GetChannelNum() const override { return 2; }
+
+private:
+    TFrames* Frames;
+};
+
+vector<float> GenStereoSignal(size_t len) {
+    vector<float> buf(len * 2);
+    for (size_t i = 0; i < len; i++) {
+        const double t = i / 44100.0;
+        buf[i * 2] = 0.3 * sin(2 * M_PI * (200 * t + 2000 * t * t)) + ((i / 11025) & 1 ? 0.4 * sin(2 * M_PI * 3000 * t) : 0);
+        buf[i * 2 + 1] = 0.4 * sin(2 * M_PI * 440 * t) * exp(-((i % 22050) / 8000.0));
+    }
+    return buf;
+}
+
+uint64_t EncodeAtrac3(vector<TAtrac3Encoder::TOutput>&& outputs, uint32_t bitrate, const vector<float>& pcm,
+                      bool skipSilence = true) {
+    TAtrac3Encoder encoder(std::move(outputs), TAtrac3EncoderSettings(bitrate, false, false, 2, 0, false,
+                                                                      ESpeed::Default, false, skipSilence));
+    auto lambda = encoder.GetLambda();
+    vector<float> frame(TAtrac3Data::NumSamples * 2);
+    TPCMEngine::ProcessMeta meta = {2};
+    for (size_t pos = 0; pos + frame.size() <= pcm.size(); pos += frame.size()) {
+        // the encoder may not change the input, it is shared by all outputs
+        std::copy(pcm.begin() + pos, pcm.begin() + pos + frame.size(), frame.begin());
+        lambda(frame.data(), meta);
+    }
+    return encoder.GetSkippedFrames();
+}
+
+} // namespace
+
+TEST(TAtrac3Encoder, MultiBitrateMatchesSingleBitrate) {
+    const vector<float> pcm = GenStereoSignal(64 * TAtrac3Data::NumSamples);
+    const uint32_t bitrates[3] = {104738, 132300, 176400};
+
+    TFrames multi[3];
+    vector<TAtrac3Encoder::TOutput> outputs;
+    for (size_t i = 0; i < 3; i++) {
+        outputs.push_back({TCompressedOutputPtr(new TFrameCollector(&multi[i])),
+                           TAtrac3Data::GetContainerParamsForBitrate(bitrates[i])});
+    }
+    EncodeAtrac3(std::move(outputs), bitrates[0], pcm);
+
+    for (size_t i = 0; i < 3; i++) {
+        TFrames single;
+        vector<TAtrac3Encoder::TOutput> one;
+        one.push_back({TCompressedOutputPtr(new TFrameCollector(&single)),
+                       TAtrac3Data::GetContainerParamsForBitrate(bitrates[i])});
+        EncodeAtrac3(std::move(one), bitrates[i], pcm);
+
+        EXPECT_EQ(single.size(), 64u);
+        EXPECT_TRUE(single == multi[i]);
+    }
+}
+
+TEST(TAtrac3Encoder, SkipSilenceKeepsOtherFrames) {
+    const uint32_t bitrate = 132300;
+    vector<float> pcm = GenStereoSignal(64 * TAtrac3Data::NumSamples);
+    std::fill(pcm.begin() + 16 * TAtrac3Data::NumSamples * 2, pcm.begin() + 48 * TAtrac3Data::NumSamples * 2, 0.0f);
+
+    TFrames skipped;
+    vector<TAtrac3Encoder::TOutput> out1;
+    out1.push_back({TCompressedOutputPtr(new TFrameCollector(&skipped)), TAtrac3Data::GetContainerParamsForBitrate(bitrate)});
+    const uint64_t numSkipped = EncodeAtrac3(std::move(out1), bitrate, pcm);
+
+    TFrames encoded;
+    vector<TAtrac3Encoder::TOutput> out2;
+    out2.push_back({TCompressedOutputPtr(new TFrameCollector(&encoded)), TAtrac3Data::GetContainerParamsForBitrate(bitrate)});
+    EXPECT_EQ(EncodeAtrac3(std::move(out2), bitrate, pcm, false), 0u);
+
+    EXPECT_GT(numSkipped, 20u);
+    ASSERT_EQ(skipped.size(), encoded.size());
+    // The state is left at rest by skipped frames, so frames after the silence are the same
+    for (size_t i = 0; i < skipped.size(); i++) {
+        if (i < 16 || i > 48) {
+            EXPECT_TRUE(skipped[i] == encoded[i]) << "frame " << i;
+        }
+    }
+}
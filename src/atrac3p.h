@@ -21,9 +21,15 @@
 #include "config.h"
 #include "pcmengin.h"
 #include "compressed_io.h"
+#include "atrac/atrac_speed.h"
+
+#include <memory>
+#include <vector>
 
 namespace NAtracDEnc {
 
+class TThreadPool;
+
 class TAt3PEnc : public IProcessor {
 public:
     struct TSettings {
@@ -35,21 +41,73 @@ public:
             GHA_ENABLED = GHA_PASS_INPUT | GHA_WRITE_TONAL | GHA_WRITE_RESIUDAL
         };
         uint8_t UseGha;
+        // Threads for the tonal components search, output does not depend on it
+        size_t GhaThreads;
+        // Start the tonal components search from the tones of the previous frame
+        bool GhaWarmStart;
+        // Effort of the tonal components search
+        ESpeed Speed;
+        // Size of the encoded frame in bytes, defines the bitrate
+        uint16_t FrameSz;
+        // Process channels of a stereo unit on two threads
+        bool ParallelChannels;
+        // Write a precomputed frame for silence instead of encoding it
+        bool SkipSilence;
+        // Skip the tonal components search, the whole input is encoded as spectrum.
+        // UseGha is ignored
+        bool NoTonal;
 
         TSettings()
             : UseGha(GHA_ENABLED)
+            , GhaThreads(1)
+            , GhaWarmStart(false)
+            , Speed(ESpeed::Default)
+            , FrameSz(2048)
+            , ParallelChannels(false)
+            , SkipSilence(true)
+            , NoTonal(false)
         {}
     };
     TAt3PEnc(TCompressedOutputPtr&& out, int channels, TSettings settings);
+    ~TAt3PEnc();
     TPCMEngine::TProcessLambda GetLambda() override;
+    // Number of silent channel units (one per frame for mono and stereo) written without encoding
+    uint64_t GetSkippedFrames() const;
     static constexpr int NumSamples = 2048;
+    // Delay of the encoder and decoder pair in samples without the frame look-ahead:
+    // PQF with 384 taps prototype (383) and the MDCT overlap of 128 samples per band (16 * 128)
+    static constexpr size_t Delay = 383 + 2048;
     static void ParseAdvancedOpt(const char* opt, TSettings& settings);
+    // Frame size of the lowest standard bitrate not less than the given one (kbit/s),
+    // 0 - the highest bitrate
+    static uint16_t GetFrameSzForBitrate(uint32_t bitrate);
+    static uint32_t GetBitrate(uint16_t frameSz) { return (uint64_t)frameSz * 8 * 44100 / NumSamples; }
+    // Number of channels of each channel unit (1 - mono, 2 - stereo) in order of channels,
+    // empty if the number of channels is not supported
+    static std::vector<int> GetChannelUnits(int channels);
+    // Input (WAV order) channel for each channel of the units in order of the units,
+    // the decoder routes them back to the output channels in WAV order
+    static std::vector<int> GetChannelMap(int channels);
+    // Size of the frame with all channel units, frameSz is the part of a stereo unit
+    static uint16_t GetMultichannelFrameSz(int channels, uint16_t frameSz);
 
 private:
+    TPCMEngine::EProcessResult EncodeFrame(const float* data);
+
+    class TImpl;
+    struct TUnit {
+        std::unique_ptr<TImpl> Impl;
+        int FirstChannel;
+    };
     TCompressedOutputPtr Out;
     int Channels;
-    class TImpl;
-    std::unique_ptr<TImpl> Impl;
+    uint16_t FrameSz;
+    std::vector<TUnit> Units;
+    // Empty if channels of the units are in the input order
+    std::vector<int> ChannelMap;
+    std::vector<float> UnitOrderBuf;
+    // Channel units are encoded in parallel, one thread per unit
+    std::unique_ptr<TThreadPool> Pool;
 };
 
 }
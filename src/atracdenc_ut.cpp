@@ -20,6 +20,7 @@
 #include <lib/mdct/mdct_ut_common.h>
 #include <gtest/gtest.h>
 
+#include <cmath>
 #include <vector>
 using std::vector;
 using namespace NAtracDEnc;
@@ -114,3 +115,91 @@ TEST(TAtrac1MDCT, TAtrac1MDCTShortEncDec) {
     CheckResult256(hiCopy, hiRes);
 }
 
+namespace {
+
+using TFrames = vector<vector<char>>;
+
+class TFrameCollector : public ICompressedOutput {
+public:
+    explicit TFrameCollector(TFrames* frames)
+        : Frames(frames)
+    {}
+    void WriteFrame(std::vector<char> data) override {
+        Frames->push_back(std::move(data));
+    }
+    std::string GetName() const override { return "ut"; }
+    size_t GetChannelNum() const override { return 2; }
+
+private:
+    TFrames* Frames;
+};
+
+class TFrameReader : public ICompressedInput {
+public:
+    explicit TFrameReader(const TFrames& frames)
+        : Frames(frames)
+    {}
+    std::unique_ptr<TFrame> ReadFrame() override {
+        const auto& data = Frames.at(Pos++);
+        std::unique_ptr<TFrame> frame(new TFrame(data.size()));
+        memcpy(frame->Get(), data.data(), data.size());
+        return frame;
+    }
+    uint64_t GetLengthInSamples() const override { return Frames.size() / 2 * TAtrac1Data::NumSamples; }
+    std::string GetName() const override { return "ut"; }
+    size_t GetChannelNum() const override { return 2; }
+
+private:
+    const TFrames& Frames;
+    size_t Pos = 0;
+};
+
+vector<float> EncodeDecodeAtrac1(const vector<float>& pcm, bool skipSilence, uint64_t* skipped) {
+    TFrames frames;
+    {
+        TAtrac1Encoder encoder(TCompressedOutputPtr(new TFrameCollector(&frames)),
+                               TAtrac1EncodeSettings(0, false, TAtrac1EncodeSettings::EWindowMode::EWM_AUTO, 0,
+                                                     false, ESpeed::Default, false, skipSilence));
+        auto lambda = encoder.GetLambda();
+        vector<float> frame(TAtrac1Data::NumSamples * 2);
+        TPCMEngine::ProcessMeta meta = {2};
+        for (size_t pos = 0; pos < pcm.size(); pos += frame.size()) {
+            std::copy(pcm.begin() + pos, pcm.begin() + pos + frame.size(), frame.begin());
+            lambda(frame.data(), meta);
+        }
+        *skipped = encoder.GetSkippedFrames();
+    }
+
+    vector<float> res(pcm.size());
+    TAtrac1Decoder decoder(TCompressedInputPtr(new TFrameReader(frames)));
+    auto lambda = decoder.GetLambda();
+    TPCMEngine::ProcessMeta meta = {2};
+    for (size_t pos = 0; pos < res.size(); pos += TAtrac1Data::NumSamples * 2) {
+        lambda(res.data() + pos, meta);
+    }
+    return res;
+}
+
+} // namespace
+
+TEST(TAtrac1Encoder, SkipSilenceDecodesUnchanged) {
+    const size_t len = 128 * TAtrac1Data::NumSamples;
+    vector<float> pcm(len * 2);
+    for (size_t i = 0; i < len; i++) {
+        const double t = i / 44100.0;
+        // Channels are silent at different places, each channel is skipped on its own
+        pcm[i * 2] = (i < 20000 || i > 40000) ? 0.5 * sin(2 * M_PI * 1000 * t) : 0.0;
+        pcm[i * 2 + 1] = (i < 30000 || i > 55000) ? 0.3 * sin(2 * M_PI * (300 * t + 3000 * t * t)) : 0.0;
+    }
+
+    uint64_t skipped = 0;
+    const vector<float> decoded = EncodeDecodeAtrac1(pcm, true, &skipped);
+    uint64_t notSkipped = 0;
+    const vector<float> reference = EncodeDecodeAtrac1(pcm, false, &notSkipped);
+
+    EXPECT_EQ(notSkipped, 0u);
+    EXPECT_GT(skipped, 50u);
+    for (size_t i = 0; i < decoded.size(); i++) {
+        EXPECT_NEAR(decoded[i], reference[i], 1.0 / 32768) << "sample " << i;
+    }
+}
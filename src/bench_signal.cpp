@@ -0,0 +1,125 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include "bench_signal.h"
+
+#include <cmath>
+#include <cstdint>
+
+namespace NAtracDEnc {
+
+namespace {
+
+const double SampleRate = 44100.0;
+
+// xorshift32, uniform in [-1, 1)
+class TNoise {
+public:
+    explicit TNoise(uint32_t seed)
+        : State(seed)
+    {}
+
+    float operator()() {
+        State ^= State << 13;
+        State ^= State >> 17;
+        State ^= State << 5;
+        return static_cast<int32_t>(State) / 2147483648.0f;
+    }
+
+private:
+    uint32_t State;
+};
+
+float Sweep(size_t i, size_t samples, size_t ch) {
+    const double f0 = 20.0;
+    const double f1 = 20000.0;
+    const double t = i / SampleRate;
+    const double len = samples / SampleRate;
+    const double k = std::log(f1 / f0);
+    const double phase = 2 * M_PI * f0 * len / k * (std::exp(t / len * k) - 1.0);
+    return 0.5 * std::sin(phase + ch * M_PI / 4);
+}
+
+float Tonal(size_t i, size_t ch) {
+    double sum = 0;
+    for (size_t t = 0; t < 24; t++) {
+        const double freq = 110.0 * (t + 1) * (1.0 + 0.003 * ch) + 13.0 * t;
+        sum += std::sin(2 * M_PI * freq * i / SampleRate + t) / (t + 2);
+    }
+    return 0.3 * sum;
+}
+
+} // namespace
+
+const char* GetSignalName(ESignal signal) {
+    switch (signal) {
+        case ESignal::Sweep: return "sweep";
+        case ESignal::Transients: return "transients";
+        case ESignal::WhiteNoise: return "white_noise";
+        case ESignal::PinkNoise: return "pink_noise";
+        case ESignal::Tonal: return "tonal";
+        case ESignal::Silence: return "silence";
+        default: return "unknown";
+    }
+}
+
+std::vector<float> GenSignal(ESignal signal, size_t samples, size_t channels) {
+    std::vector<float> buf(samples * channels, 0.0f);
+    for (size_t ch = 0; ch < channels; ch++) {
+        TNoise noise(0x9e3779b9u + ch);
+        // Paul Kellet's economy pink noise filter
+        float b0 = 0, b1 = 0, b2 = 0;
+        for (size_t i = 0; i < samples; i++) {
+            float v = 0;
+            switch (signal) {
+                case ESignal::Sweep:
+                    v = Sweep(i, samples, ch);
+                    break;
+                case ESignal::Transients: {
+                    // A burst every 4410 samples (10 per second) decaying in about 5 ms
+                    const size_t pos = (i + ch * 7) % 4410;
+                    v = 0.05f * std::sin(2 * M_PI * 220.0 * i / SampleRate) +
+                        0.8f * std::exp(-(double)pos / 220.0) * noise();
+                    break;
+                }
+                case ESignal::WhiteNoise:
+                    v = 0.3f * noise();
+                    break;
+                case ESignal::PinkNoise: {
+                    const float w = noise();
+                    b0 = 0.99765f * b0 + w * 0.0990460f;
+                    b1 = 0.96300f * b1 + w * 0.2965164f;
+                    b2 = 0.57000f * b2 + w * 1.0526913f;
+                    v = 0.1f * (b0 + b1 + b2 + w * 0.1848f);
+                    break;
+                }
+                case ESignal::Tonal:
+                    v = Tonal(i, ch);
+                    break;
+                case ESignal::Silence:
+                case ESignal::Count:
+                    break;
+            }
+            buf[i * channels + ch] = v;
+        }
+    }
+    return buf;
+}
+
+} // namespace NAtracDEnc
@@ -0,0 +1,45 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace NAtracDEnc {
+
+// Synthetic test signals for the benchmarks and golden_ut, 44100 Hz. The output depends on the
+// arguments only (own PRNG, no library distributions), so results of different
+// builds and machines are measured on the same input
+enum class ESignal {
+    Sweep,      // logarithmic sine sweep 20 Hz - 20 kHz
+    Transients, // decaying noise bursts over a low tone, exercises short windows and gain control
+    WhiteNoise,
+    PinkNoise,
+    Tonal,      // dense mix of stable tones, the worst case of the tonal search
+    Silence,
+    Count
+};
+
+const char* GetSignalName(ESignal signal);
+
+// Interleaved samples in [-1, 1]
+std::vector<float> GenSignal(ESignal signal, size_t samples, size_t channels);
+
+} // namespace NAtracDEnc
@@ -0,0 +1,128 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include "atrac1denc.h"
+#include "atrac3denc.h"
+#include "atrac3p.h"
+#include "bench_signal.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace NAtracDEnc;
+
+namespace {
+
+class TNullOutput : public ICompressedOutput {
+public:
+    void WriteFrame(std::vector<char>) override {}
+    std::string GetName() const override { return {}; }
+    size_t GetChannelNum() const override { return 2; }
+};
+
+const size_t Channels = 2;
+const size_t Seconds = 2;
+const size_t NumSamples = Seconds * 44100;
+
+const std::vector<float>& GetSignal(ESignal signal) {
+    static std::vector<float> signals[static_cast<size_t>(ESignal::Count)];
+    std::vector<float>& buf = signals[static_cast<size_t>(signal)];
+    if (buf.empty()) {
+        buf = GenSignal(signal, NumSamples, Channels);
+    }
+    return buf;
+}
+
+// Feeds the signal frame by frame as TPCMEngine does. The encoder is created for
+// each iteration, as its state depends on the previous input. The "realtime"
+// counter is the number of encoded seconds per second of the run
+template<class TMakeEncoder>
+void RunEncoder(benchmark::State& state, size_t frameSamples, TMakeEncoder makeEncoder) {
+    const ESignal signal = static_cast<ESignal>(state.range(0));
+    const std::vector<float>& pcm = GetSignal(signal);
+    std::vector<float> frame(frameSamples * Channels);
+    const TPCMEngine::ProcessMeta meta = {Channels};
+
+    for (auto _ : state) {
+        auto encoder = makeEncoder();
+        auto lambda = encoder->GetLambda();
+        for (size_t pos = 0; pos + frame.size() <= pcm.size(); pos += frame.size()) {
+            std::copy(pcm.begin() + pos, pcm.begin() + pos + frame.size(), frame.begin());
+            lambda(frame.data(), meta);
+        }
+    }
+
+    state.SetLabel(GetSignalName(signal));
+    state.counters["realtime"] = benchmark::Counter(Seconds, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+void BM_EncodeAtrac1(benchmark::State& state) {
+    RunEncoder(state, NAtrac1::TAtrac1Data::NumSamples, []() {
+        return std::unique_ptr<TAtrac1Encoder>(new TAtrac1Encoder(TCompressedOutputPtr(new TNullOutput()),
+            NAtrac1::TAtrac1EncodeSettings(0, false, NAtrac1::TAtrac1EncodeSettings::EWindowMode::EWM_AUTO, 0)));
+    });
+}
+
+// state.range(1) - bitrate in bit/s
+void BM_EncodeAtrac3(benchmark::State& state) {
+    const uint32_t bitrate = state.range(1);
+    RunEncoder(state, NAtrac3::TAtrac3Data::NumSamples, [bitrate]() {
+        return std::unique_ptr<TAtrac3Encoder>(new TAtrac3Encoder(TCompressedOutputPtr(new TNullOutput()),
+            NAtrac3::TAtrac3EncoderSettings(bitrate, false, false, Channels, 0)));
+    });
+}
+
+// state.range(1) - bitrate in kbit/s
+void BM_EncodeAtrac3Plus(benchmark::State& state) {
+    TAt3PEnc::TSettings settings;
+    settings.FrameSz = TAt3PEnc::GetFrameSzForBitrate(state.range(1));
+    RunEncoder(state, TAt3PEnc::NumSamples, [settings]() {
+        return std::unique_ptr<TAt3PEnc>(new TAt3PEnc(TCompressedOutputPtr(new TNullOutput()), Channels, settings));
+    });
+}
+
+void SignalArgs(benchmark::internal::Benchmark* b) {
+    for (int s = 0; s < static_cast<int>(ESignal::Count); s++) {
+        b->Arg(s);
+    }
+}
+
+void Atrac3Args(benchmark::internal::Benchmark* b) {
+    for (int s = 0; s < static_cast<int>(ESignal::Count); s++) {
+        for (const auto& params : NAtrac3::TAtrac3Data::ContainerParams) {
+            b->Args({s, static_cast<int>(params.Bitrate)});
+        }
+    }
+}
+
+void Atrac3PlusArgs(benchmark::internal::Benchmark* b) {
+    for (int s = 0; s < static_cast<int>(ESignal::Count); s++) {
+        for (int kbps : {64, 128, 256, 352}) {
+            b->Args({s, kbps});
+        }
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_EncodeAtrac1)->Apply(SignalArgs)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_EncodeAtrac3)->Apply(Atrac3Args)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_EncodeAtrac3Plus)->Apply(Atrac3PlusArgs)->Unit(benchmark::kMillisecond);
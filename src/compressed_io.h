@@ -56,6 +56,8 @@ public:
 class ICompressedOutput : public ICompressedIO {
 public:
     virtual void WriteFrame(std::vector<char> data) = 0;
+    // Push written frames to the underlying file
+    virtual void Flush() {}
 };
 
 typedef std::unique_ptr<ICompressedInput> TCompressedInputPtr;
@@ -19,6 +19,13 @@
 #include "env.h"
 
 #include <fenv.h>
+#include <float.h>
+#include <stdint.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define ATDE_ENV_SSE
+#endif
 
 #pragma STDC FENV_ACCESS ON
 
@@ -28,4 +35,33 @@ void SetRoundFloat() {
     fesetround(FE_TONEAREST);
 }
 
+void SetFlushToZero() {
+#if defined(ATDE_ENV_SSE)
+    // FTZ (bit 15) and DAZ (bit 6) of MXCSR
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+#elif defined(__aarch64__) && defined(__GNUC__)
+    // FZ (bit 24) of FPCR, covers both results and operands
+    uint64_t fpcr;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    fpcr |= (uint64_t)1 << 24;
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr));
+#endif
+}
+
+bool IsFlushToZero() {
+    volatile float min = FLT_MIN;
+    volatile float res = min / 2;
+    return res == 0.0f;
+}
+
+TFloatEnvGuard::TFloatEnvGuard() {
+    fegetenv(&Saved);
+    SetRoundFloat();
+    SetFlushToZero();
+}
+
+TFloatEnvGuard::~TFloatEnvGuard() {
+    fesetenv(&Saved);
+}
+
 } // namespace NEnv
@@ -18,8 +18,29 @@
 
 #pragma once
 
+#include <fenv.h>
+
 namespace NEnv {
 
 void SetRoundFloat();
 
+// Subnormal results and operands are flushed to zero in the current thread
+// (FTZ and DAZ on x86, FZ on AArch64), no-op on other targets
+void SetFlushToZero();
+bool IsFlushToZero();
+
+// Floating point environment of an encoding or decoding thread: round to nearest
+// and subnormals flushed to zero. Decaying filter and overlap tails otherwise turn
+// into subnormals, which are many times slower on most CPUs.
+// The previous environment of the thread is restored on destruction.
+class TFloatEnvGuard {
+public:
+    TFloatEnvGuard();
+    ~TFloatEnvGuard();
+    TFloatEnvGuard(const TFloatEnvGuard&) = delete;
+    TFloatEnvGuard& operator=(const TFloatEnvGuard&) = delete;
+private:
+    fenv_t Saved;
+};
+
 } // namespace NEnv
\ No newline at end of file
@@ -0,0 +1,41 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "env.h"
+#include <gtest/gtest.h>
+
+#include <cfloat>
+
+using namespace NEnv;
+
+TEST(TFloatEnvGuard, FlushesAndRestores) {
+    fesetround(FE_UPWARD);
+    const bool flushBefore = IsFlushToZero();
+    {
+        TFloatEnvGuard guard;
+        EXPECT_EQ(FE_TONEAREST, fegetround());
+#if defined(__SSE__) || defined(__aarch64__)
+        EXPECT_TRUE(IsFlushToZero());
+        volatile float min = FLT_MIN;
+        EXPECT_EQ(0.0f, min * 0.25f);
+#endif
+    }
+    EXPECT_EQ(FE_UPWARD, fegetround());
+    EXPECT_EQ(flushBefore, IsFlushToZero());
+    fesetround(FE_TONEAREST);
+}
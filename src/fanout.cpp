@@ -0,0 +1,90 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "fanout.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace NAtracDEnc {
+
+static size_t GetMaxFrameSz(const std::vector<TFanOutProcessor::TConsumer>& consumers) {
+    size_t sz = 0;
+    for (const auto& c : consumers) {
+        sz = std::max(sz, c.FrameSz);
+    }
+    return sz;
+}
+
+TFanOutProcessor::TFanOutProcessor(std::vector<TConsumer>&& consumers)
+    : Consumers(std::move(consumers))
+    , LookAhead(Consumers.size())
+    , FrameSz(GetMaxFrameSz(Consumers))
+    , Pool(Consumers.size())
+{
+    for (const auto& c : Consumers) {
+        if (c.FrameSz == 0 || FrameSz % c.FrameSz) {
+            throw std::runtime_error("frame size of " + c.Name + " does not divide the block size");
+        }
+    }
+}
+
+TPCMEngine::TProcessLambda TFanOutProcessor::GetLambda() {
+    std::vector<TPCMEngine::TProcessLambda> lambdas;
+    for (const auto& c : Consumers) {
+        lambdas.push_back(c.Processor->GetLambda());
+    }
+
+    return [this, lambdas](float* data, const TPCMEngine::ProcessMeta& meta) {
+        Pool.ParallelFor(lambdas.size(), [&](size_t i, size_t) {
+            const size_t step = Consumers[i].FrameSz;
+            size_t& lookAhead = LookAhead[i];
+            for (size_t pos = 0; pos < FrameSz; pos += step) {
+                // The drained block has no new input, only pending look-ahead frames are finished
+                if (meta.Drain && lookAhead == 0) {
+                    break;
+                }
+                const auto res = lambdas[i](data + pos * meta.Channels, meta);
+                if (res == TPCMEngine::EProcessResult::LOOK_AHEAD) {
+                    lookAhead++;
+                } else if (meta.Drain) {
+                    lookAhead--;
+                }
+            }
+        });
+
+        if (meta.Drain) {
+            LookAheadBlocks -= std::min<size_t>(LookAheadBlocks, 1);
+            return TPCMEngine::EProcessResult::PROCESSED;
+        }
+
+        // The engine drains one block per LOOK_AHEAD result, report as many blocks
+        // as the processor with the longest look-ahead needs
+        size_t blocks = 0;
+        for (size_t i = 0; i < LookAhead.size(); i++) {
+            blocks = std::max(blocks, (LookAhead[i] * Consumers[i].FrameSz + FrameSz - 1) / FrameSz);
+        }
+        if (blocks > LookAheadBlocks) {
+            LookAheadBlocks++;
+            return TPCMEngine::EProcessResult::LOOK_AHEAD;
+        }
+        return TPCMEngine::EProcessResult::PROCESSED;
+    };
+}
+
+} //namespace NAtracDEnc
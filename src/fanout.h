@@ -0,0 +1,56 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pcmengin.h"
+#include "lib/parallel/thread_pool.h"
+
+namespace NAtracDEnc {
+
+// Feeds the same PCM blocks to several processors, each one on own thread.
+// The block is the largest frame of processors, smaller frames must divide it,
+// so each processor runs a whole number of own frames per block.
+class TFanOutProcessor : public IProcessor {
+public:
+    struct TConsumer {
+        std::unique_ptr<IProcessor> Processor;
+        size_t FrameSz;
+        std::string Name;
+    };
+
+    explicit TFanOutProcessor(std::vector<TConsumer>&& consumers);
+
+    TPCMEngine::TProcessLambda GetLambda() override;
+
+private:
+    std::vector<TConsumer> Consumers;
+    // Frames of each processor returned as LOOK_AHEAD which are not flushed yet
+    std::vector<size_t> LookAhead;
+    size_t FrameSz = 0;
+    // Blocks reported to the engine as LOOK_AHEAD
+    size_t LookAheadBlocks = 0;
+    TThreadPool Pool;
+};
+
+} //namespace NAtracDEnc
@@ -0,0 +1,109 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "fanout.h"
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using namespace NAtracDEnc;
+
+namespace {
+
+// Ramp of sample indexes, so each consumer can check it sees the input in order
+class TRampReader : public IPCMReader {
+public:
+    explicit TRampReader(size_t len)
+        : Len(len)
+    {}
+    bool Read(TPCMBuffer& data, const uint32_t size) const override {
+        if (Pos >= Len)
+            return false;
+        for (uint32_t i = 0; i < size; i++) {
+            data[i][0] = (Pos < Len) ? Pos : 0;
+            Pos++;
+        }
+        return true;
+    }
+private:
+    const size_t Len;
+    mutable size_t Pos = 0;
+};
+
+class TFrameCounter : public IProcessor {
+public:
+    TFrameCounter(size_t frameSz, bool lookAhead)
+        : FrameSz(frameSz)
+        , LookAhead(lookAhead)
+    {}
+    TPCMEngine::TProcessLambda GetLambda() override {
+        return [this](float* data, const TPCMEngine::ProcessMeta&) {
+            if (!Drained) {
+                EXPECT_EQ(data[0], Frames * FrameSz);
+            }
+            Frames++;
+            if (LookAhead && Frames == 1) {
+                return TPCMEngine::EProcessResult::LOOK_AHEAD;
+            }
+            return TPCMEngine::EProcessResult::PROCESSED;
+        };
+    }
+    const size_t FrameSz;
+    const bool LookAhead;
+    size_t Frames = 0;
+    bool Drained = false;
+};
+
+} // namespace
+
+TEST(TFanOutProcessor, DifferentFrameSizes) {
+    const size_t len = 4096 * 4;
+    auto* at1 = new TFrameCounter(512, false);
+    auto* at3 = new TFrameCounter(1024, false);
+    auto* at3p = new TFrameCounter(2048, true);
+
+    std::vector<TFanOutProcessor::TConsumer> consumers;
+    consumers.push_back({std::unique_ptr<IProcessor>(at1), 512, "at1"});
+    consumers.push_back({std::unique_ptr<IProcessor>(at3), 1024, "at3"});
+    consumers.push_back({std::unique_ptr<IProcessor>(at3p), 2048, "at3p"});
+    TFanOutProcessor fanOut(std::move(consumers));
+
+    // The block is the largest frame of the processors
+    const size_t blockSz = 2048;
+    TPCMEngine engine(4096, 1, TPCMEngine::TReaderPtr(new TRampReader(len)));
+    auto lambda = fanOut.GetLambda();
+    uint64_t processed = 0;
+    for (size_t i = 0; i < len / 4096; i++) {
+        processed = engine.ApplyProcess(blockSz, lambda);
+    }
+    // The block with the look-ahead frame is not reported as processed
+    EXPECT_EQ(processed, len - 2048);
+    EXPECT_EQ(at1->Frames, len / 512);
+    EXPECT_EQ(at3->Frames, len / 1024);
+    EXPECT_EQ(at3p->Frames, len / 2048);
+
+    // End of input, only the processor with look-ahead gets the drained block
+    at3p->Drained = true;
+    processed = engine.ApplyProcess(blockSz, lambda);
+    EXPECT_EQ(processed, len);
+    EXPECT_EQ(at1->Frames, len / 512);
+    EXPECT_EQ(at3->Frames, len / 1024);
+    EXPECT_EQ(at3p->Frames, len / 2048 + 1);
+
+    EXPECT_THROW(engine.ApplyProcess(blockSz, lambda), TNoDataToRead);
+}
@@ -0,0 +1,560 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+// Bit exact regression test of the encoders. A fixed synthetic corpus is encoded
+// with a set of codec settings, every frame is split into bitstream fields and the
+// hashes of the fields are compared with the references in golden_data. The first
+// differing frame and field are reported. Every config must have a reference,
+// a missing one fails the test.
+//
+// The references depend on floating point results, so they are valid for one
+// platform and toolchain family (generated on x86-64 Linux, GCC, SSE2 math), the
+// test runs with subnormals flushed to zero as the encoder does.
+// After an intended change of the output regenerate them with
+//     ATRACDENC_GOLDEN_UPDATE=1 ./golden_ut
+// and commit the diff of golden_data together with the change.
+
+#include "atrac1denc.h"
+#include "atrac3denc.h"
+#include "atrac3p.h"
+#include "bench_signal.h"
+#include "env.h"
+#include "atrac/atrac_scale.h"
+#include "atrac/at3p/at3p_bitstream.h"
+#include "atrac/at3p/at3p_tables.h"
+#include "atrac/at3p/ff/atrac3plus_data.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace NAtracDEnc;
+
+namespace {
+
+using TFrames = std::vector<std::vector<char>>;
+
+class TFrameCollector : public ICompressedOutput {
+public:
+    explicit TFrameCollector(TFrames* frames)
+        : Frames(frames)
+    {}
+    void WriteFrame(std::vector<char> data) override { Frames->push_back(std::move(data)); }
+    std::string GetName() const override { return "golden"; }
+    size_t GetChannelNum() const override { return 2; }
+
+private:
+    TFrames* Frames;
+};
+
+struct TField {
+    const char* Name;
+    size_t Begin; // bit offsets in the frame
+    size_t End;
+};
+
+// Reads fixed width fields of the frame, the offset is clamped to the frame size
+class TFieldReader {
+public:
+    TFieldReader(const std::vector<char>& data)
+        : Data(data)
+    {}
+
+    uint32_t Read(size_t n) {
+        uint32_t res = 0;
+        for (size_t i = 0; i < n; i++, Pos++) {
+            res <<= 1;
+            if (Pos < Data.size() * 8) {
+                res |= (Data[Pos / 8] >> (7 - Pos % 8)) & 1;
+            }
+        }
+        return res;
+    }
+
+    uint32_t Peek(size_t n) const {
+        TFieldReader tmp(*this);
+        return tmp.Read(n);
+    }
+
+    size_t GetPos() const { return std::min(Pos, Data.size() * 8); }
+
+private:
+    const std::vector<char>& Data;
+    size_t Pos = 0;
+};
+
+// FNV-1a of the bits [begin, end) of the frame
+uint32_t HashBits(const std::vector<char>& data, size_t begin, size_t end) {
+    uint32_t hash = 2166136261u;
+    uint8_t acc = 0;
+    for (size_t i = begin; i < end; i++) {
+        acc = (acc << 1) | ((data[i / 8] >> (7 - i % 8)) & 1);
+        if ((i - begin) % 8 == 7 || i + 1 == end) {
+            hash = (hash ^ acc) * 16777619u;
+            acc = 0;
+        }
+    }
+    return (hash ^ static_cast<uint32_t>(end - begin)) * 16777619u;
+}
+
+// Sound unit of one channel: block size modes, amount of BFUs, word lengths,
+// scale factors and mantissas
+std::vector<TField> SplitAtrac1(const std::vector<char>& data) {
+    TFieldReader reader(data);
+    std::vector<TField> fields;
+    reader.Read(8);
+    fields.push_back({"block_size", 0, reader.GetPos()});
+    const uint32_t numBfu = NAtrac1::TAtrac1Data::BfuAmountTab[reader.Read(3)];
+    reader.Read(5);
+    fields.push_back({"bfu_amount", fields.back().End, reader.GetPos()});
+    reader.Read(4 * numBfu);
+    fields.push_back({"word_lengths", fields.back().End, reader.GetPos()});
+    reader.Read(6 * numBfu);
+    fields.push_back({"scale_factors", fields.back().End, reader.GetPos()});
+    fields.push_back({"mantissas", fields.back().End, data.size() * 8});
+    return fields;
+}
+
+// Two sound units, the second one of a joint stereo frame is stored byte reversed
+// from the end of the frame. The units are split at the middle of the frame, so
+// with joint stereo a part of the spectrum may be attributed to the other channel
+std::vector<TField> SplitAtrac3(const std::vector<char>& data, bool js, std::vector<char>* unit1) {
+    static const char* names[2][3] = {
+        {"ch0_header", "ch0_gain_control", "ch0_spectrum"},
+        {"ch1_header", "ch1_gain_control", "ch1_spectrum"}
+    };
+    const size_t half = data.size() / 2;
+    unit1->assign(data.begin() + half, data.end());
+    if (js) {
+        std::reverse(unit1->begin(), unit1->end());
+    }
+
+    const std::vector<char> unit0(data.begin(), data.begin() + half);
+    std::vector<TField> fields;
+    for (size_t ch = 0; ch < 2; ch++) {
+        TFieldReader reader(ch == 0 ? unit0 : *unit1);
+        const size_t offset = ch * half * 8;
+        // id or joint stereo parameters and the number of QMF bands
+        reader.Read(js && ch == 1 ? 14 : 6);
+        const uint32_t numQmfBand = reader.Read(2) + 1;
+        const size_t headerEnd = reader.GetPos();
+        for (uint32_t band = 0; band < numQmfBand; band++) {
+            reader.Read(9 * reader.Read(3));
+        }
+        fields.push_back({names[ch][0], offset, offset + headerEnd});
+        fields.push_back({names[ch][1], offset + headerEnd, offset + reader.GetPos()});
+        fields.push_back({names[ch][2], offset + reader.GetPos(), offset + half * 8});
+    }
+    return fields;
+}
+
+// Index of the variable length code at the reader position, the code is consumed.
+// An invalid code gives 0 and misaligns the following fields, so they differ too
+template<size_t N>
+size_t ReadVlc(TFieldReader& reader, const std::array<NAt3p::TVlcElement, N>& tab) {
+    for (size_t i = 0; i < N; i++) {
+        if (tab[i].Len && reader.Peek(tab[i].Len) == (uint16_t)tab[i].Code) {
+            reader.Read(tab[i].Len);
+            return i;
+        }
+    }
+    return 0;
+}
+
+void ReadQuSpectra(TFieldReader& reader, const NAt3p::THuffTables& huff, size_t idx, size_t numSpecs) {
+    const Atrac3pSpecCodeTab& tab = atrac3p_spectra_tabs[idx];
+    for (size_t pos = 0; pos < numSpecs;) {
+        if (tab.group_size != 1) {
+            reader.Read(1);
+        }
+        for (size_t j = 0; j < tab.group_size; j++) {
+            const size_t val = ReadVlc(reader, huff.VlcSpecs[idx]);
+            for (size_t i = 0; i < tab.num_coeffs; i++, pos++) {
+                // Sign bit of each non zero coefficient of the unsigned table
+                if (!tab.is_signed && ((val >> (tab.bits * i)) & ((1u << tab.bits) - 1))) {
+                    reader.Read(1);
+                }
+            }
+        }
+    }
+}
+
+// Frame with one channel unit in the order the encoder writes it: header, word lengths,
+// scale factor indexes, spectra (code tables, quantized spectra and power compensation),
+// window shapes with gain control flags, then the tonal block with the noise flag,
+// the terminator and the padding
+std::vector<TField> SplitAtrac3Plus(const std::vector<char>& data) {
+    static const NAt3p::THuffTables huff;
+    TFieldReader reader(data);
+    std::vector<TField> fields;
+
+    reader.Read(1);
+    const size_t channels = reader.Read(2) + 1;
+    const size_t numQuantUnits = reader.Read(5) + 1;
+    reader.Read(1); // mute flag
+    fields.push_back({"header", 0, reader.GetPos()});
+
+    std::vector<uint32_t> wordLen[2] = {
+        std::vector<uint32_t>(numQuantUnits), std::vector<uint32_t>(numQuantUnits)
+    };
+    // VLC of deltas to the previous unit, the second channel has deltas to the first one
+    reader.Read(6);
+    {
+        const auto& tab = huff.WordLens[reader.Read(2)];
+        wordLen[0][0] = reader.Read(3);
+        for (size_t i = 1; i < numQuantUnits; i++) {
+            wordLen[0][i] = (wordLen[0][i - 1] + ReadVlc(reader, tab)) & 7;
+        }
+    }
+    if (channels == 2) {
+        reader.Read(4);
+        const auto& tab = huff.WordLens[reader.Read(2)];
+        for (size_t i = 0; i < numQuantUnits; i++) {
+            wordLen[1][i] = (wordLen[0][i] + ReadVlc(reader, tab)) & 7;
+        }
+    }
+    fields.push_back({"word_lengths", fields.back().End, reader.GetPos()});
+
+    size_t usedQuantUnits = 0;
+    for (size_t ch = 0; ch < channels; ch++) {
+        for (size_t i = 0; i < numQuantUnits; i++) {
+            if (wordLen[ch][i]) {
+                usedQuantUnits = std::max(usedQuantUnits, i + 1);
+            }
+        }
+    }
+
+    if (usedQuantUnits) {
+        for (size_t ch = 0; ch < channels; ch++) {
+            reader.Read(2 + 6 * usedQuantUnits);
+        }
+    }
+    fields.push_back({"sf_indexes", fields.back().End, reader.GetPos()});
+
+    if (usedQuantUnits) {
+        const uint32_t tabBits = reader.Read(1) + 2;
+        std::vector<uint32_t> tabIdx[2] = {
+            std::vector<uint32_t>(usedQuantUnits), std::vector<uint32_t>(usedQuantUnits)
+        };
+        for (size_t ch = 0; ch < channels; ch++) {
+            reader.Read(4);
+            for (size_t i = 0; i < usedQuantUnits; i++) {
+                if (wordLen[ch][i]) {
+                    tabIdx[ch][i] = reader.Read(tabBits);
+                } else if (ch == 1 && wordLen[0][i]) {
+                    reader.Read(1);
+                }
+            }
+        }
+        for (size_t ch = 0; ch < channels; ch++) {
+            for (size_t i = 0; i < usedQuantUnits; i++) {
+                if (wordLen[ch][i]) {
+                    ReadQuSpectra(reader, huff, wordLen[ch][i] - 1 + 7 * tabIdx[ch][i],
+                        NAt3p::TScaleTable::SpecsPerBlock[i]);
+                }
+            }
+            if (usedQuantUnits > 2) {
+                reader.Read(4 * atrac3p_subband_to_num_powgrps[atrac3p_qu_to_subband[usedQuantUnits - 1]]);
+            }
+        }
+    }
+    fields.push_back({"spectra", fields.back().End, reader.GetPos()});
+
+    if (channels == 2) {
+        reader.Read(2);
+    }
+    const size_t sbNum = atrac3p_qu_to_subband[numQuantUnits - 1] + 1;
+    for (size_t ch = 0; ch < channels; ch++) {
+        if (reader.Read(1) && reader.Read(1)) {
+            reader.Read(sbNum);
+        }
+    }
+    reader.Read(channels);
+    fields.push_back({"window_gain", fields.back().End, reader.GetPos()});
+    fields.push_back({"tonal_block", fields.back().End, data.size() * 8});
+    return fields;
+}
+
+// ATRAC3plus bitstream writer alone, the corpus is given to it as the spectra. The tonal
+// components search depends on libgha, so here the rate control and all fields of the
+// bitstream are covered with a fixed tonal block on every other frame
+class TAt3PBitStreamWriter : public IProcessor {
+public:
+    TAt3PBitStreamWriter(TCompressedOutputPtr&& out, uint16_t frameSz)
+        : Out(std::move(out))
+        , BitStream(Out.get(), frameSz)
+    {
+        Tonal.NumToneBands = 2;
+        Tonal.SecondIsLeader = false;
+        Tonal.ToneSharing[0] = true;
+        Tonal.ToneSharing[1] = false;
+        // Band 0 is shared, band 1 of the second channel has own tone
+        Tonal.Waves[0].WaveSbInfos = {{0, 2}, {2, 1, {3, 20}}};
+        Tonal.Waves[0].WaveParams = {{100, 40, 0, 7}, {700, 38, 0, 21}, {300, 45, 0, 3}};
+        Tonal.Waves[1].WaveSbInfos = {{0, 0}, {0, 1}};
+        Tonal.Waves[1].WaveParams = {{900, 44, 0, 30}};
+    }
+
+    TPCMEngine::TProcessLambda GetLambda() override {
+        return [this](float* data, const TPCMEngine::ProcessMeta& meta) {
+            std::vector<TAt3PBitStream::TSingleChannelElement> sces(meta.Channels);
+            std::vector<float> specs(TAt3PEnc::NumSamples);
+            for (size_t ch = 0; ch < meta.Channels; ch++) {
+                for (size_t i = 0; i < specs.size(); i++) {
+                    specs[i] = data[i * meta.Channels + ch];
+                }
+                sces[ch].ScaledBlocks = Scaler.ScaleFrame(specs, NAt3p::TScaleTable::TBlockSizeMod());
+                if (Frame % 3 == ch + 1) {
+                    sces[ch].SubbandInfo.Win.SetSteepWin(0);
+                }
+            }
+            BitStream.WriteFrame(meta.Channels, (Frame % 2) ? &Tonal : nullptr, sces);
+            Frame++;
+            return TPCMEngine::EProcessResult::PROCESSED;
+        };
+    }
+
+private:
+    TCompressedOutputPtr Out;
+    TAt3PBitStream BitStream;
+    TScaler<NAt3p::TScaleTable> Scaler;
+    TAt3PGhaData Tonal;
+    size_t Frame = 0;
+};
+
+struct TGoldenConfig {
+    std::string Name;
+    size_t FrameSamples; // samples of one channel passed to the lambda
+    std::function<std::unique_ptr<IProcessor>(TCompressedOutputPtr&&)> MakeEncoder;
+    // Bitstream fields of the frame, hashes of the fields are stored in the reference
+    std::function<std::vector<uint32_t>(const std::vector<char>&)> Hash;
+    std::vector<const char*> FieldNames;
+};
+
+std::ostream& operator<<(std::ostream& os, const TGoldenConfig& config) {
+    return os << config.Name;
+}
+
+const size_t Channels = 2;
+const size_t NumSamples = 22050; // 0.5 s of each signal
+
+template<class TSplit>
+std::vector<uint32_t> HashFields(const std::vector<char>& data, TSplit split) {
+    std::vector<char> unit1;
+    std::vector<uint32_t> res;
+    for (const TField& field : split(data, &unit1)) {
+        // Fields of the byte reversed unit are hashed in the order they were written
+        const bool reversed = !unit1.empty() && field.Begin >= data.size() / 2 * 8;
+        if (reversed) {
+            const size_t offset = data.size() / 2 * 8;
+            res.push_back(HashBits(unit1, field.Begin - offset, field.End - offset));
+        } else {
+            res.push_back(HashBits(data, field.Begin, field.End));
+        }
+    }
+    return res;
+}
+
+std::vector<TGoldenConfig> MakeConfigs() {
+    using NAtrac1::TAtrac1EncodeSettings;
+    std::vector<TGoldenConfig> configs;
+
+    const struct {
+        const char* Name;
+        TAtrac1EncodeSettings::EWindowMode Mode;
+        uint32_t Mask;
+    } atrac1Modes[] = {
+        {"atrac1_auto", TAtrac1EncodeSettings::EWindowMode::EWM_AUTO, 0},
+        {"atrac1_long", TAtrac1EncodeSettings::EWindowMode::EWM_NOTRANSIENT, 0},
+        {"atrac1_short", TAtrac1EncodeSettings::EWindowMode::EWM_NOTRANSIENT, 7},
+    };
+    for (const auto& mode : atrac1Modes) {
+        const auto windowMode = mode.Mode;
+        const uint32_t mask = mode.Mask;
+        configs.push_back({mode.Name, NAtrac1::TAtrac1Data::NumSamples,
+            [windowMode, mask](TCompressedOutputPtr&& out) {
+                return std::unique_ptr<IProcessor>(new TAtrac1Encoder(std::move(out),
+                    TAtrac1EncodeSettings(0, false, windowMode, mask)));
+            },
+            [](const std::vector<char>& data) {
+                return HashFields(data, [](const std::vector<char>& d, std::vector<char>*) { return SplitAtrac1(d); });
+            },
+            {"block_size", "bfu_amount", "word_lengths", "scale_factors", "mantissas"}});
+    }
+
+    // 66150 and 93713 are joint stereo
+    for (uint32_t bitrate : {66150, 93713, 132300, 352800}) {
+        for (bool noGainControl : {false, true}) {
+            const bool js = NAtrac3::TAtrac3Data::GetContainerParamsForBitrate(bitrate)->Js;
+            configs.push_back({"atrac3_" + std::to_string(bitrate) + (noGainControl ? "_nogc" : ""),
+                NAtrac3::TAtrac3Data::NumSamples,
+                [bitrate, noGainControl](TCompressedOutputPtr&& out) {
+                    return std::unique_ptr<IProcessor>(new TAtrac3Encoder(std::move(out),
+                        NAtrac3::TAtrac3EncoderSettings(bitrate, noGainControl, false, Channels, 0)));
+                },
+                [js](const std::vector<char>& data) {
+                    return HashFields(data, [js](const std::vector<char>& d, std::vector<char>* unit1) {
+                        return SplitAtrac3(d, js, unit1);
+                    });
+                },
+                {"ch0_header", "ch0_gain_control", "ch0_spectrum", "ch1_header", "ch1_gain_control", "ch1_spectrum"}});
+        }
+    }
+
+    const auto hashAtrac3Plus = [](const std::vector<char>& data) {
+        return HashFields(data, [](const std::vector<char>& d, std::vector<char>*) { return SplitAtrac3Plus(d); });
+    };
+    const std::vector<const char*> atrac3PlusFields =
+        {"header", "word_lengths", "sf_indexes", "spectra", "window_gain", "tonal_block"};
+
+    // Without the tonal components search the output does not depend on libgha,
+    // the whole encoder but the search runs on the input
+    for (uint32_t kbps : {64, 352}) {
+        configs.push_back({"atrac3plus_" + std::to_string(kbps) + "_notonal",
+            TAt3PEnc::NumSamples,
+            [kbps](TCompressedOutputPtr&& out) {
+                TAt3PEnc::TSettings settings;
+                settings.FrameSz = TAt3PEnc::GetFrameSzForBitrate(kbps);
+                settings.NoTonal = true;
+                return std::unique_ptr<IProcessor>(new TAt3PEnc(std::move(out), Channels, settings));
+            },
+            hashAtrac3Plus, atrac3PlusFields});
+        configs.push_back({"atrac3plus_" + std::to_string(kbps) + "_bitstream",
+            TAt3PEnc::NumSamples,
+            [kbps](TCompressedOutputPtr&& out) {
+                return std::unique_ptr<IProcessor>(new TAt3PBitStreamWriter(std::move(out),
+                    TAt3PEnc::GetFrameSzForBitrate(kbps)));
+            },
+            hashAtrac3Plus, atrac3PlusFields});
+    }
+    return configs;
+}
+
+// One line per frame: signal, frame number and the hashes of the fields
+std::vector<std::string> Encode(const TGoldenConfig& config) {
+    std::vector<std::string> lines;
+    for (int s = 0; s < static_cast<int>(ESignal::Count); s++) {
+        const ESignal signal = static_cast<ESignal>(s);
+        const std::vector<float> pcm = GenSignal(signal, NumSamples, Channels);
+        TFrames frames;
+        {
+            auto encoder = config.MakeEncoder(TCompressedOutputPtr(new TFrameCollector(&frames)));
+            auto lambda = encoder->GetLambda();
+            std::vector<float> frame(config.FrameSamples * Channels);
+            const TPCMEngine::ProcessMeta meta = {Channels};
+            for (size_t pos = 0; pos + frame.size() <= pcm.size(); pos += frame.size()) {
+                std::copy(pcm.begin() + pos, pcm.begin() + pos + frame.size(), frame.begin());
+                lambda(frame.data(), meta);
+            }
+        }
+        for (size_t f = 0; f < frames.size(); f++) {
+            std::ostringstream line;
+            line << GetSignalName(signal) << ' ' << f;
+            char buf[16];
+            for (uint32_t hash : config.Hash(frames[f])) {
+                snprintf(buf, sizeof(buf), " %08x", hash);
+                line << buf;
+            }
+            lines.push_back(line.str());
+        }
+    }
+    return lines;
+}
+
+std::string GetReferencePath(const TGoldenConfig& config) {
+    return std::string(GOLDEN_DATA_DIR) + "/" + config.Name + ".txt";
+}
+
+// The first difference between the frame lines, e.g. "frame 12 of tonal, field ch0_spectrum"
+std::string Describe(const TGoldenConfig& config, const std::string& expected, const std::string& actual) {
+    std::istringstream e(expected);
+    std::istringstream a(actual);
+    std::string signal;
+    std::string frame;
+    e >> signal >> frame;
+    a >> signal >> frame;
+    std::ostringstream res;
+    res << "frame " << frame << " of " << signal;
+    for (const char* name : config.FieldNames) {
+        std::string eh;
+        std::string ah;
+        e >> eh;
+        a >> ah;
+        if (eh != ah) {
+            res << ", field " << name;
+            break;
+        }
+    }
+    return res.str();
+}
+
+class TGoldenTest : public ::testing::TestWithParam<TGoldenConfig> {
+protected:
+    // Subnormals are flushed to zero as in the encoder run by main
+    NEnv::TFloatEnvGuard FloatEnv;
+};
+
+} // namespace
+
+TEST_P(TGoldenTest, BitExact) {
+    const TGoldenConfig& config = GetParam();
+    const std::vector<std::string> actual = Encode(config);
+    const std::string path = GetReferencePath(config);
+
+    if (std::getenv("ATRACDENC_GOLDEN_UPDATE")) {
+        std::ofstream out(path);
+        out << "# " << config.Name << ": signal frame";
+        for (const char* name : config.FieldNames) {
+            out << ' ' << name;
+        }
+        out << '\n';
+        for (const std::string& line : actual) {
+            out << line << '\n';
+        }
+        ASSERT_TRUE(out.good()) << "unable to write " << path;
+        return;
+    }
+
+    std::ifstream in(path);
+    ASSERT_TRUE(in.good()) << "no reference " << path << ", run with ATRACDENC_GOLDEN_UPDATE=1 to create it";
+    std::vector<std::string> expected;
+    for (std::string line; std::getline(in, line);) {
+        if (!line.empty() && line[0] != '#') {
+            expected.push_back(line);
+        }
+    }
+
+    for (size_t i = 0; i < std::min(expected.size(), actual.size()); i++) {
+        ASSERT_EQ(expected[i], actual[i]) << config.Name << ": first difference at "
+                                          << Describe(config, expected[i], actual[i]);
+    }
+    ASSERT_EQ(expected.size(), actual.size()) << config.Name << ": number of frames differs";
+}
+
+INSTANTIATE_TEST_SUITE_P(Golden, TGoldenTest, ::testing::ValuesIn(MakeConfigs()),
+    [](const ::testing::TestParamInfo<TGoldenConfig>& info) { return info.param.Name; });
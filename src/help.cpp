@@ -10,18 +10,45 @@ atracdenc {-e <codec> | --encode=<codec> | -d | --decode} -i <in> -o <out>
 
 -e or --encode		encode file using one of codecs
 	{atrac1 | atrac3 | atrac3_lp | atrac3plus}
+			a comma separated list of codecs encodes the input to
+			each of them in one pass, one -o file per codec
 -d or --decode		decode file (only ATRAC1 supported for decoding)
 -i			path to input file
 -o			path to output file
 -h			print help and exit
 
---bitrate		allow to specify bitrate (for ATRAC3 + RealMedia container only)
+--bitrate		allow to specify bitrate (for ATRAC3 + RealMedia container and
+			ATRAC3PLUS: 48, 64, 96, 128, 160, 192, 256, 320 or 352 kbit/s,
+			per stereo pair for multichannel input). For ATRAC3 a comma
+			separated list encodes to several -o files in one pass
+--speed=P		speed preset: fastest, fast, default or slow. Faster presets
+			use a coarser bit allocation search (all codecs)
+--parallelch		process channels of a stereo frame on two threads, lower
+			latency of one stream, the output does not change (all codecs)
+--live			low latency mode for live streams: read the input frame by
+			frame, write and flush each encoded frame at once and print
+			the algorithmic delay and a latency histogram at exit
+--stats[=FMT]		print time spent in each stage (PCM IO, filter bank,
+			transient analysis, MDCT, scaling, bit allocation, tonal
+			search, bitstream, container) to stderr at exit,
+			FMT is table (default) or json
+--perf-counters		add CPU cycles, instructions, cache and branch misses of
+			each stage and per frame to the --stats report (Linux)
+--trace FILE		write per frame and per stage events of every thread to
+			FILE in Chrome trace format (open in Perfetto)
 
 Advanced options:
 --bfuidxconst		Set constant amount of used BFU (ATRAC1, ATRAC3).
 --bfuidxfast		Enable fast search of BFU amount (ATRAC1)
 --notransient[=mask]	Disable transient detection and use optional mask
 			to set bands with forced short MDCT window (ATRAC1)
+--advanced=ghathreads=N	Use N threads for tonal components search (ATRAC3PLUS)
+--advanced=ghawarm=1	Start tonal components search from tones of the previous
+			frame, faster for stationary signals (ATRAC3PLUS)
+--advanced=notonal=1	Disable tonal components search, the whole signal is
+			encoded as spectrum (ATRAC3PLUS)
+--advanced=speed=P	Override --speed for ATRAC3PLUS, faster presets search
+			less tonal components
 
 Examples:
 Encode in to ATRAC1 (SP)
@@ -61,6 +61,29 @@ void TBitStream::Write(uint32_t val, int n) {
     BitsUsed += n;
 }
 
+void TBitStream::Write(const TBitBuffer& bits) {
+    const uint32_t n = bits.GetSizeInBits();
+    const size_t bytesPos = BitsUsed / 8;
+    const int overlap = BitsUsed % 8;
+    const size_t endPos = (BitsUsed + n + 7) / 8;
+
+    if (Buf.size() < endPos)
+        Buf.resize(endPos, 0);
+
+    // Bytes of the buffer words are shifted in to place, padding bits of the last
+    // word are zero
+    const std::vector<uint32_t>& words = bits.GetWords();
+    const size_t srcBytes = (n + 7) / 8;
+    for (size_t i = 0; i < srcBytes; ++i) {
+        const uint8_t b = words[i / 4] >> (24 - 8 * (i % 4));
+        Buf[bytesPos + i] |= b >> overlap;
+        if (overlap && bytesPos + i + 1 < endPos)
+            Buf[bytesPos + i + 1] |= (uint8_t)(b << (8 - overlap));
+    }
+
+    BitsUsed += n;
+}
+
 uint32_t TBitStream::Read(int n) {
     if (n >23 || n < 0)
         abort();
@@ -85,4 +108,21 @@ unsigned long long TBitStream::GetSizeInBits() const {
     return BitsUsed;
 }
 
+void TBitBuffer::Append(const TBitBuffer& other) noexcept {
+    if (BitsUsed % 32 == 0) {
+        Words.insert(Words.end(), other.Words.begin(), other.Words.end());
+        BitsUsed += other.BitsUsed;
+        return;
+    }
+
+    const uint32_t fullWords = other.BitsUsed / 32;
+    for (uint32_t i = 0; i < fullWords; i++) {
+        Write(other.Words[i], 32);
+    }
+    const uint32_t rest = other.BitsUsed % 32;
+    if (rest) {
+        Write(other.Words[fullWords] >> (32 - rest), rest);
+    }
+}
+
 }
@@ -24,6 +24,8 @@
 
 namespace NBitStream {
 
+class TBitBuffer;
+
 static inline int MakeSign(int val, unsigned bits) {
     unsigned shift = 8 * sizeof(int) - bits;
     union { unsigned u; int s; } v = { (unsigned) val << shift };
@@ -38,6 +40,8 @@ class TBitStream {
         TBitStream(const char* buf, int size);
         TBitStream();
         void Write(uint32_t val, int n);
+        // Appends all bits of the buffer
+        void Write(const TBitBuffer& bits);
         uint32_t Read(int n);
         unsigned long long GetSizeInBits() const;
         uint32_t GetBufSize() const { return Buf.size(); };
@@ -45,4 +49,39 @@ class TBitStream {
 			return Buf;
 		}
 };
+
+// Packed bit buffer to stage parts of the bitstream.
+// Bits are stored msb first in 32 bit words, allocated memory is kept on Clear
+// so the buffer can be reused from frame to frame.
+class TBitBuffer {
+    std::vector<uint32_t> Words;
+    uint32_t BitsUsed = 0;
+    public:
+        // n in [0, 32], bits of val above n are ignored
+        void Write(uint32_t val, uint32_t n) noexcept {
+            if (n == 0)
+                return;
+            if (n < 32)
+                val &= (1u << n) - 1;
+
+            const uint32_t used = BitsUsed % 32;
+            if (used == 0) {
+                Words.push_back(val << (32 - n));
+            } else {
+                const uint32_t free = 32 - used;
+                if (n <= free) {
+                    Words.back() |= val << (free - n);
+                } else {
+                    Words.back() |= val >> (n - free);
+                    Words.push_back(val << (32 - (n - free)));
+                }
+            }
+            BitsUsed += n;
+        }
+        void Append(const TBitBuffer& other) noexcept;
+        void Clear() noexcept { Words.clear(); BitsUsed = 0; }
+        uint32_t GetSizeInBits() const noexcept { return BitsUsed; }
+        // Last word is padded with zeros
+        const std::vector<uint32_t>& GetWords() const noexcept { return Words; }
+};
 } //NBitStream
@@ -0,0 +1,71 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "bitstream.h"
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+using namespace NBitStream;
+
+namespace {
+
+// Fields of 1..16 bits as written for a frame of about 1 KiB
+std::vector<std::pair<uint32_t, int>> GenFields() {
+    std::vector<std::pair<uint32_t, int>> fields;
+    uint32_t seed = 1;
+    size_t bits = 0;
+    while (bits < 8192) {
+        seed = seed * 1664525u + 1013904223u;
+        const int n = 1 + (seed >> 28);
+        fields.emplace_back(seed >> 8, n);
+        bits += n;
+    }
+    return fields;
+}
+
+void BM_BitStreamWrite(benchmark::State& state) {
+    const auto fields = GenFields();
+    for (auto _ : state) {
+        TBitStream bs;
+        for (const auto& f : fields) {
+            bs.Write(f.first & ((1u << f.second) - 1), f.second);
+        }
+        benchmark::DoNotOptimize(bs.GetSizeInBits());
+    }
+    state.SetItemsProcessed(state.iterations() * fields.size());
+}
+
+void BM_BitBufferWrite(benchmark::State& state) {
+    const auto fields = GenFields();
+    TBitBuffer buf;
+    for (auto _ : state) {
+        buf.Clear();
+        for (const auto& f : fields) {
+            buf.Write(f.first, f.second);
+        }
+        benchmark::DoNotOptimize(buf.GetSizeInBits());
+    }
+    state.SetItemsProcessed(state.iterations() * fields.size());
+}
+
+} // namespace
+
+BENCHMARK(BM_BitStreamWrite);
+BENCHMARK(BM_BitBufferWrite);
@@ -132,3 +132,68 @@ TEST(TBitStream, SignWriteRead) {
     EXPECT_EQ(-7, MakeSign(bs.Read(4), 4));
 }
 
+
+TEST(TBitBuffer, WriteAppend) {
+    TBitBuffer a;
+    a.Write(5, 3);
+    a.Write(0xffffffff, 32);
+    a.Write(10003, 16);
+    EXPECT_EQ(51u, a.GetSizeInBits());
+    EXPECT_EQ(2u, a.GetWords().size());
+    EXPECT_EQ(0xbfffffffu, a.GetWords()[0]);
+    EXPECT_EQ(0xe4e26000u, a.GetWords()[1]);
+
+    TBitBuffer b;
+    b.Write(1, 1);
+    b.Append(a);
+    b.Append(a);
+    EXPECT_EQ(103u, b.GetSizeInBits());
+
+    TBitStream bs;
+    for (uint32_t w : b.GetWords()) {
+        bs.Write(w >> 16, 16);
+        bs.Write(w & 0xffff, 16);
+    }
+    EXPECT_EQ(1u, bs.Read(1));
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ(5u, bs.Read(3));
+        EXPECT_EQ(0xffffu, bs.Read(16));
+        EXPECT_EQ(0xffffu, bs.Read(16));
+        EXPECT_EQ(10003u, bs.Read(16));
+    }
+
+    b.Clear();
+    EXPECT_EQ(0u, b.GetSizeInBits());
+    b.Append(a);
+    EXPECT_EQ(a.GetWords(), b.GetWords());
+}
+
+TEST(TBitStream, WriteBitBuffer) {
+    TBitBuffer buf;
+    buf.Write(10003, 16);
+    buf.Write(5, 3);
+    buf.Write(0x12345, 20);
+
+    for (int offset = 0; offset < 9; offset++) {
+        TBitStream expected;
+        TBitStream bs;
+        if (offset) {
+            expected.Write(1, offset);
+            bs.Write(1, offset);
+        }
+
+        expected.Write(10003, 16);
+        expected.Write(5, 3);
+        expected.Write(0x12345, 20);
+        expected.Write(3, 2);
+        bs.Write(buf);
+        bs.Write(3, 2);
+
+        EXPECT_EQ(expected.GetSizeInBits(), bs.GetSizeInBits());
+        const size_t bytes = (bs.GetSizeInBits() + 7) / 8;
+        ASSERT_GE(bs.GetBytes().size(), bytes);
+        for (size_t i = 0; i < bytes; i++) {
+            EXPECT_EQ(expected.GetBytes()[i], bs.GetBytes()[i]);
+        }
+    }
+}
@@ -33,6 +33,7 @@ public:
     bool DoCheck(size_t gotBits) const noexcept;
     void DoRun(void* frameData, TBitStream& bs);
     uint32_t DoGetCurGlobalConsumption() const noexcept;
+    const TRateControlStat& GetStat() const noexcept { return Stat; }
 private:
     std::vector<IBitStreamPartEncoder::TPtr> Encoders;
     size_t CurEncPos;
@@ -45,12 +46,24 @@ private:
     float LastLambda;
 
     bool NeedRepeat = false;
+
+    // The first frame uses plain bisection, next frames start the search
+    // from the lambda found for the previous frame.
+    TRateControl RateControl;
+    bool HasHint = false;
+    bool UseRateControl = false;
+    bool RateControlDone = false;
+    bool Searched = false;
+    float Solution = 0;
+    uint32_t FrameIterations = 0;
+    TRateControlStat Stat;
 };
 
 TBitStreamEncoder::TImpl::TImpl(std::vector<IBitStreamPartEncoder::TPtr>&& encoders)
     : Encoders(std::move(encoders))
     , CurEncPos(0)
     , RepeatEncPos(0)
+    , RateControl(0.02f, 0.25f)
 {
 }
 
@@ -59,10 +72,27 @@ void TBitStreamEncoder::TImpl::DoStart(size_t targetBits, float minLambda, float
     TargetBits = targetBits;
     MinLambda = minLambda;
     MaxLambda = maxLambda;
+    // Used if no probe fits the budget
+    LastLambda = maxLambda;
+    Searched = true;
+
+    UseRateControl = HasHint;
+    if (UseRateControl) {
+        RateControlDone = false;
+        RateControl.Start(minLambda, maxLambda, (maxLambda + minLambda) / 2.0, targetBits, targetBits);
+    }
 }
 
 float TBitStreamEncoder::TImpl::DoContinue() noexcept
 {
+    if (UseRateControl) {
+        if (RateControlDone) {
+            return RateControl.GetResult();
+        }
+        RepeatEncPos = CurEncPos;
+        return RateControl.Get();
+    }
+
     if (MaxLambda <= MinLambda) {
         return LastLambda;
     }
@@ -74,8 +104,24 @@ float TBitStreamEncoder::TImpl::DoContinue() noexcept
 
 void TBitStreamEncoder::TImpl::DoSubmit(size_t gotBits) noexcept
 {
+    FrameIterations++;
+    if (UseRateControl) {
+        if (RateControlDone) {
+            NeedRepeat = false;
+        } else if (RateControl.Submit(gotBits)) {
+            Solution = RateControl.GetResult();
+            // Result is not the last probe, encode once again with it
+            RateControlDone = true;
+            NeedRepeat = Solution != RateControl.Get();
+        } else {
+            NeedRepeat = true;
+        }
+        return;
+    }
+
     if  (MaxLambda <= MinLambda) {
         NeedRepeat = false;
+        Solution = LastLambda;
     } else {
         if (gotBits < TargetBits) {
             LastLambda = CurLambda;
@@ -86,6 +132,7 @@ void TBitStreamEncoder::TImpl::DoSubmit(size_t gotBits) noexcept
             NeedRepeat = true;
         } else {
             NeedRepeat = false;
+            Solution = CurLambda;
         }
     }
 }
@@ -97,6 +144,9 @@ bool TBitStreamEncoder::TImpl::DoCheck(size_t gotBits) const noexcept
 
 void TBitStreamEncoder::TImpl::DoRun(void* frameData, TBitStream& bs)
 {
+    Searched = false;
+    FrameIterations = 0;
+    RepeatEncPos = 0;
     bool cont = false;
     do {
         for (CurEncPos = RepeatEncPos; CurEncPos < Encoders.size(); CurEncPos++) {
@@ -104,6 +154,10 @@ void TBitStreamEncoder::TImpl::DoRun(void* frameData, TBitStream& bs)
             if (NeedRepeat) {
                 NeedRepeat = false;
                 cont = true;
+                // Stages from the one which continues the search are encoded again
+                for (size_t i = RepeatEncPos; i <= CurEncPos; i++) {
+                    Encoders[i]->Reset();
+                }
                 break;
             } else {
                 cont = false;
@@ -122,6 +176,12 @@ void TBitStreamEncoder::TImpl::DoRun(void* frameData, TBitStream& bs)
     for (size_t i = 0; i < Encoders.size(); i++) {
         Encoders[i]->Dump(bs);
     }
+
+    if (Searched) {
+        RateControl.Hint(Solution);
+        HasHint = true;
+        Stat.Add(FrameIterations);
+    }
 }
 
 uint32_t TBitStreamEncoder::TImpl::DoGetCurGlobalConsumption() const noexcept
@@ -149,6 +209,11 @@ void TBitStreamEncoder::Do(void* frameData, TBitStream& bs)
     Impl->DoRun(frameData, bs);
 }
 
+const TRateControlStat& TBitStreamEncoder::GetRateControlStat() const noexcept
+{
+    return Impl->GetStat();
+}
+
 /////
 
 void TBitAllocHandler::Start(size_t targetBits, float minLambda, float maxLambda) noexcept
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include "rate_control.h"
+
 #include <memory>
 #include <vector>
 #include <functional>
@@ -62,6 +64,7 @@ public:
     ~TBitStreamEncoder();
 
     void Do(void* frameData, NBitStream::TBitStream& bs);
+    const TRateControlStat& GetRateControlStat() const noexcept;
     TBitStreamEncoder(const TBitStreamEncoder&) = delete;
     TBitStreamEncoder& operator=(const TBitStreamEncoder&) = delete;
 private:
@@ -176,3 +176,65 @@ TEST(BsEncode, NotExactAlloc) {
 }
 
 
+
+class TStartPartEncoder : public IBitStreamPartEncoder {
+public:
+    EStatus Encode(void* frameData, TBitAllocHandler& ba) override {
+        ba.Start(1000, -15, -1);
+        return EStatus::Ok;
+    }
+
+    void Dump(NBitStream::TBitStream& bs) override {
+    }
+
+    uint32_t GetConsumption() const noexcept override {
+        return 0;
+    }
+};
+
+class TLambdaPartEncoder : public IBitStreamPartEncoder {
+public:
+    EStatus Encode(void* frameData, TBitAllocHandler& ba) override {
+        auto lambda = ba.Continue();
+        Bits = SomeBitFn1(lambda);
+        ba.Submit(Bits);
+        return EStatus::Ok;
+    }
+
+    void Dump(NBitStream::TBitStream& bs) override {
+         for (size_t i = 0; i < Bits; i++) {
+             bs.Write(1, 1);
+         }
+    }
+
+    uint32_t GetConsumption() const noexcept override {
+        return Bits;
+    }
+private:
+    size_t Bits = 0;
+};
+
+TEST(BsEncode, WarmStartNextFrames) {
+    std::vector<IBitStreamPartEncoder::TPtr> encoders;
+    encoders.emplace_back(std::make_unique<TStartPartEncoder>());
+    encoders.emplace_back(std::make_unique<TLambdaPartEncoder>());
+
+    TBitStreamEncoder encoder(std::move(encoders));
+    {
+        NBitStream::TBitStream bs;
+        encoder.Do(nullptr, bs);
+        EXPECT_EQ(bs.GetSizeInBits(), 1000);
+        EXPECT_EQ(encoder.GetRateControlStat().Iterations, 8);
+    }
+
+    for (size_t frame = 1; frame < 10; frame++) {
+        NBitStream::TBitStream bs;
+        encoder.Do(nullptr, bs);
+        EXPECT_LE(bs.GetSizeInBits(), 1000);
+        EXPECT_GE(bs.GetSizeInBits(), 990);
+    }
+
+    const TRateControlStat& stat = encoder.GetRateControlStat();
+    EXPECT_EQ(stat.Frames, 10);
+    EXPECT_LT(stat.Iterations, 8 * 10);
+}
@@ -0,0 +1,117 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "rate_control.h"
+
+#include <algorithm>
+
+namespace NAtracDEnc {
+
+TRateControl::TRateControl(float precision, float step) noexcept
+    : Precision(precision)
+    , Step(step)
+{}
+
+void TRateControl::Start(float minVal, float maxVal, float coldStart, uint32_t minBits, uint32_t maxBits) noexcept
+{
+    MinVal = minVal;
+    MaxVal = maxVal;
+    MinBits = minBits;
+    MaxBits = maxBits;
+
+    HasLo = false;
+    HasHi = false;
+    LastSide = 0;
+    CurStep = Step;
+    Iterations = 0;
+
+    Cur = HasPrev ? std::min(std::max(Prev, minVal), maxVal) : coldStart;
+}
+
+void TRateControl::Finish(float result) noexcept
+{
+    Result = result;
+    Prev = result;
+    HasPrev = true;
+}
+
+bool TRateControl::Submit(uint32_t bits) noexcept
+{
+    Iterations++;
+
+    if (bits >= MinBits && bits <= MaxBits) {
+        Finish(Cur);
+        return true;
+    }
+
+    int side;
+    if (bits > MaxBits) {
+        Lo = Cur;
+        LoBits = bits;
+        HasLo = true;
+        side = -1;
+    } else {
+        Hi = Cur;
+        HiBits = bits;
+        HasHi = true;
+        side = 1;
+    }
+
+    // Expand the bracket from the start point
+    if (!HasHi) {
+        if (Cur >= MaxVal) {
+            // Budget can't be reached, best effort
+            Finish(MaxVal);
+            return true;
+        }
+        Cur = std::min(Cur + CurStep, MaxVal);
+        CurStep *= 2;
+        return false;
+    }
+
+    if (!HasLo) {
+        if (Cur <= MinVal) {
+            Finish(MinVal);
+            return true;
+        }
+        Cur = std::max(Cur - CurStep, MinVal);
+        CurStep *= 2;
+        return false;
+    }
+
+    if (Hi - Lo < Precision) {
+        Finish(Hi);
+        return true;
+    }
+
+    float next;
+    if (side == LastSide) {
+        // Regula falsi moves only one side of the bracket, fall back to bisection
+        next = (Lo + Hi) / 2;
+    } else {
+        const double target = ((double)MinBits + MaxBits) / 2;
+        next = Lo + (Hi - Lo) * ((LoBits - target) / ((double)LoBits - HiBits));
+    }
+    LastSide = side;
+
+    const float margin = Precision / 4;
+    Cur = std::min(std::max(next, Lo + margin), Hi - margin);
+    return false;
+}
+
+} // namespace NAtracDEnc
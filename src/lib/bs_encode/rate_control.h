@@ -0,0 +1,106 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace NAtracDEnc {
+
+// Number of rate control iterations (bit consumption evaluations)
+// spent per encoded unit (sound unit, channel or frame).
+struct TRateControlStat {
+    uint64_t Frames = 0;
+    uint64_t Iterations = 0;
+    uint32_t MaxIterations = 0;
+
+    void Add(uint32_t iterations) noexcept {
+        Frames++;
+        Iterations += iterations;
+        if (iterations > MaxIterations)
+            MaxIterations = iterations;
+    }
+
+    TRateControlStat& operator+=(const TRateControlStat& other) noexcept {
+        Frames += other.Frames;
+        Iterations += other.Iterations;
+        if (other.MaxIterations > MaxIterations)
+            MaxIterations = other.MaxIterations;
+        return *this;
+    }
+};
+
+// Search of the rate control parameter (allocation shift, lambda) which gives
+// bit consumption in [minBits, maxBits]. Consumption must not grow with the parameter.
+// The search starts from the solution of the previous search, expands a bracket
+// around it with a doubling step and refines the bracket with regula falsi steps
+// (bisection if regula falsi does not shrink the bracket fast enough).
+//
+// Usage:
+//  rc.Start(...);
+//  do {
+//      bits = Evaluate(rc.Get());
+//  } while (!rc.Submit(bits));
+//  rc.GetResult() - the parameter to use, not always the last probed one
+class TRateControl {
+public:
+    TRateControl(float precision, float step) noexcept;
+
+    // coldStart is used if there is no previous solution
+    void Start(float minVal, float maxVal, float coldStart, uint32_t minBits, uint32_t maxBits) noexcept;
+    float Get() const noexcept { return Cur; }
+    // Returns true if the search is finished
+    bool Submit(uint32_t bits) noexcept;
+    float GetResult() const noexcept { return Result; }
+    uint32_t GetIterations() const noexcept { return Iterations; }
+    // Set the start point of the next search
+    void Hint(float solution) noexcept { Prev = solution; HasPrev = true; }
+    // Forget previous solution, the next search is started from coldStart
+    void Reset() noexcept { HasPrev = false; }
+
+private:
+    void Finish(float result) noexcept;
+
+    const float Precision;
+    const float Step;
+
+    float MinVal = 0;
+    float MaxVal = 0;
+    uint32_t MinBits = 0;
+    uint32_t MaxBits = 0;
+
+    // Lo gives too many bits, Hi fits in to the budget
+    float Lo = 0;
+    float Hi = 0;
+    uint32_t LoBits = 0;
+    uint32_t HiBits = 0;
+    bool HasLo = false;
+    bool HasHi = false;
+    // Side of the bracket moved by the last step, -1 - Lo, 1 - Hi
+    int LastSide = 0;
+
+    float CurStep = 0;
+    float Cur = 0;
+    float Result = 0;
+    uint32_t Iterations = 0;
+
+    float Prev = 0;
+    bool HasPrev = false;
+};
+
+} // namespace NAtracDEnc
@@ -0,0 +1,84 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "rate_control.h"
+#include <gtest/gtest.h>
+#include <cmath>
+
+using namespace NAtracDEnc;
+
+// Step function like a real allocation: bits drop by 8 every 0.05 of shift
+static uint32_t Bits(float shift, float offset) {
+    return 8 * (uint32_t)std::max(0.0f, std::floor((20.0f - shift + offset) / 0.05f));
+}
+
+static uint32_t Search(TRateControl& rc, float offset, uint32_t minBits, uint32_t maxBits) {
+    rc.Start(-8, 20, 6, minBits, maxBits);
+    while (!rc.Submit(Bits(rc.Get(), offset)))
+        ;
+    return Bits(rc.GetResult(), offset);
+}
+
+TEST(TRateControl, InWindow) {
+    TRateControl rc(0.1, 0.5);
+    const uint32_t bits = Search(rc, 0.0, 1000, 1100);
+    EXPECT_GE(bits, 1000u);
+    EXPECT_LE(bits, 1100u);
+}
+
+TEST(TRateControl, PrecisionLimit) {
+    TRateControl rc(0.1, 0.5);
+    // Window is narrower than the step of the function
+    const uint32_t bits = Search(rc, 0.0, 1001, 1001);
+    EXPECT_LT(bits, 1001u);
+    EXPECT_GT(Bits(rc.GetResult() - 0.1, 0.0), 1001u);
+}
+
+TEST(TRateControl, OutOfRange) {
+    TRateControl rc(0.1, 0.5);
+    Search(rc, 0.0, 1000000, 1000000);
+    EXPECT_EQ(rc.GetResult(), -8);
+
+    Search(rc, 0.0, 0, 0);
+    EXPECT_EQ(rc.GetResult(), 20);
+}
+
+TEST(TRateControl, WarmStartReducesIterations) {
+    TRateControl warm(0.1, 0.5);
+    TRateControl cold(0.1, 0.5);
+    TRateControlStat warmStat;
+    TRateControlStat coldStat;
+
+    for (int frame = 0; frame < 100; frame++) {
+        const float offset = 0.5 * sin(frame * 0.1);
+        const uint32_t warmBits = Search(warm, offset, 2000, 2100);
+        warmStat.Add(warm.GetIterations());
+
+        cold.Reset();
+        const uint32_t coldBits = Search(cold, offset, 2000, 2100);
+        coldStat.Add(cold.GetIterations());
+
+        EXPECT_GE(warmBits, 2000u);
+        EXPECT_LE(warmBits, 2100u);
+        EXPECT_GE(coldBits, 2000u);
+        EXPECT_LE(coldBits, 2100u);
+    }
+
+    EXPECT_EQ(warmStat.Frames, 100u);
+    EXPECT_LT(warmStat.Iterations * 2, coldStat.Iterations);
+}
@@ -67,6 +67,7 @@ int oma_close(OMAFILE* oma_file);
 
 block_count_t oma_read(OMAFILE *oma_file, void *ptr, block_count_t blocks);
 block_count_t oma_write(OMAFILE *oma_file, const void *ptr, block_count_t blocks);
+int oma_flush(OMAFILE *oma_file);
 
 oma_info_t* oma_get_info(OMAFILE *oma_file);
 int oma_get_bitrate(oma_info_t *info);
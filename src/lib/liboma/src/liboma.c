@@ -292,6 +292,10 @@ block_count_t oma_write(OMAFILE *oma_file, const void *ptr, block_count_t blocks
     return -1;
 }
 
+int oma_flush(OMAFILE *oma_file) {
+    return fflush(oma_file->file);
+}
+
 oma_info_t* oma_get_info(OMAFILE *oma_file) {
     if (oma_file == NULL)
         return NULL;
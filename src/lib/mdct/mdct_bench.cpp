@@ -0,0 +1,59 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "mdct.h"
+#include <bench_signal.h>
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+using namespace NAtracDEnc;
+using namespace NMDCT;
+
+namespace {
+
+// Transform sizes of ATRAC1 (64, 256, 512) and ATRAC3 (512)
+template<size_t N>
+void BM_Mdct(benchmark::State& state) {
+    const std::vector<float> in = GenSignal(ESignal::WhiteNoise, N, 1);
+    TMDCT<N> mdct;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mdct(in.data()).data());
+    }
+    state.SetItemsProcessed(state.iterations() * N / 2);
+}
+
+template<size_t N>
+void BM_Midct(benchmark::State& state) {
+    const std::vector<float> in = GenSignal(ESignal::WhiteNoise, N / 2, 1);
+    TMIDCT<N> midct;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(midct(in.data()).data());
+    }
+    state.SetItemsProcessed(state.iterations() * N / 2);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_Mdct, 64);
+BENCHMARK_TEMPLATE(BM_Mdct, 256);
+BENCHMARK_TEMPLATE(BM_Mdct, 512);
+BENCHMARK_TEMPLATE(BM_Midct, 64);
+BENCHMARK_TEMPLATE(BM_Midct, 256);
+BENCHMARK_TEMPLATE(BM_Midct, 512);
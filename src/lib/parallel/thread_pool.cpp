@@ -0,0 +1,116 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "thread_pool.h"
+
+namespace NAtracDEnc {
+
+TThreadPool::TThreadPool(size_t threads)
+{
+    for (size_t i = 1; i < threads; i++) {
+        Workers.emplace_back(&TThreadPool::WorkerLoop, this, i);
+    }
+}
+
+TThreadPool::~TThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Stop = true;
+    }
+    Start.notify_all();
+    for (auto& w : Workers) {
+        w.join();
+    }
+}
+
+void TThreadPool::RunTasks(size_t worker)
+{
+    std::unique_lock<std::mutex> lock(Mutex);
+    const TTaskFn* fn = Fn;
+    if (worker) {
+        fesetenv(&Env);
+    }
+    while (NextTask < Tasks) {
+        const size_t task = NextTask++;
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            (*fn)(task, worker);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+        if (error && !Error) {
+            Error = error;
+        }
+    }
+    if (--Running == 0) {
+        Done.notify_all();
+    }
+}
+
+void TThreadPool::WorkerLoop(size_t worker)
+{
+    size_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(Mutex);
+            Start.wait(lock, [&] { return Stop || Generation != seen; });
+            if (Stop) {
+                return;
+            }
+            seen = Generation;
+        }
+        RunTasks(worker);
+    }
+}
+
+void TThreadPool::ParallelFor(size_t tasks, const TTaskFn& fn)
+{
+    if (Workers.empty() || tasks < 2) {
+        for (size_t i = 0; i < tasks; i++) {
+            fn(i, 0);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Fn = &fn;
+        fegetenv(&Env);
+        Tasks = tasks;
+        NextTask = 0;
+        Running = Workers.size() + 1;
+        Generation++;
+    }
+    Start.notify_all();
+
+    RunTasks(0);
+
+    std::unique_lock<std::mutex> lock(Mutex);
+    Done.wait(lock, [this] { return Running == 0; });
+    Fn = nullptr;
+    if (Error) {
+        std::exception_ptr error = std::move(Error);
+        Error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+} // namespace NAtracDEnc
@@ -0,0 +1,74 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <fenv.h>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace NAtracDEnc {
+
+// Fixed set of worker threads to run independent tasks of one job.
+// The calling thread takes part in the job as worker 0, so the pool
+// created for N threads starts N - 1 threads. Workers run tasks with the
+// floating point environment (rounding, subnormals flushing) of the caller.
+class TThreadPool {
+public:
+    // fn(task, worker), worker is in [0, GetThreadsNum())
+    using TTaskFn = std::function<void(size_t, size_t)>;
+
+    explicit TThreadPool(size_t threads);
+    ~TThreadPool();
+
+    TThreadPool(const TThreadPool&) = delete;
+    TThreadPool& operator=(const TThreadPool&) = delete;
+
+    size_t GetThreadsNum() const noexcept { return Workers.size() + 1; }
+
+    // Runs fn for each task in [0, tasks) and returns when all tasks are done.
+    // Order of tasks execution is not specified. If tasks throw, the first exception
+    // is rethrown by the caller thread after all tasks are done.
+    void ParallelFor(size_t tasks, const TTaskFn& fn);
+
+private:
+    void WorkerLoop(size_t worker);
+    void RunTasks(size_t worker);
+
+    std::vector<std::thread> Workers;
+    std::mutex Mutex;
+    std::condition_variable Start;
+    std::condition_variable Done;
+
+    // State of the current job, guarded by Mutex
+    const TTaskFn* Fn = nullptr;
+    fenv_t Env;
+    size_t Tasks = 0;
+    size_t NextTask = 0;
+    size_t Running = 0;
+    size_t Generation = 0;
+    std::exception_ptr Error;
+    bool Stop = false;
+};
+
+} // namespace NAtracDEnc
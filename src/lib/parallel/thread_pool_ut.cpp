@@ -0,0 +1,76 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "thread_pool.h"
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <fenv.h>
+#include <stdexcept>
+
+using namespace NAtracDEnc;
+
+TEST(TThreadPool, AllTasksDone) {
+    for (size_t threads : {1, 2, 4}) {
+        TThreadPool pool(threads);
+        EXPECT_EQ(threads, pool.GetThreadsNum());
+        for (size_t job = 0; job < 100; job++) {
+            std::vector<size_t> res(job, 0);
+            std::atomic<size_t> badWorker{0};
+            pool.ParallelFor(job, [&](size_t task, size_t worker) {
+                if (worker >= threads)
+                    badWorker++;
+                res[task] += task + 1;
+            });
+            EXPECT_EQ(0u, badWorker.load());
+            for (size_t i = 0; i < job; i++) {
+                EXPECT_EQ(i + 1, res[i]);
+            }
+        }
+    }
+}
+
+TEST(TThreadPool, WorkersUseCallerFloatEnv) {
+    TThreadPool pool(4);
+    const int saved = fegetround();
+    for (int mode : {FE_DOWNWARD, FE_TONEAREST}) {
+        fesetround(mode);
+        std::atomic<size_t> badMode{0};
+        pool.ParallelFor(16, [&](size_t, size_t) {
+            if (fegetround() != mode)
+                badMode++;
+        });
+        EXPECT_EQ(0u, badMode.load());
+    }
+    fesetround(saved);
+}
+
+TEST(TThreadPool, TaskExceptionIsRethrown) {
+    TThreadPool pool(4);
+    std::atomic<size_t> done{0};
+    EXPECT_THROW(pool.ParallelFor(16, [&](size_t task, size_t) {
+        if (task == 5)
+            throw std::runtime_error("task failed");
+        done++;
+    }), std::runtime_error);
+    // The other tasks are completed and the pool is usable
+    EXPECT_EQ(15u, done.load());
+    done = 0;
+    pool.ParallelFor(16, [&](size_t, size_t) { done++; });
+    EXPECT_EQ(16u, done.load());
+}
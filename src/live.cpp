@@ -0,0 +1,158 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "live.h"
+
+#include <algorithm>
+
+namespace NAtracDEnc {
+
+namespace {
+
+class TLiveReader : public IPCMReader {
+public:
+    TLiveReader(IPCMReader* reader, TLiveStatPtr stat)
+        : Reader(reader)
+        , Stat(std::move(stat))
+    {}
+
+    bool Read(TPCMBuffer& data, const uint32_t size) const override {
+        const bool ok = Reader->Read(data, size);
+        if (ok) {
+            Stat->OnRead();
+        }
+        return ok;
+    }
+
+private:
+    std::unique_ptr<IPCMReader> Reader;
+    TLiveStatPtr Stat;
+};
+
+class TLiveOutput : public ICompressedOutput {
+public:
+    TLiveOutput(TCompressedOutputPtr out, TLiveStatPtr stat)
+        : Out(std::move(out))
+        , Stat(std::move(stat))
+    {}
+
+    void WriteFrame(std::vector<char> data) override {
+        Out->WriteFrame(std::move(data));
+        Out->Flush();
+        Stat->OnWrite();
+    }
+
+    void Flush() override {
+        Out->Flush();
+    }
+
+    std::string GetName() const override {
+        return Out->GetName();
+    }
+
+    size_t GetChannelNum() const override {
+        return Out->GetChannelNum();
+    }
+
+private:
+    TCompressedOutputPtr Out;
+    TLiveStatPtr Stat;
+};
+
+} //namespace
+
+void TLatencyHistogram::Add(uint64_t us) {
+    size_t i = 0;
+    while (i + 1 < NumBuckets && (us >> (i + 1))) {
+        i++;
+    }
+    Buckets[i]++;
+    Count++;
+    Sum += us;
+    Min = std::min(Min, us);
+    Max = std::max(Max, us);
+}
+
+uint64_t TLatencyHistogram::GetPercentile(double p) const {
+    if (Count == 0) {
+        return 0;
+    }
+    const uint64_t rank = std::max<uint64_t>(1, (uint64_t)(p / 100.0 * Count + 0.5));
+    uint64_t acc = 0;
+    for (size_t i = 0; i < NumBuckets; i++) {
+        acc += Buckets[i];
+        if (acc >= rank) {
+            return std::min(Max, ((uint64_t)2 << i) - 1);
+        }
+    }
+    return Max;
+}
+
+void TLatencyHistogram::Print(FILE* out) const {
+    fprintf(out, " count: %llu, min: %llu, avg: %llu, p50: <=%llu, p99: <=%llu, max: %llu\n",
+        (unsigned long long)Count, (unsigned long long)GetMin(), (unsigned long long)GetAvg(),
+        (unsigned long long)GetPercentile(50), (unsigned long long)GetPercentile(99),
+        (unsigned long long)Max);
+
+    uint64_t top = 0;
+    for (auto b : Buckets) {
+        top = std::max(top, b);
+    }
+    for (size_t i = 0; i < NumBuckets; i++) {
+        if (Buckets[i] == 0) {
+            continue;
+        }
+        const int bar = (int)((Buckets[i] * 40 + top - 1) / top);
+        fprintf(out, " %10llu - %-10llu %8llu %.*s\n",
+            (unsigned long long)(i ? (uint64_t)1 << i : 0), (unsigned long long)((uint64_t)2 << i) - 1,
+            (unsigned long long)Buckets[i], bar, "########################################");
+    }
+}
+
+void TLiveStat::OnRead() {
+    Arrival = TClock::now();
+    FramesRead++;
+}
+
+void TLiveStat::OnWrite() {
+    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(TClock::now() - Arrival);
+    Histogram.Add(us.count());
+    if (FramesWritten++ == 0) {
+        LookAheadFrames = FramesRead;
+    }
+}
+
+void TLiveStat::Print(FILE* out) const {
+    const uint64_t delay = GetAlgorithmicDelay();
+    fprintf(out, "Live mode: %llu frames read, %llu frames written, frame %zu samples\n",
+        (unsigned long long)FramesRead, (unsigned long long)FramesWritten, FrameSz);
+    fprintf(out, "Algorithmic delay: %llu samples (%.1f ms), look-ahead %llu frames\n",
+        (unsigned long long)delay, delay * 1000.0 / 44100.0, (unsigned long long)LookAheadFrames);
+    fprintf(out, "Latency from input arrival to frame written, us:\n");
+    Histogram.Print(out);
+}
+
+IPCMReader* CreateLiveReader(IPCMReader* reader, TLiveStatPtr stat) {
+    return new TLiveReader(reader, std::move(stat));
+}
+
+TCompressedOutputPtr CreateLiveOutput(TCompressedOutputPtr out, TLiveStatPtr stat) {
+    return TCompressedOutputPtr(new TLiveOutput(std::move(out), std::move(stat)));
+}
+
+} //namespace NAtracDEnc
@@ -0,0 +1,100 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include "compressed_io.h"
+#include "pcmengin.h"
+
+namespace NAtracDEnc {
+
+// Histogram of latencies in microseconds with power of two buckets,
+// bucket i holds values in [2^i, 2^(i+1)), bucket 0 also holds 0.
+class TLatencyHistogram {
+public:
+    static constexpr size_t NumBuckets = 32;
+
+    void Add(uint64_t us);
+
+    uint64_t GetCount() const { return Count; }
+    uint64_t GetMin() const { return Count ? Min : 0; }
+    uint64_t GetMax() const { return Max; }
+    uint64_t GetAvg() const { return Count ? Sum / Count : 0; }
+    uint64_t GetBucket(size_t i) const { return Buckets[i]; }
+    // Upper bound of the bucket which contains the given percentile
+    uint64_t GetPercentile(double p) const;
+
+    void Print(FILE* out) const;
+
+private:
+    std::array<uint64_t, NumBuckets> Buckets = {};
+    uint64_t Count = 0;
+    uint64_t Sum = 0;
+    uint64_t Min = UINT64_MAX;
+    uint64_t Max = 0;
+};
+
+// Statistic of the live mode: time from arrival of an input frame to the moment
+// the compressed frame produced after it is written and flushed.
+class TLiveStat {
+public:
+    using TClock = std::chrono::steady_clock;
+
+    // codecDelay - delay of the decoder side in samples (MDCT overlap, filter banks),
+    // the look-ahead of the encoder is measured while encoding
+    TLiveStat(size_t frameSz, size_t codecDelay)
+        : FrameSz(frameSz)
+        , CodecDelay(codecDelay)
+    {}
+
+    void OnRead();
+    void OnWrite();
+
+    uint64_t GetFramesRead() const { return FramesRead; }
+    uint64_t GetFramesWritten() const { return FramesWritten; }
+    // Input frames consumed before the first compressed frame was written
+    uint64_t GetLookAheadFrames() const { return LookAheadFrames; }
+    // Worst case delay of a sample from input to the frame which completes it
+    uint64_t GetAlgorithmicDelay() const { return LookAheadFrames * FrameSz + CodecDelay; }
+    const TLatencyHistogram& GetHistogram() const { return Histogram; }
+
+    void Print(FILE* out) const;
+
+private:
+    const size_t FrameSz;
+    const size_t CodecDelay;
+    TClock::time_point Arrival;
+    uint64_t FramesRead = 0;
+    uint64_t FramesWritten = 0;
+    uint64_t LookAheadFrames = 0;
+    TLatencyHistogram Histogram;
+};
+
+using TLiveStatPtr = std::shared_ptr<TLiveStat>;
+
+// Decorators which feed TLiveStat, the output one also flushes each frame
+IPCMReader* CreateLiveReader(IPCMReader* reader, TLiveStatPtr stat);
+TCompressedOutputPtr CreateLiveOutput(TCompressedOutputPtr out, TLiveStatPtr stat);
+
+} //namespace NAtracDEnc
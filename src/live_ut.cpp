@@ -0,0 +1,60 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "live.h"
+#include <gtest/gtest.h>
+
+using namespace NAtracDEnc;
+
+TEST(TLatencyHistogram, Buckets) {
+    TLatencyHistogram h;
+    h.Add(0);
+    h.Add(1);
+    h.Add(3);
+    h.Add(1000);
+    EXPECT_EQ(4u, h.GetCount());
+    EXPECT_EQ(0u, h.GetMin());
+    EXPECT_EQ(1000u, h.GetMax());
+    EXPECT_EQ(251u, h.GetAvg());
+    EXPECT_EQ(2u, h.GetBucket(0));
+    EXPECT_EQ(1u, h.GetBucket(1));
+    EXPECT_EQ(1u, h.GetBucket(9));
+    EXPECT_EQ(1u, h.GetPercentile(50));
+    EXPECT_EQ(1000u, h.GetPercentile(99));
+}
+
+TEST(TLatencyHistogram, Empty) {
+    TLatencyHistogram h;
+    EXPECT_EQ(0u, h.GetMin());
+    EXPECT_EQ(0u, h.GetAvg());
+    EXPECT_EQ(0u, h.GetPercentile(99));
+}
+
+TEST(TLiveStat, LookAhead) {
+    TLiveStat stat(2048, 100);
+    stat.OnRead();
+    stat.OnRead();
+    stat.OnWrite();
+    stat.OnRead();
+    stat.OnWrite();
+    EXPECT_EQ(3u, stat.GetFramesRead());
+    EXPECT_EQ(2u, stat.GetFramesWritten());
+    EXPECT_EQ(2u, stat.GetLookAheadFrames());
+    EXPECT_EQ(2u * 2048 + 100, stat.GetAlgorithmicDelay());
+    EXPECT_EQ(2u, stat.GetHistogram().GetCount());
+}
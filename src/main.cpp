@@ -16,6 +16,9 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <stdexcept>
@@ -31,9 +34,14 @@
 #include "at3.h"
 #include "oma.h"
 #include "config.h"
+#include "env.h"
+#include "stage_stat.h"
+#include "trace.h"
 #include "atrac1denc.h"
 #include "atrac3denc.h"
 #include "atrac3p.h"
+#include "live.h"
+#include "fanout.h"
 
 #ifdef PLATFORM_WINDOWS
 #include <windows.h>
@@ -91,6 +99,31 @@ static int checkedStoi(const char* data, int min, int max, int def)
     }
 }
 
+// Comma separated list, e.g. 66,105,132
+static std::vector<string> splitList(const char* data)
+{
+    std::vector<string> res;
+    const string list(data);
+    size_t pos = 0;
+    for (;;) {
+        const size_t end = list.find(',', pos);
+        res.push_back(list.substr(pos, end - pos));
+        if (end == string::npos)
+            break;
+        pos = end + 1;
+    }
+    return res;
+}
+
+static std::vector<uint32_t> checkedStoiList(const char* data, int min, int max, int def)
+{
+    std::vector<uint32_t> res;
+    for (const string& s : splitList(data)) {
+        res.push_back(checkedStoi(s.c_str(), min, max, def));
+    }
+    return res;
+}
+
 enum EMode {
     E_ENCODE = 1,
     E_DECODE = 2,
@@ -98,6 +131,20 @@ enum EMode {
     E_ATRAC3PLUS = 8
 };
 
+struct TCodec {
+    uint32_t Mode; // E_ATRAC3, E_ATRAC3PLUS or 0 for ATRAC1
+    uint32_t Bitrate; // 0 - use default for codec
+};
+
+static const char* GetCodecName(uint32_t mode)
+{
+    switch (mode) {
+        case E_ATRAC3: return "ATRAC3";
+        case E_ATRAC3PLUS: return "ATRAC3PLUS";
+        default: return "ATRAC1";
+    }
+}
+
 enum EOptions
 {
     O_ENCODE = 'e',
@@ -112,6 +159,12 @@ enum EOptions
     O_NOTONAL = 5,
     O_NOGAINCONTROL = 6,
     O_ADVANCED_OPT = 7,
+    O_SPEED = 8,
+    O_PARALLELCH = 9,
+    O_LIVE = 10,
+    O_STATS = 11,
+    O_TRACE = 12,
+    O_PERFCOUNTERS = 13,
 };
 
 static void CheckInputFormat(const TWav* p)
@@ -123,6 +176,14 @@ static void CheckInputFormat(const TWav* p)
         throw std::runtime_error("unsupported sample rate");
 }
 
+static void CheckAtrac3PChannels(int numChannels)
+{
+    if (TAt3PEnc::GetChannelUnits(numChannels).empty()) {
+        throw std::runtime_error("unsupported number of channels for ATRAC3PLUS: " + std::to_string(numChannels)
+            + ", 1, 2, 3, 4, 6, 7 and 8 channels are supported");
+    }
+}
+
 static TWavPtr OpenWavFile(const string& inFile)
 {
     TWavPtr wavPtr = std::make_unique<TWav>(inFile);
@@ -130,41 +191,58 @@ static TWavPtr OpenWavFile(const string& inFile)
     return wavPtr;
 }
 
-static void PrepareAtrac1Encoder(const string& inFile,
-                                 const string& outFile, 
+static TPCMEngine* CreateEncoderPCMEngine(const TWav& wav, size_t numChannels, uint16_t frameSz,
+                                          const TLiveStatPtr& live)
+{
+    IPCMReader* reader = wav.GetPCMReader();
+    if (!live) {
+        return new TPCMEngine(4096, numChannels, TPCMEngine::TReaderPtr(reader));
+    }
+    // Read one frame at a time, so the frame is encoded as soon as its input arrives
+    return new TPCMEngine(frameSz, numChannels, TPCMEngine::TReaderPtr(CreateLiveReader(reader, live)));
+}
+
+// Printed once before the outputs of the encoders
+static void PrintInputInfo(const string& inFile, const TWav& wav)
+{
+    cout << "Input:\n Filename: " << inFile
+         << "\n Channels: " << (int)wav.GetChannelNum()
+         << "\n SampleRate: " << wav.GetSampleRate()
+         << "\n Duration (sec): " << wav.GetTotalSamples() / wav.GetSampleRate()
+         << endl;
+}
+
+static TCompressedOutputPtr CreateEncoderOutput(TCompressedOutputPtr out, const TLiveStatPtr& live)
+{
+    if (!live) {
+        return out;
+    }
+    return CreateLiveOutput(std::move(out), live);
+}
+
+static void PrepareAtrac1Encoder(const string& outFile, 
                                  const bool noStdOut, 
                                  NAtrac1::TAtrac1EncodeSettings&& encoderSettings,
                                  uint64_t* totalSamples,
-                                 TWavPtr* wavIO,
-                                 TPcmEnginePtr* pcmEngine,
-                                 TAtracProcessorPtr* atracProcessor)
+                                 const TWavPtr& wavIO,
+                                 TAtracProcessorPtr* atracProcessor,
+                                 const TLiveStatPtr& live)
 {
     using NAtrac1::TAtrac1Data;
 
-    {
-        TWav* wavPtr = new TWav(inFile);
-        CheckInputFormat(wavPtr);
-        wavIO->reset(wavPtr);
-    }
-    const size_t numChannels = (*wavIO)->GetChannelNum();
-    *totalSamples = (*wavIO)->GetTotalSamples();
+    const size_t numChannels = wavIO->GetChannelNum();
+    *totalSamples = wavIO->GetTotalSamples();
     //TODO: recheck it
     const uint64_t numFrames = numChannels * (*totalSamples) / TAtrac1Data::NumSamples;
     if (numFrames >= UINT32_MAX) {
         std::cerr << "Number of input samples exceeds output format limitation,"
             "the result will be incorrect" << std::endl;
     }
-    TCompressedOutputPtr aeaIO = CreateAeaOutput(outFile, "test", numChannels, (uint32_t)numFrames);
-    pcmEngine->reset(new TPCMEngine(4096,
-                                            numChannels,
-                                            TPCMEngine::TReaderPtr((*wavIO)->GetPCMReader())));
+    TCompressedOutputPtr aeaIO = CreateEncoderOutput(
+        CreateAeaOutput(outFile, "test", numChannels, (uint32_t)numFrames), live);
     if (!noStdOut)
-        cout << "Input\n Filename: " << inFile
-             << "\n Channels: " << (int)numChannels
-             << "\n SampleRate: " << (*wavIO)->GetSampleRate()
-             << "\n Duration (sec): " << *totalSamples / (*wavIO)->GetSampleRate()
-	     << "\nOutput:\n Filename: " << outFile
-	     << "\n Codec: ATRAC1"
+        cout << "Output:\n Filename: " << outFile
+             << "\n Codec: ATRAC1"
              << endl;
     atracProcessor->reset(new TAtrac1Encoder(std::move(aeaIO), std::move(encoderSettings)));
 }
@@ -193,74 +271,118 @@ static void PrepareAtrac1Decoder(const string& inFile,
     atracProcessor->reset(new TAtrac1Decoder(std::move(aeaIO)));
 }
 
-static void PrepareAtrac3Encoder(const string& inFile,
-                                 const string& outFile,
-                                 const bool noStdOut,
-                                 NAtrac3::TAtrac3EncoderSettings&& encoderSettings,
-                                 uint64_t* totalSamples,
-                                 const TWavPtr& wavIO,
-                                 TPcmEnginePtr* pcmEngine,
-                                 TAtracProcessorPtr* atracProcessor)
+static TCompressedOutputPtr CreateAtrac3Output(const string& outFile,
+                                               int numChannels,
+                                               uint64_t numFrames,
+                                               const NAtrac3::TContainerParams& params,
+                                               string* contName)
 {
-    const int numChannels = encoderSettings.SourceChannels;
-    *totalSamples = wavIO->GetTotalSamples();
-    const uint64_t numFrames = (*totalSamples) / 1024;
-    if (numFrames >= UINT32_MAX) {
-        std::cerr << "Number of input samples exceeds output format limitation,"
-            "the result will be incorrect" << std::endl;
-    }
-
     const string ext = GetFileExt(outFile);
 
     TCompressedOutputPtr omaIO;
 
-    string contName;
     if (ext == "wav" || ext == "at3") {
-        contName = "AT3 (RIFF)";
+        *contName = "AT3 (RIFF)";
         omaIO = CreateAt3Output(outFile, numChannels, numFrames,
-                encoderSettings.ConteinerParams->FrameSz,
-                encoderSettings.ConteinerParams->Js);
+                params.FrameSz,
+                params.Js);
     } else if (ext == "rm") {
-        contName = "RealMedia";
+        *contName = "RealMedia";
         omaIO = CreateRmOutput(outFile, "test", numChannels,
-            numFrames, encoderSettings.ConteinerParams->FrameSz,
-            encoderSettings.ConteinerParams->Js);
+            numFrames, params.FrameSz,
+            params.Js);
     } else {
-        contName = "OMA";
+        *contName = "OMA";
         omaIO.reset(new TOma(outFile,
             "test",
             numChannels,
             (int32_t)numFrames, OMAC_ID_ATRAC3,
-            encoderSettings.ConteinerParams->FrameSz,
-            encoderSettings.ConteinerParams->Js));
+            params.FrameSz,
+            params.Js));
     }
+    return omaIO;
+}
 
-    if (!noStdOut)
-        cout << "Input:\n Filename: " << inFile
-             << "\n Channels: " << (int)numChannels
-             << "\n SampleRate: " << wavIO->GetSampleRate()
-             << "\n Duration (sec): " << *totalSamples / wavIO->GetSampleRate()
-	     << "\nOutput:\n Filename: " << outFile
-	     << "\n Codec: ATRAC3"
-	     << "\n Container: " << contName
-             << "\n Bitrate: " << encoderSettings.ConteinerParams->Bitrate
-             << endl;
+using TAtrac3SettingsFactory = std::function<NAtrac3::TAtrac3EncoderSettings(uint32_t bitrate)>;
 
-    pcmEngine->reset(new TPCMEngine(4096,
-                                            numChannels,
-                                            TPCMEngine::TReaderPtr(wavIO->GetPCMReader())));
-    atracProcessor->reset(new TAtrac3Encoder(std::move(omaIO), std::move(encoderSettings)));
+// Each of outFiles is encoded with the bitrate at the same position.
+// Outputs with the same joint stereo mode share one analysis pass.
+static void PrepareAtrac3Encoder(const std::vector<string>& outFiles,
+                                 const bool noStdOut,
+                                 const std::vector<uint32_t>& bitrates,
+                                 const TAtrac3SettingsFactory& createSettings,
+                                 uint64_t* totalSamples,
+                                 const TWavPtr& wavIO,
+                                 TAtracProcessorPtr* atracProcessor,
+                                 const TLiveStatPtr& live)
+{
+    using NAtrac3::TAtrac3Data;
+    using NAtrac3::TContainerParams;
+
+    if (outFiles.size() != bitrates.size()) {
+        throw std::invalid_argument("ATRAC3: number of bitrates must match number of output files");
+    }
+    if (live && outFiles.size() > 1) {
+        throw std::invalid_argument("--live is supported with one output file only");
+    }
+
+    const int numChannels = wavIO->GetChannelNum();
+    *totalSamples = wavIO->GetTotalSamples();
+    const uint64_t numFrames = (*totalSamples) / 1024;
+    if (numFrames >= UINT32_MAX) {
+        std::cerr << "Number of input samples exceeds output format limitation,"
+            "the result will be incorrect" << std::endl;
+    }
+
+    // Joint stereo changes the input of the MDCT, so non JS and JS outputs need own front ends
+    std::vector<TAtrac3Encoder::TOutput> groups[2];
+    uint32_t groupBitrate[2] = {0, 0};
+
+    for (size_t i = 0; i < outFiles.size(); i++) {
+        const TContainerParams* params = TAtrac3Data::GetContainerParamsForBitrate(bitrates[i] * 1024);
+        string contName;
+        TCompressedOutputPtr omaIO = CreateAtrac3Output(outFiles[i], numChannels, numFrames, *params, &contName);
+
+        if (!noStdOut)
+            cout << "Output:\n Filename: " << outFiles[i]
+                 << "\n Codec: ATRAC3"
+                 << "\n Container: " << contName
+                 << "\n Bitrate: " << params->Bitrate
+                 << endl;
+
+        auto& group = groups[params->Js];
+        if (group.empty()) {
+            groupBitrate[params->Js] = bitrates[i] * 1024;
+        }
+        group.push_back({CreateEncoderOutput(std::move(omaIO), live), params});
+    }
+
+    std::vector<TFanOutProcessor::TConsumer> encoders;
+    for (size_t js = 0; js < 2; js++) {
+        if (!groups[js].empty()) {
+            TAtracProcessorPtr encoder(new TAtrac3Encoder(std::move(groups[js]), createSettings(groupBitrate[js])));
+            encoders.push_back({std::move(encoder), TAtrac3Data::NumSamples, js ? "ATRAC3 JS" : "ATRAC3"});
+        }
+    }
+
+    if (encoders.size() == 1) {
+        *atracProcessor = std::move(encoders[0].Processor);
+    } else {
+        atracProcessor->reset(new TFanOutProcessor(std::move(encoders)));
+    }
 }
 
-static void PrepareAtrac3PEncoder(const string& inFile,
-                                  const string& outFile,
+static void PrepareAtrac3PEncoder(const string& outFile,
                                   const bool noStdOut,
                                   int numChannels,
                                   uint64_t* totalSamples,
                                   const TWavPtr& wavIO,
-                                  TPcmEnginePtr* pcmEngine,
                                   TAtracProcessorPtr* atracProcessor,
-                                  const char* advancedOpt)
+                                  uint32_t bitrate,
+                                  ESpeed speed,
+                                  bool parallelChannels,
+                                  const char* advancedOpt,
+                                  const TLiveStatPtr& live)
 {
     *totalSamples = wavIO->GetTotalSamples();
     const uint64_t numFrames = (*totalSamples) / 2048;
@@ -270,6 +392,8 @@ static void PrepareAtrac3PEncoder(const string& inFile,
     }
 
     const string ext = GetFileExt(outFile);
+    const uint16_t unitFrameSz = TAt3PEnc::GetFrameSzForBitrate(bitrate);
+    const uint16_t frameSz = TAt3PEnc::GetMultichannelFrameSz(numChannels, unitFrameSz);
 
     TCompressedOutputPtr omaIO;
 
@@ -284,34 +408,32 @@ static void PrepareAtrac3PEncoder(const string& inFile,
             "test",
             numChannels,
             (int32_t)numFrames, OMAC_ID_ATRAC3PLUS,
-            2048,
+            frameSz,
             false));
     }
 
     if (!noStdOut)
-        cout << "Input:\n Filename: " << inFile
-             << "\n Channels: " << (int)numChannels
-             << "\n SampleRate: " << wavIO->GetSampleRate()
-             << "\n Duration (sec): " << *totalSamples / wavIO->GetSampleRate()
-	     << "\nOutput:\n Filename: " << outFile
+        cout << "Output:\n Filename: " << outFile
 	     << "\n Codec: ATRAC3Plus"
 	     << "\n Container: " << contName
-             //<< "\n Bitrate: " << encoderSettings.ConteinerParams->Bitrate
+             << "\n Bitrate: " << TAt3PEnc::GetBitrate(frameSz)
              << endl;
 
-    pcmEngine->reset(new TPCMEngine(4096,
-                                            numChannels,
-                                            TPCMEngine::TReaderPtr(wavIO->GetPCMReader())));
     TAt3PEnc::TSettings settings;
+    settings.Speed = speed;
+    settings.ParallelChannels = parallelChannels;
+    settings.FrameSz = unitFrameSz;
     if (advancedOpt) {
         TAt3PEnc::ParseAdvancedOpt(advancedOpt, settings);
     }
-    atracProcessor->reset(new TAt3PEnc(std::move(omaIO), numChannels, settings));
+    atracProcessor->reset(new TAt3PEnc(CreateEncoderOutput(std::move(omaIO), live), numChannels, settings));
 }
 
 
 int main_(int argc, char* const* argv)
 {
+    // Encoder and decoder threads inherit it from this one
+    NEnv::TFloatEnvGuard floatEnv;
     const char* myName = argv[0];
     const char* advancedOpt = nullptr;
     static struct option longopts[] = {
@@ -325,12 +447,19 @@ int main_(int argc, char* const* argv)
         { "nostdout", no_argument, NULL, O_NOSTDOUT},
         { "nogaincontrol", no_argument, NULL, O_NOGAINCONTROL},
         { "advanced", required_argument, NULL, O_ADVANCED_OPT},
+        { "speed", required_argument, NULL, O_SPEED},
+        { "parallelch", no_argument, NULL, O_PARALLELCH},
+        { "live", no_argument, NULL, O_LIVE},
+        { "stats", optional_argument, NULL, O_STATS},
+        { "trace", required_argument, NULL, O_TRACE},
+        { "perf-counters", no_argument, NULL, O_PERFCOUNTERS},
         { NULL, 0, NULL, 0}
     };
 
     int ch = 0;
     string inFile;
     string outFile;
+    std::vector<string> outFiles;
     uint32_t mode = 0;
     uint32_t bfuIdxConst = 0; //0 - auto, no const
     bool fastBfuNumSearch = false;
@@ -340,25 +469,38 @@ int main_(int argc, char* const* argv)
     NAtrac1::TAtrac1EncodeSettings::EWindowMode windowMode = NAtrac1::TAtrac1EncodeSettings::EWindowMode::EWM_AUTO;
     uint32_t winMask = 0; //0 - all is long
     uint32_t bitrate = 0; //0 - use default for codec
+    std::vector<uint32_t> bitrates; //ATRAC3 may encode several bitrates at once
+    std::vector<TCodec> codecs; //several codecs are encoded from the same input in one pass
+    ESpeed speed = ESpeed::Default;
+    bool parallelChannels = false;
+    bool liveMode = false;
+    enum class EStatsFormat { None, Table, Json } statsFormat = EStatsFormat::None;
+    string traceFile;
+    bool perfCounters = false;
     while ((ch = getopt_long(argc, argv, "e:dhi:o:m", longopts, NULL)) != -1) {
         switch (ch) {
             case O_ENCODE:
                 mode |= E_ENCODE;
-                // if arg is given, it must specify the codec; otherwise use atrac1
-                if (optarg) {
-                    if (strcmp(optarg, "atrac3") == 0) {
-                        mode |= E_ATRAC3;
-                    } else if (strcmp(optarg, "atrac3_lp4") == 0) {
-                        mode |= E_ATRAC3;
-                        bitrate = 64;
-                    } else if (strcmp(optarg, "atrac3plus") == 0) {
-                        mode |= E_ATRAC3PLUS;
-                    } else if (strcmp(optarg, "atrac1") == 0) {
+                // if arg is given, it must specify the codec or a comma separated list of codecs;
+                // otherwise use atrac1
+                if (!optarg) {
+                    codecs.push_back({0, 0});
+                    break;
+                }
+                for (const string& name : splitList(optarg)) {
+                    if (name == "atrac3") {
+                        codecs.push_back({E_ATRAC3, 0});
+                    } else if (name == "atrac3_lp4") {
+                        codecs.push_back({E_ATRAC3, 64});
+                    } else if (name == "atrac3plus") {
+                        codecs.push_back({E_ATRAC3PLUS, 0});
+                    } else if (name == "atrac1") {
                         // this is the default
+                        codecs.push_back({0, 0});
                     } else {
                        // bad value
                        string err = "unrecognized encoding codec: ";
-                       err.append(optarg);
+                       err.append(name);
                        printUsage(myName, err);
                        return 1;
                     }
@@ -371,8 +513,8 @@ int main_(int argc, char* const* argv)
                 inFile = optarg;
                 break;
             case 'o':
-                outFile = optarg;
-                if (outFile == "-")
+                outFiles.push_back(optarg);
+                if (outFiles.back() == "-")
                     noStdOut = true;
                 break;
             case 'h':
@@ -380,7 +522,7 @@ int main_(int argc, char* const* argv)
                 return 0;
                 break;
             case O_BITRATE:
-                bitrate = checkedStoi(optarg, 32, 384, 0);
+                bitrates = checkedStoiList(optarg, 32, 384, 0);
                 break;
             case O_BFUIDXCONST:
                 bfuIdxConst = checkedStoi(optarg, 1, 32, 0);
@@ -410,6 +552,36 @@ int main_(int argc, char* const* argv)
             case O_ADVANCED_OPT:
                 advancedOpt = optarg;
                 break;
+            case O_SPEED:
+                try {
+                    speed = ParseSpeed(optarg);
+                } catch (const std::exception& ex) {
+                    printUsage(myName, ex.what());
+                    return 1;
+                }
+                break;
+            case O_PARALLELCH:
+                parallelChannels = true;
+                break;
+            case O_LIVE:
+                liveMode = true;
+                break;
+            case O_STATS:
+                if (!optarg || strcmp(optarg, "table") == 0) {
+                    statsFormat = EStatsFormat::Table;
+                } else if (strcmp(optarg, "json") == 0) {
+                    statsFormat = EStatsFormat::Json;
+                } else {
+                    printUsage(myName, "--stats format must be table or json");
+                    return 1;
+                }
+                break;
+            case O_TRACE:
+                traceFile = optarg;
+                break;
+            case O_PERFCOUNTERS:
+                perfCounters = true;
+                break;
             default:
                 printUsage(myName);
                 return 1;
@@ -428,29 +600,143 @@ int main_(int argc, char* const* argv)
         cerr << "No input file" << endl;
         return 1;
     }
-    if (outFile.empty()) {
+    if (outFiles.empty()) {
         cerr << "No out file" << endl;
         return 1;
     }
+    outFile = outFiles[0];
+
+    if (perfCounters) {
+        // Counters are reported per stage, so the stage report is needed
+        if (statsFormat == EStatsFormat::None)
+            statsFormat = EStatsFormat::Table;
+        TPerfCounters::Enable();
+    }
+    if (statsFormat != EStatsFormat::None) {
+        TStageStat::Enable();
+    }
+    if (!traceFile.empty()) {
+        TTrace::Enable();
+    }
+    const auto startTime = std::chrono::steady_clock::now();
+    auto printStageStat = [&]() {
+        if (!traceFile.empty() && !TTrace::Write(traceFile)) {
+            cerr << "Unable to write trace to " << traceFile << endl;
+        }
+        if (statsFormat == EStatsFormat::None)
+            return;
+        const std::chrono::duration<double> wall = std::chrono::steady_clock::now() - startTime;
+        TStageStat::Print(stderr, statsFormat == EStatsFormat::Json, wall.count());
+    };
+
+    const bool fanOut = codecs.size() > 1;
+    if (fanOut) {
+        if (outFiles.size() != codecs.size() || (!bitrates.empty() && bitrates.size() != codecs.size())) {
+            cerr << "Each codec needs own output file (and own bitrate if given)" << endl;
+            return 1;
+        }
+        if (liveMode) {
+            cerr << "--live is supported with one codec only" << endl;
+            return 1;
+        }
+        if (bitrates.empty()) {
+            for (const auto& codec : codecs) {
+                bitrates.push_back(codec.Bitrate);
+            }
+        }
+    } else if (codecs.size() == 1) {
+        mode |= codecs[0].Mode;
+        if (bitrates.empty() && codecs[0].Bitrate) {
+            bitrates.push_back(codecs[0].Bitrate);
+        }
+    }
+
+    if (!bitrates.empty()) {
+        bitrate = bitrates[0];
+    }
+    if ((outFiles.size() > 1 || bitrates.size() > 1) && mode != (E_ENCODE | E_ATRAC3) && !fanOut) {
+        cerr << "Several output files and bitrates are supported for ATRAC3 encoding only" << endl;
+        return 1;
+    }
+    if (bitrates.empty()) {
+        bitrates.push_back(0);
+    }
 
     TPcmEnginePtr pcmEngine;
     TAtracProcessorPtr atracProcessor;
     uint64_t totalSamples = 0;
     TWavPtr wavIO;
     uint32_t pcmFrameSz = 0; //size of one pcm frame to process
+    TLiveStatPtr liveStat;
+    // Several codecs read the input from a ring of blocks, each one at own pace
+    std::unique_ptr<TPCMRingEngine> ringEngine;
+    std::vector<TAtracProcessorPtr> ringProcessors;
+
+    auto createAtrac1Settings = [&]() {
+        if (bfuIdxConst > 8) {
+            throw std::invalid_argument("ATRAC1 mode, --bfuidxconst is a index of max used BFU. "
+                "Values [1;8] is allowed");
+        }
+        return NAtrac1::TAtrac1EncodeSettings(bfuIdxConst, fastBfuNumSearch, windowMode, winMask,
+                                              false, speed, parallelChannels);
+    };
+    auto createAtrac3Settings = [&](uint32_t containerBitrate) {
+        return NAtrac3::TAtrac3EncoderSettings(containerBitrate, noGainControl,
+                                               noTonalComponents, wavIO->GetChannelNum(), bfuIdxConst,
+                                               false, speed, parallelChannels);
+    };
 
     try {
-        switch (mode) {
+        if (liveMode && !(mode & E_ENCODE)) {
+            throw std::invalid_argument("--live is supported for encoding only");
+        }
+        if (fanOut) {
+            using NAtrac1::TAtrac1Data;
+            using NAtrac3::TAtrac3Data;
+            wavIO = OpenWavFile(inFile);
+            // Before any output file is created
+            for (const auto& codec : codecs) {
+                if (codec.Mode == E_ATRAC3PLUS)
+                    CheckAtrac3PChannels(wavIO->GetChannelNum());
+            }
+            if (!noStdOut)
+                PrintInputInfo(inFile, *wavIO);
+            ringEngine.reset(new TPCMRingEngine(4096, wavIO->GetChannelNum(), 8,
+                                                TPCMRingEngine::TReaderPtr(wavIO->GetPCMReader())));
+            for (size_t i = 0; i < codecs.size(); i++) {
+                TAtracProcessorPtr processor;
+                size_t frameSz = 0;
+                switch (codecs[i].Mode) {
+                    case E_ATRAC3:
+                        PrepareAtrac3Encoder({outFiles[i]}, noStdOut, {bitrates[i]}, createAtrac3Settings,
+                            &totalSamples, wavIO, &processor, nullptr);
+                        frameSz = TAtrac3Data::NumSamples;
+                        break;
+                    case E_ATRAC3PLUS:
+                        PrepareAtrac3PEncoder(outFiles[i], noStdOut, wavIO->GetChannelNum(),
+                            &totalSamples, wavIO, &processor, bitrates[i], speed, parallelChannels, advancedOpt,
+                            nullptr);
+                        frameSz = TAt3PEnc::NumSamples;
+                        break;
+                    default:
+                        PrepareAtrac1Encoder(outFiles[i], noStdOut, createAtrac1Settings(),
+                            &totalSamples, wavIO, &processor, nullptr);
+                        frameSz = TAtrac1Data::NumSamples;
+                }
+                ringEngine->AddConsumer(frameSz, processor->GetLambda());
+                ringProcessors.push_back(std::move(processor));
+            }
+        } else switch (mode) {
             case E_ENCODE:
 	        {
-                if (bfuIdxConst > 8) {
-                    throw std::invalid_argument("ATRAC1 mode, --bfuidxconst is a index of max used BFU. "
-                        "Values [1;8] is allowed");
-                }
                 using NAtrac1::TAtrac1Data;
-                NAtrac1::TAtrac1EncodeSettings encoderSettings(bfuIdxConst, fastBfuNumSearch, windowMode, winMask);
-                PrepareAtrac1Encoder(inFile, outFile, noStdOut, std::move(encoderSettings),
-                &totalSamples, &wavIO, &pcmEngine, &atracProcessor);
+                wavIO = OpenWavFile(inFile);
+                if (!noStdOut)
+                    PrintInputInfo(inFile, *wavIO);
+                if (liveMode)
+                    liveStat = std::make_shared<TLiveStat>(TAtrac1Data::NumSamples, TAtrac1Encoder::Delay);
+                PrepareAtrac1Encoder(outFile, noStdOut, createAtrac1Settings(),
+                &totalSamples, wavIO, &atracProcessor, liveStat);
                 pcmFrameSz = TAtrac1Data::NumSamples;
             }
             break;
@@ -466,18 +752,26 @@ int main_(int argc, char* const* argv)
             {
                 using NAtrac3::TAtrac3Data;
                 wavIO = OpenWavFile(inFile);
-                NAtrac3::TAtrac3EncoderSettings encoderSettings(bitrate * 1024, noGainControl,
-                                                                noTonalComponents, wavIO->GetChannelNum(), bfuIdxConst);
-                PrepareAtrac3Encoder(inFile, outFile, noStdOut, std::move(encoderSettings),
-                &totalSamples, wavIO, &pcmEngine, &atracProcessor);
+                if (!noStdOut)
+                    PrintInputInfo(inFile, *wavIO);
+                if (liveMode)
+                    liveStat = std::make_shared<TLiveStat>(TAtrac3Data::NumSamples, TAtrac3Encoder::Delay);
+                PrepareAtrac3Encoder(outFiles, noStdOut, bitrates, createAtrac3Settings,
+                &totalSamples, wavIO, &atracProcessor, liveStat);
                 pcmFrameSz = TAtrac3Data::NumSamples;;
             }
             break;
             case (E_ENCODE | E_ATRAC3PLUS):
             {
                 wavIO = OpenWavFile(inFile);
-                PrepareAtrac3PEncoder(inFile, outFile, noStdOut, wavIO->GetChannelNum(),
-                    &totalSamples, wavIO, &pcmEngine, &atracProcessor, advancedOpt);
+                CheckAtrac3PChannels(wavIO->GetChannelNum());
+                if (!noStdOut)
+                    PrintInputInfo(inFile, *wavIO);
+                if (liveMode)
+                    liveStat = std::make_shared<TLiveStat>(TAt3PEnc::NumSamples, TAt3PEnc::Delay);
+                PrepareAtrac3PEncoder(outFile, noStdOut, wavIO->GetChannelNum(),
+                    &totalSamples, wavIO, &atracProcessor, bitrate, speed, parallelChannels, advancedOpt,
+                    liveStat);
                 pcmFrameSz = 2048;
             }
             break;
@@ -486,22 +780,56 @@ int main_(int argc, char* const* argv)
                 throw std::runtime_error("Processing mode was not specified");
             }
         }
+        if ((mode & E_ENCODE) && !ringEngine) {
+            pcmEngine.reset(CreateEncoderPCMEngine(*wavIO, wavIO->GetChannelNum(), pcmFrameSz, liveStat));
+        }
     } catch (const std::exception& ex) {
         cerr << "Fatal error: " << ex.what() << endl;
         return 1;
     }
 
+    if (ringEngine) {
+        try {
+            ringEngine->Run([&](uint64_t read) {
+                if (!noStdOut)
+                    printProgress(static_cast<int>(std::min(read, totalSamples) * 100 / std::max<uint64_t>(totalSamples, 1)));
+            });
+        } catch (const std::exception& ex) {
+            cerr << "Encode error: " << ex.what() << endl;
+            return 1;
+        }
+        if (!noStdOut) {
+            cout << "\nDone\nThroughput:" << endl;
+            for (size_t i = 0; i < codecs.size(); i++) {
+                const auto& stat = ringEngine->GetStat(i);
+                const double duration = (double)stat.Processed / wavIO->GetSampleRate();
+                cout << " " << GetCodecName(codecs[i].Mode) << ": " << duration << " s encoded in "
+                     << stat.Seconds << " s, " << (stat.Seconds > 0 ? duration / stat.Seconds : 0.0)
+                     << "x realtime" << endl;
+            }
+        }
+        printStageStat();
+        return 0;
+    }
+
+    auto printStat = [&]() {
+        if (liveStat)
+            liveStat->Print(stderr);
+        printStageStat();
+    };
+
     auto atracLambda = atracProcessor->GetLambda();
 
     uint64_t processed = 0;
     try {
         while (totalSamples > (processed = pcmEngine->ApplyProcess(pcmFrameSz, atracLambda)))
         {
-            if (!noStdOut)
+            if (!noStdOut && !liveStat)
                 printProgress(static_cast<int>(processed*100/totalSamples));
         }
         if (!noStdOut)
             cout << "\nDone" << endl;
+        printStat();
     }
     catch (const TAeaIOError& err) {
         cerr << "Aea IO fatal error: " << err.what() << endl;
@@ -509,6 +837,7 @@ int main_(int argc, char* const* argv)
     }
     catch (const TNoDataToRead&) {
         cerr << "No more data to read from input" << endl;
+        printStat();
         return 0;
     }
     catch (const std::exception& ex) {
@@ -18,12 +18,26 @@
 
 #include "oma.h"
 
+#include <stdexcept>
 #include <stdlib.h>
 
 using std::string;
 using std::vector;
 using std::unique_ptr;
 
+static int GetAtrac3pChannelFormat(size_t numChannel) {
+    switch (numChannel) {
+        case 1: return OMA_MONO;
+        case 2: return OMA_STEREO;
+        case 3: return OMA_3;
+        case 4: return OMA_4;
+        case 6: return OMA_6;
+        case 7: return OMA_7;
+        case 8: return OMA_8;
+    }
+    throw std::runtime_error("unsupported number of channels for ATRAC3PLUS: " + std::to_string(numChannel));
+}
+
 TOma::TOma(const string& filename, const string&, size_t numChannel,
     uint32_t /*numFrames*/, int cid, uint32_t framesize, bool jointStereo) {
     oma_info_t info;
@@ -31,7 +45,7 @@ TOma::TOma(const string& filename, const string&, size_t numChannel,
     info.samplerate = 44100;
     info.channel_format = (cid == OMAC_ID_ATRAC3)
         ? (jointStereo ? OMA_STEREO_JS : OMA_STEREO)
-        : (numChannel == 1 ? OMA_MONO : OMA_STEREO);
+        : GetAtrac3pChannelFormat(numChannel);
     info.framesize = framesize;
     File = oma_open(filename.c_str(), OMAM_W, &info);
     if (!File)
@@ -49,6 +63,10 @@ void TOma::WriteFrame(vector<char> data) {
     }
 }
 
+void TOma::Flush() {
+    oma_flush(File);
+}
+
 string TOma::GetName() const {
     abort();
     return {};
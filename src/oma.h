@@ -29,6 +29,7 @@ public:
         uint32_t numFrames, int cid, uint32_t framesize, bool jointStereo);
     ~TOma();
     void WriteFrame(std::vector<char> data) override;
+    void Flush() override;
     std::string GetName() const override;
     size_t GetChannelNum() const override;
 };
@@ -25,9 +25,16 @@
 #include <cstdlib>
 #include <iostream>
 #include <cstdint>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #include <assert.h>
 #include <string.h>
+#include <fenv.h>
+
+#include "stage_stat.h"
 
 class TNoDataToRead : public std::exception {
 };
@@ -114,6 +121,8 @@ public:
     typedef std::unique_ptr<IPCMReader> TReaderPtr;
     struct ProcessMeta {
         const uint16_t Channels;
+        // No new input, the last block is passed again to flush the look-ahead
+        const bool Drain = false;
     };
 private:
     TPCMBuffer Buffer;
@@ -121,6 +130,7 @@ private:
     TReaderPtr Reader;
     uint64_t Processed = 0;
     uint64_t ToDrain = 0;
+    uint64_t Frames = 0; // calls of the lambda, numbers frames in the trace
 public:
         TPCMEngine(uint16_t bufSize, size_t numChannels)
            : Buffer(bufSize, numChannels) {
@@ -157,7 +167,11 @@ public:
             bool drain = false;
             if (Reader) {
                 const uint32_t sizeToRead = Buffer.Size();
-                const bool ok = Reader->Read(Buffer, sizeToRead);
+                bool ok;
+                {
+                    NAtracDEnc::TStageScope stage(NAtracDEnc::EStage::PcmRead);
+                    ok = Reader->Read(Buffer, sizeToRead);
+                }
                 if (!ok) {
                     if (ToDrain) {
                         drain = true;
@@ -168,10 +182,14 @@ public:
             }
 
             size_t lastPos = 0;
-            ProcessMeta meta = {Buffer.Channels()};
+            ProcessMeta meta = {Buffer.Channels(), drain};
 
             for (size_t i = 0; i + step <= Buffer.Size(); i+=step) {
-                auto res = lambda(Buffer[i], meta);
+                EProcessResult res;
+                {
+                    NAtracDEnc::TFrameScope frame(Frames++);
+                    res = lambda(Buffer[i], meta);
+                }
                 if (res == EProcessResult::PROCESSED) {
                     lastPos += step;
                     if (drain && ToDrain--) {
@@ -184,6 +202,7 @@ public:
             }
 
             if (Writer) {
+                NAtracDEnc::TStageScope stage(NAtracDEnc::EStage::PcmWrite);
                 Writer->Write(Buffer, lastPos);
             }
 
@@ -197,3 +216,199 @@ public:
     virtual typename TPCMEngine::TProcessLambda GetLambda() = 0;
     virtual ~IProcessor() {}
 };
+
+// Feeds the same input to several consumers without copying. Blocks of input are
+// kept in a ring, a block is reused when all consumers are done with it. Each consumer
+// runs on own thread at own pace with own step, the reader waits for the slowest one.
+class TPCMRingEngine {
+public:
+    typedef std::unique_ptr<IPCMReader> TReaderPtr;
+    typedef std::function<void(uint64_t read)> TProgressLambda;
+
+    struct TConsumerStat {
+        uint64_t Processed = 0;
+        double Seconds = 0; // time spent in the consumer lambda
+    };
+
+private:
+    struct TSlot {
+        TSlot(uint16_t bufSize, size_t numChannels)
+            : Buffer(bufSize, numChannels)
+        {}
+        TPCMBuffer Buffer;
+        size_t Refs = 0; // consumers which have not processed the block yet
+    };
+
+    struct TConsumer {
+        size_t Step;
+        TPCMEngine::TProcessLambda Lambda;
+        TConsumerStat Stat;
+        uint64_t Frames = 0;
+    };
+
+    const uint16_t BlockSize;
+    const uint16_t NumChannels;
+    std::vector<TSlot> Ring;
+    std::vector<TConsumer> Consumers;
+    TReaderPtr Reader;
+
+    // Guards state below and Refs of slots
+    std::mutex Mutex;
+    std::condition_variable Cond;
+    uint64_t Published = 0; // number of blocks read
+    bool Eof = false;
+    bool Failed = false;
+    std::exception_ptr Error;
+
+    void SetError(std::exception_ptr error) {
+        std::lock_guard<std::mutex> lock(Mutex);
+        if (!Failed) {
+            Failed = true;
+            Error = error;
+        }
+        Cond.notify_all();
+    }
+
+    void ProcessBlock(TConsumer& consumer, TPCMBuffer& buf, bool drain, size_t* lookAhead) {
+        const TPCMEngine::ProcessMeta meta = {NumChannels, drain};
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t pos = 0; pos + consumer.Step <= BlockSize; pos += consumer.Step) {
+            if (drain && *lookAhead == 0) {
+                break;
+            }
+            TPCMEngine::EProcessResult res;
+            {
+                NAtracDEnc::TFrameScope frame(consumer.Frames++);
+                res = consumer.Lambda(buf[pos], meta);
+            }
+            if (res == TPCMEngine::EProcessResult::LOOK_AHEAD) {
+                assert(!drain);
+                (*lookAhead)++;
+                continue;
+            }
+            if (drain) {
+                (*lookAhead)--;
+            }
+            consumer.Stat.Processed += consumer.Step;
+        }
+        consumer.Stat.Seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void ConsumerLoop(TConsumer& consumer) {
+        size_t lookAhead = 0;
+        for (uint64_t next = 0;; next++) {
+            {
+                std::unique_lock<std::mutex> lock(Mutex);
+                Cond.wait(lock, [&] { return Published > next || Eof || Failed; });
+                if (Failed) {
+                    return;
+                }
+                if (Published <= next) {
+                    break;
+                }
+            }
+            TSlot& slot = Ring[next % Ring.size()];
+            ProcessBlock(consumer, slot.Buffer, false, &lookAhead);
+            {
+                std::lock_guard<std::mutex> lock(Mutex);
+                slot.Refs--;
+            }
+            Cond.notify_all();
+        }
+        // The reader has stopped, so the last block is intact, pass it again to flush the look-ahead
+        if (lookAhead && Published) {
+            ProcessBlock(consumer, Ring[(Published - 1) % Ring.size()].Buffer, true, &lookAhead);
+        }
+    }
+
+    void ReaderLoop(const TProgressLambda& progress) {
+        for (uint64_t seq = 0;; seq++) {
+            TSlot& slot = Ring[seq % Ring.size()];
+            {
+                std::unique_lock<std::mutex> lock(Mutex);
+                Cond.wait(lock, [&] { return slot.Refs == 0 || Failed; });
+                if (Failed) {
+                    return;
+                }
+            }
+            bool ok;
+            {
+                NAtracDEnc::TStageScope stage(NAtracDEnc::EStage::PcmRead);
+                ok = Reader->Read(slot.Buffer, BlockSize);
+            }
+            {
+                std::lock_guard<std::mutex> lock(Mutex);
+                if (ok) {
+                    slot.Refs = Consumers.size();
+                    Published++;
+                } else {
+                    Eof = true;
+                }
+            }
+            Cond.notify_all();
+            if (!ok) {
+                return;
+            }
+            if (progress) {
+                progress(Published * BlockSize);
+            }
+        }
+    }
+
+public:
+    // ringSize - number of blocks in the ring, at least 2
+    TPCMRingEngine(uint16_t blockSize, size_t numChannels, size_t ringSize, TReaderPtr&& reader)
+        : BlockSize(blockSize)
+        , NumChannels(numChannels)
+        , Reader(std::move(reader))
+    {
+        assert(ringSize >= 2);
+        Ring.reserve(ringSize);
+        for (size_t i = 0; i < ringSize; i++) {
+            Ring.emplace_back(blockSize, numChannels);
+        }
+    }
+
+    // step must divide the block size, the lambda must not change the input
+    size_t AddConsumer(size_t step, TPCMEngine::TProcessLambda lambda) {
+        if (step == 0 || step > BlockSize) {
+            throw TPCMBufferTooSmall();
+        }
+        assert(BlockSize % step == 0);
+        Consumers.push_back({step, std::move(lambda), TConsumerStat(), 0});
+        return Consumers.size() - 1;
+    }
+
+    // Reads the input to the end, the first error of the reader or a consumer is rethrown
+    void Run(const TProgressLambda& progress = TProgressLambda()) {
+        // Consumers run with the floating point environment of the caller
+        fenv_t env;
+        fegetenv(&env);
+        std::vector<std::thread> threads;
+        for (auto& consumer : Consumers) {
+            threads.emplace_back([this, &consumer, &env] {
+                fesetenv(&env);
+                try {
+                    ConsumerLoop(consumer);
+                } catch (...) {
+                    SetError(std::current_exception());
+                }
+            });
+        }
+        try {
+            ReaderLoop(progress);
+        } catch (...) {
+            SetError(std::current_exception());
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        if (Error) {
+            std::rethrow_exception(Error);
+        }
+    }
+
+    const TConsumerStat& GetStat(size_t consumer) const {
+        return Consumers[consumer].Stat;
+    }
+};
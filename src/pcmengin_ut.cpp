@@ -0,0 +1,124 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "pcmengin.h"
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Ramp of sample indexes in all channels
+class TRampReader : public IPCMReader {
+public:
+    explicit TRampReader(size_t len)
+        : Len(len)
+    {}
+    bool Read(TPCMBuffer& data, const uint32_t size) const override {
+        if (Pos >= Len)
+            return false;
+        for (uint32_t i = 0; i < size; i++, Pos++) {
+            for (size_t ch = 0; ch < data.Channels(); ch++) {
+                data[i][ch] = (Pos < Len) ? Pos : 0;
+            }
+        }
+        return true;
+    }
+private:
+    const size_t Len;
+    mutable size_t Pos = 0;
+};
+
+struct TRampChecker {
+    TRampChecker(size_t step, bool lookAhead, bool slow)
+        : Step(step)
+        , LookAhead(lookAhead)
+        , Slow(slow)
+    {}
+
+    TPCMEngine::TProcessLambda GetLambda() {
+        return [this](float* data, const TPCMEngine::ProcessMeta& meta) {
+            if (meta.Drain) {
+                Drained++;
+                return TPCMEngine::EProcessResult::PROCESSED;
+            }
+            EXPECT_EQ(data[0], Frames * Step);
+            EXPECT_EQ(data[meta.Channels - 1], Frames * Step);
+            Frames++;
+            if (Slow) {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+            return (LookAhead && Frames == 1) ? TPCMEngine::EProcessResult::LOOK_AHEAD
+                                              : TPCMEngine::EProcessResult::PROCESSED;
+        };
+    }
+
+    const size_t Step;
+    const bool LookAhead;
+    const bool Slow;
+    size_t Frames = 0;
+    size_t Drained = 0;
+};
+
+} // namespace
+
+TEST(TPCMRingEngine, ConsumersWithDifferentSteps) {
+    const size_t len = 4096 * 16;
+    TPCMRingEngine engine(4096, 2, 2, TPCMRingEngine::TReaderPtr(new TRampReader(len)));
+
+    TRampChecker fast(512, false, false);
+    TRampChecker slow(1024, false, true);
+    TRampChecker lookAhead(2048, true, false);
+    const size_t fastId = engine.AddConsumer(fast.Step, fast.GetLambda());
+    const size_t slowId = engine.AddConsumer(slow.Step, slow.GetLambda());
+    const size_t lookAheadId = engine.AddConsumer(lookAhead.Step, lookAhead.GetLambda());
+
+    uint64_t read = 0;
+    engine.Run([&](uint64_t n) { read = n; });
+
+    EXPECT_EQ(read, len);
+    EXPECT_EQ(fast.Frames, len / 512);
+    EXPECT_EQ(slow.Frames, len / 1024);
+    EXPECT_EQ(lookAhead.Frames, len / 2048);
+    EXPECT_EQ(fast.Drained, 0u);
+    EXPECT_EQ(slow.Drained, 0u);
+    // The look-ahead frame is flushed with the last block
+    EXPECT_EQ(lookAhead.Drained, 1u);
+
+    EXPECT_EQ(engine.GetStat(fastId).Processed, len);
+    EXPECT_EQ(engine.GetStat(slowId).Processed, len);
+    EXPECT_EQ(engine.GetStat(lookAheadId).Processed, len);
+}
+
+TEST(TPCMRingEngine, ConsumerError) {
+    TPCMRingEngine engine(4096, 1, 2, TPCMRingEngine::TReaderPtr(new TRampReader(4096 * 16)));
+
+    TRampChecker ok(1024, false, false);
+    size_t calls = 0;
+    engine.AddConsumer(ok.Step, ok.GetLambda());
+    engine.AddConsumer(2048, [&](float*, const TPCMEngine::ProcessMeta&) {
+        if (++calls == 3)
+            throw std::runtime_error("consumer error");
+        return TPCMEngine::EProcessResult::PROCESSED;
+    });
+
+    EXPECT_THROW(engine.Run(), std::runtime_error);
+    EXPECT_EQ(calls, 3u);
+}
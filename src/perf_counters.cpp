@@ -0,0 +1,157 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include "perf_counters.h"
+
+#include <cstring>
+#include <mutex>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace NAtracDEnc {
+
+std::atomic<bool> TPerfCounters::Enabled{false};
+
+namespace {
+
+std::atomic<uint32_t> Available{0};
+std::mutex ErrorMutex;
+std::string Error;
+
+void SetError(const std::string& error) {
+    std::lock_guard<std::mutex> lock(ErrorMutex);
+    if (Error.empty()) {
+        Error = error;
+    }
+}
+
+#ifdef __linux__
+
+const uint64_t Configs[TPerfCounters::NumCounters] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+// Counters of one thread are opened as a group, so they are scheduled on the
+// PMU together and one read() returns all of them
+class TThreadCounters {
+public:
+    TThreadCounters() {
+        for (size_t i = 0; i < TPerfCounters::NumCounters; i++) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = Configs[i];
+            attr.disabled = Leader < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            const int fd = syscall(__NR_perf_event_open, &attr, 0, -1, Leader, 0);
+            if (fd < 0) {
+                SetError(std::string(TPerfCounters::GetName(static_cast<ECounter>(i))) + ": " + strerror(errno));
+                continue;
+            }
+            if (Leader < 0) {
+                Leader = fd;
+            }
+            Fds[NumOpened] = fd;
+            Index[NumOpened++] = i;
+        }
+        if (Leader >= 0) {
+            ioctl(Leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(Leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            uint32_t mask = 0;
+            for (size_t i = 0; i < NumOpened; i++) {
+                mask |= 1u << Index[i];
+            }
+            Available.fetch_or(mask, std::memory_order_relaxed);
+        }
+    }
+
+    ~TThreadCounters() {
+        for (size_t i = 0; i < NumOpened; i++) {
+            close(Fds[i]);
+        }
+    }
+
+    void Read(TPerfCounters::TValues& values) const {
+        values.fill(0);
+        if (Leader < 0) {
+            return;
+        }
+        // PERF_FORMAT_GROUP: number of counters followed by their values in the open order
+        uint64_t buf[1 + TPerfCounters::NumCounters];
+        if (read(Leader, buf, sizeof(buf)) < static_cast<ssize_t>(sizeof(uint64_t) * (1 + NumOpened))) {
+            return;
+        }
+        for (size_t i = 0; i < NumOpened && i < buf[0]; i++) {
+            values[Index[i]] = buf[1 + i];
+        }
+    }
+
+private:
+    int Leader = -1;
+    int Fds[TPerfCounters::NumCounters];
+    size_t Index[TPerfCounters::NumCounters];
+    size_t NumOpened = 0;
+};
+
+#endif
+
+} // namespace
+
+void TPerfCounters::Read(TValues& values) noexcept {
+#ifdef __linux__
+    thread_local TThreadCounters counters;
+    counters.Read(values);
+#else
+    static std::once_flag once;
+    std::call_once(once, []() { SetError("hardware counters are supported on Linux only"); });
+    values.fill(0);
+#endif
+}
+
+uint32_t TPerfCounters::GetAvailable() noexcept {
+    return Available.load(std::memory_order_relaxed);
+}
+
+std::string TPerfCounters::GetError() {
+    std::lock_guard<std::mutex> lock(ErrorMutex);
+    return Error;
+}
+
+const char* TPerfCounters::GetName(ECounter counter) noexcept {
+    switch (counter) {
+        case ECounter::Cycles: return "cycles";
+        case ECounter::Instructions: return "instructions";
+        case ECounter::CacheMisses: return "cache_misses";
+        case ECounter::BranchMisses: return "branch_misses";
+        default: return "unknown";
+    }
+}
+
+} // namespace NAtracDEnc
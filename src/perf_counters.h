@@ -0,0 +1,62 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace NAtracDEnc {
+
+enum class ECounter : uint8_t {
+    Cycles,
+    Instructions,
+    CacheMisses,
+    BranchMisses,
+    Count
+};
+
+// Hardware counters of the calling thread (Linux perf_event_open). Every thread
+// opens its own counters on the first read and closes them at exit. A counter
+// which can not be opened (no PMU in a VM, perf_event_paranoid, seccomp in a
+// container, other OS) reads as zero, encoding is not affected.
+class TPerfCounters {
+public:
+    static constexpr size_t NumCounters = static_cast<size_t>(ECounter::Count);
+    using TValues = std::array<uint64_t, NumCounters>;
+
+    static void Enable(bool enable = true) noexcept { Enabled.store(enable, std::memory_order_relaxed); }
+    static bool IsEnabled() noexcept { return Enabled.load(std::memory_order_relaxed); }
+
+    // Current values for the calling thread, costs a syscall
+    static void Read(TValues& values) noexcept;
+
+    // Set of counters opened on at least one thread, bit per ECounter
+    static uint32_t GetAvailable() noexcept;
+    // Reason why a counter was not opened, empty if all of them were
+    static std::string GetError();
+    static const char* GetName(ECounter counter) noexcept;
+
+private:
+    static std::atomic<bool> Enabled;
+};
+
+} // namespace NAtracDEnc
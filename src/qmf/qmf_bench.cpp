@@ -0,0 +1,63 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "qmf.h"
+#include <bench_signal.h>
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+using namespace NAtracDEnc;
+
+namespace {
+
+// One split of the ATRAC1 and ATRAC3 band splitting trees, the first one takes 512 or 1024 samples
+template<size_t N>
+void BM_QmfAnalysis(benchmark::State& state) {
+    const std::vector<float> in = GenSignal(ESignal::PinkNoise, N, 1);
+    std::vector<float> lower(N / 2);
+    std::vector<float> upper(N / 2);
+    TQmf<N> qmf;
+    for (auto _ : state) {
+        qmf.Analysis(in.data(), lower.data(), upper.data());
+        benchmark::DoNotOptimize(lower.data());
+        benchmark::DoNotOptimize(upper.data());
+    }
+    state.SetItemsProcessed(state.iterations() * N);
+}
+
+template<size_t N>
+void BM_QmfSynthesis(benchmark::State& state) {
+    const std::vector<float> lower = GenSignal(ESignal::PinkNoise, N / 2, 1);
+    const std::vector<float> upper = GenSignal(ESignal::WhiteNoise, N / 2, 1);
+    std::vector<float> out(N);
+    TQmf<N> qmf;
+    for (auto _ : state) {
+        qmf.Synthesis(out.data(), lower.data(), upper.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * N);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_QmfAnalysis, 512);
+BENCHMARK_TEMPLATE(BM_QmfAnalysis, 1024);
+BENCHMARK_TEMPLATE(BM_QmfSynthesis, 512);
+BENCHMARK_TEMPLATE(BM_QmfSynthesis, 1024);
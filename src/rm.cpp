@@ -184,12 +184,16 @@ public:
     }
 
     void WriteFrame(std::vector<char> data) override {
-        static std::vector<char> tmp(data.size());
-        scramble_data(&data[0], &tmp[0], data.size());
-        WriteAudioPacket(tmp);
+        Scrambled_.resize(data.size());
+        scramble_data(&data[0], &Scrambled_[0], data.size());
+        WriteAudioPacket(Scrambled_);
         FrameNum_++;
     }
 
+    void Flush() override {
+        fflush(File_);
+    }
+
     std::string GetName() const override {
         return {};
     }
@@ -206,6 +210,7 @@ private:
     uint32_t FrameNum_;
 
     int64_t DataHeaderPos_;
+    std::vector<char> Scrambled_;
 
     void WriteAudioPacket(const std::vector<char>& data) {
 	switch (FrameNum_ % 3) {
@@ -0,0 +1,92 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+#include "compressed_io.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace NAtracDEnc {
+
+// Tracks runs of silent input per channel. A frame may be skipped (replaced by a
+// precomputed silent frame) when the frame and all input the encoder state still
+// depends on are silent: the filter banks, overlap buffers and detectors are at rest
+// then and processing the frame would leave them as they are.
+class TSilenceDetector {
+public:
+    // Half of the 16 bit LSB, such input does not survive on a 16 bit output
+    static constexpr float DefaultThreshold = 1.0f / 65536;
+
+    // historySz - samples before the frame the encoder state depends on
+    TSilenceDetector(size_t channels, size_t frameSz, size_t historySz, float threshold = DefaultThreshold)
+        : FrameSz(frameSz)
+        , MinRun(frameSz + historySz)
+        , Threshold(threshold)
+        , Runs(channels, 0)
+    {}
+
+    // Takes the next frame of channels interleaved with the given stride, the first
+    // channel of the detector is data[0]
+    void Push(const float* data, size_t stride) {
+        for (size_t ch = 0; ch < Runs.size(); ch++) {
+            // No early exit, the loop is branch free and vectorized for the mono input
+            bool loud = false;
+            for (size_t i = 0; i < FrameSz; i++) {
+                loud |= std::fabs(data[i * stride + ch]) > Threshold;
+            }
+            Runs[ch] = loud ? 0 : Runs[ch] + FrameSz;
+        }
+    }
+
+    bool IsSilent(size_t ch) const { return Runs[ch] >= MinRun; }
+
+    bool IsSilent() const {
+        for (size_t ch = 0; ch < Runs.size(); ch++) {
+            if (!IsSilent(ch))
+                return false;
+        }
+        return true;
+    }
+
+private:
+    const size_t FrameSz;
+    const uint64_t MinRun;
+    const float Threshold;
+    std::vector<uint64_t> Runs;
+};
+
+// Keeps written frames in memory, used to precompute silent frames
+class TFrameCapture : public ICompressedOutput {
+public:
+    explicit TFrameCapture(size_t channels)
+        : Channels(channels)
+    {}
+    void WriteFrame(std::vector<char> data) override {
+        Frames.push_back(std::move(data));
+    }
+    std::string GetName() const override { return {}; }
+    size_t GetChannelNum() const override { return Channels; }
+
+    std::vector<std::vector<char>> Frames;
+private:
+    const size_t Channels;
+};
+
+} //namespace NAtracDEnc
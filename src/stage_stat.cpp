@@ -0,0 +1,201 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "stage_stat.h"
+
+namespace NAtracDEnc {
+
+std::atomic<bool> TStageStat::Enabled{false};
+std::atomic<uint64_t> TStageStat::Calls[TStageStat::NumStages];
+std::atomic<uint64_t> TStageStat::Ns[TStageStat::NumStages];
+std::atomic<uint64_t> TStageStat::Iterations[TStageStat::NumStages];
+std::atomic<uint64_t> TStageStat::Counters[TStageStat::NumStages][TPerfCounters::NumCounters];
+std::atomic<uint64_t> TStageStat::FrameCount;
+std::atomic<uint64_t> TStageStat::FrameSum[TPerfCounters::NumCounters];
+std::atomic<uint64_t> TStageStat::FrameMax[TPerfCounters::NumCounters];
+
+thread_local TStageScope* TStageScope::Current = nullptr;
+
+void TStageStat::Reset() noexcept {
+    for (size_t i = 0; i < NumStages; i++) {
+        Calls[i].store(0, std::memory_order_relaxed);
+        Ns[i].store(0, std::memory_order_relaxed);
+        Iterations[i].store(0, std::memory_order_relaxed);
+        for (auto& counter : Counters[i]) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+    FrameCount.store(0, std::memory_order_relaxed);
+    for (size_t i = 0; i < TPerfCounters::NumCounters; i++) {
+        FrameSum[i].store(0, std::memory_order_relaxed);
+        FrameMax[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void TStageStat::Add(EStage stage, uint64_t ns) noexcept {
+    const size_t i = static_cast<size_t>(stage);
+    Calls[i].fetch_add(1, std::memory_order_relaxed);
+    Ns[i].fetch_add(ns, std::memory_order_relaxed);
+}
+
+void TStageStat::AddIterations(EStage stage, uint64_t iterations) noexcept {
+    if (IsEnabled()) {
+        Iterations[static_cast<size_t>(stage)].fetch_add(iterations, std::memory_order_relaxed);
+    }
+}
+
+void TStageStat::AddCounters(EStage stage, const TPerfCounters::TValues& counters) noexcept {
+    const size_t i = static_cast<size_t>(stage);
+    for (size_t j = 0; j < counters.size(); j++) {
+        Counters[i][j].fetch_add(counters[j], std::memory_order_relaxed);
+    }
+}
+
+void TStageStat::AddFrame(const TPerfCounters::TValues& counters) noexcept {
+    FrameCount.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < counters.size(); i++) {
+        FrameSum[i].fetch_add(counters[i], std::memory_order_relaxed);
+        uint64_t max = FrameMax[i].load(std::memory_order_relaxed);
+        while (counters[i] > max && !FrameMax[i].compare_exchange_weak(max, counters[i], std::memory_order_relaxed)) {
+        }
+    }
+}
+
+TStageStat::TFrames TStageStat::GetFrames() noexcept {
+    TFrames res;
+    res.Count = FrameCount.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < TPerfCounters::NumCounters; i++) {
+        res.Sum[i] = FrameSum[i].load(std::memory_order_relaxed);
+        res.Max[i] = FrameMax[i].load(std::memory_order_relaxed);
+    }
+    return res;
+}
+
+TStageStat::TStage TStageStat::Get(EStage stage) noexcept {
+    const size_t i = static_cast<size_t>(stage);
+    TStage res;
+    res.Calls = Calls[i].load(std::memory_order_relaxed);
+    res.Ns = Ns[i].load(std::memory_order_relaxed);
+    res.Iterations = Iterations[i].load(std::memory_order_relaxed);
+    for (size_t j = 0; j < TPerfCounters::NumCounters; j++) {
+        res.Counters[j] = Counters[i][j].load(std::memory_order_relaxed);
+    }
+    return res;
+}
+
+const char* TStageStat::GetName(EStage stage) noexcept {
+    switch (stage) {
+        case EStage::PcmRead: return "pcm_read";
+        case EStage::FilterBank: return "filter_bank";
+        case EStage::Transient: return "transient";
+        case EStage::Mdct: return "mdct";
+        case EStage::Scale: return "scale";
+        case EStage::BitAlloc: return "bit_alloc";
+        case EStage::Gha: return "gha";
+        case EStage::Bitstream: return "bitstream";
+        case EStage::Container: return "container";
+        case EStage::PcmWrite: return "pcm_write";
+        default: return "unknown";
+    }
+}
+
+void TStageStat::Print(FILE* out, bool json, double wallSeconds) {
+    uint64_t totalNs = 0;
+    for (size_t i = 0; i < NumStages; i++) {
+        totalNs += Get(static_cast<EStage>(i)).Ns;
+    }
+
+    const bool counters = TPerfCounters::IsEnabled();
+    const uint32_t available = TPerfCounters::GetAvailable();
+    const TFrames frames = GetFrames();
+
+    if (json) {
+        fprintf(out, "{\"wall_seconds\": %.6f, \"stages\": [", wallSeconds);
+        const char* sep = "";
+        for (size_t i = 0; i < NumStages; i++) {
+            const TStage s = Get(static_cast<EStage>(i));
+            if (s.Calls == 0)
+                continue;
+            fprintf(out, "%s{\"name\": \"%s\", \"calls\": %llu, \"seconds\": %.6f, \"iterations\": %llu", sep,
+                    GetName(static_cast<EStage>(i)), (unsigned long long)s.Calls, s.Ns / 1e9,
+                    (unsigned long long)s.Iterations);
+            for (size_t j = 0; counters && j < TPerfCounters::NumCounters; j++) {
+                if (available & (1u << j))
+                    fprintf(out, ", \"%s\": %llu", TPerfCounters::GetName(static_cast<ECounter>(j)),
+                            (unsigned long long)s.Counters[j]);
+            }
+            fprintf(out, "}");
+            sep = ", ";
+        }
+        fprintf(out, "]");
+        if (counters) {
+            fprintf(out, ", \"frames\": {\"count\": %llu", (unsigned long long)frames.Count);
+            for (size_t j = 0; j < TPerfCounters::NumCounters; j++) {
+                if (available & (1u << j))
+                    fprintf(out, ", \"%s\": {\"mean\": %.1f, \"max\": %llu}",
+                            TPerfCounters::GetName(static_cast<ECounter>(j)),
+                            frames.Count ? (double)frames.Sum[j] / frames.Count : 0.0,
+                            (unsigned long long)frames.Max[j]);
+            }
+            fprintf(out, "}");
+            if (available != (1u << TPerfCounters::NumCounters) - 1) {
+                fprintf(out, ", \"counters_error\": \"%s\"", TPerfCounters::GetError().c_str());
+            }
+        }
+        fprintf(out, "}\n");
+        return;
+    }
+
+    // Time is the sum over threads, so it may exceed the wall time
+    fprintf(out, "%-12s %10s %10s %7s %11s", "stage", "calls", "seconds", "share", "iterations");
+    for (size_t j = 0; counters && j < TPerfCounters::NumCounters; j++) {
+        if (available & (1u << j))
+            fprintf(out, " %14s", TPerfCounters::GetName(static_cast<ECounter>(j)));
+    }
+    fprintf(out, "\n");
+    for (size_t i = 0; i < NumStages; i++) {
+        const TStage s = Get(static_cast<EStage>(i));
+        if (s.Calls == 0)
+            continue;
+        fprintf(out, "%-12s %10llu %10.3f %6.1f%% %11llu", GetName(static_cast<EStage>(i)),
+                (unsigned long long)s.Calls, s.Ns / 1e9, totalNs ? 100.0 * s.Ns / totalNs : 0.0,
+                (unsigned long long)s.Iterations);
+        for (size_t j = 0; counters && j < TPerfCounters::NumCounters; j++) {
+            if (available & (1u << j))
+                fprintf(out, " %14llu", (unsigned long long)s.Counters[j]);
+        }
+        fprintf(out, "\n");
+    }
+    fprintf(out, "%-12s %10s %10.3f (thread time), wall %.3f s\n", "total", "", totalNs / 1e9, wallSeconds);
+
+    if (!counters)
+        return;
+    if (available != (1u << TPerfCounters::NumCounters) - 1) {
+        fprintf(out, "hardware counters are not available: %s\n", TPerfCounters::GetError().c_str());
+    }
+    if (available == 0 || frames.Count == 0)
+        return;
+    fprintf(out, "per frame (%llu frames):\n", (unsigned long long)frames.Count);
+    for (size_t j = 0; j < TPerfCounters::NumCounters; j++) {
+        if (available & (1u << j))
+            fprintf(out, "  %-14s mean %14.1f max %14llu\n", TPerfCounters::GetName(static_cast<ECounter>(j)),
+                    (double)frames.Sum[j] / frames.Count, (unsigned long long)frames.Max[j]);
+    }
+}
+
+} // namespace NAtracDEnc
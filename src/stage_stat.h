@@ -0,0 +1,195 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#include "perf_counters.h"
+#include "trace.h"
+
+namespace NAtracDEnc {
+
+// Stages of encoding and decoding measured for the --stats report
+enum class EStage : uint8_t {
+    PcmRead,
+    FilterBank, // analysis or synthesis filter bank (QMF, PQF)
+    Transient,  // transient detection and gain control analysis
+    Mdct,       // MDCT or IMDCT
+    Scale,
+    BitAlloc,   // bit allocation search, iterations are counted
+    Gha,        // tonal components search
+    Bitstream,  // packing or unpacking of the bitstream
+    Container,  // write or read of compressed frames
+    PcmWrite,
+    Count
+};
+
+// Time spent in each stage by all threads, a stage may run on several threads at once.
+// Collection is off by default, a disabled scope costs a relaxed load and a predictable branch.
+class TStageStat {
+public:
+    struct TStage {
+        uint64_t Calls = 0;
+        uint64_t Ns = 0;
+        uint64_t Iterations = 0;
+        TPerfCounters::TValues Counters{}; // with --perf-counters only
+    };
+
+    // Counters of whole frames (calls of the frame lambda)
+    struct TFrames {
+        uint64_t Count = 0;
+        TPerfCounters::TValues Sum{};
+        TPerfCounters::TValues Max{};
+    };
+
+    static void Enable(bool enable = true) noexcept { Enabled.store(enable, std::memory_order_relaxed); }
+    static bool IsEnabled() noexcept { return Enabled.load(std::memory_order_relaxed); }
+    static void Reset() noexcept;
+
+    static void Add(EStage stage, uint64_t ns) noexcept;
+    static void AddIterations(EStage stage, uint64_t iterations) noexcept;
+    static void AddCounters(EStage stage, const TPerfCounters::TValues& counters) noexcept;
+    static void AddFrame(const TPerfCounters::TValues& counters) noexcept;
+    static TStage Get(EStage stage) noexcept;
+    static TFrames GetFrames() noexcept;
+    static const char* GetName(EStage stage) noexcept;
+
+    // Human readable table or JSON, wallSeconds - duration of the whole run
+    static void Print(FILE* out, bool json, double wallSeconds);
+
+private:
+    static constexpr size_t NumStages = static_cast<size_t>(EStage::Count);
+    static std::atomic<bool> Enabled;
+    static std::atomic<uint64_t> Calls[NumStages];
+    static std::atomic<uint64_t> Ns[NumStages];
+    static std::atomic<uint64_t> Iterations[NumStages];
+    static std::atomic<uint64_t> Counters[NumStages][TPerfCounters::NumCounters];
+    static std::atomic<uint64_t> FrameCount;
+    static std::atomic<uint64_t> FrameSum[TPerfCounters::NumCounters];
+    static std::atomic<uint64_t> FrameMax[TPerfCounters::NumCounters];
+};
+
+// Measures the scope as the given stage. Time of the scopes nested on the same
+// thread goes to their own stages only, the same for hardware counters. With --trace
+// the scope is also recorded as a trace event
+class TStageScope {
+public:
+    explicit TStageScope(EStage stage) noexcept
+        : Stage(stage)
+        , Active(TStageStat::IsEnabled())
+        , Traced(TTrace::IsEnabled())
+        , Counted(Active && TPerfCounters::IsEnabled())
+    {
+        if (Active) {
+            Parent = Current;
+            Current = this;
+        }
+        if (Counted) {
+            TPerfCounters::Read(StartCounters);
+        }
+        if (Active || Traced) {
+            Start = TClock::now();
+        }
+    }
+
+    ~TStageScope() {
+        if (!Active && !Traced) {
+            return;
+        }
+        const TClock::time_point end = TClock::now();
+        if (Active) {
+            const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - Start).count();
+            Current = Parent;
+            if (Parent) {
+                Parent->ChildNs += ns;
+            }
+            TStageStat::Add(Stage, ns - ChildNs);
+        }
+        if (Counted) {
+            TPerfCounters::TValues counters;
+            TPerfCounters::Read(counters);
+            for (size_t i = 0; i < counters.size(); i++) {
+                counters[i] -= StartCounters[i];
+                if (Parent) {
+                    Parent->ChildCounters[i] += counters[i];
+                }
+                counters[i] -= ChildCounters[i];
+            }
+            TStageStat::AddCounters(Stage, counters);
+        }
+        if (Traced) {
+            TTrace::Add(TStageStat::GetName(Stage), Start, end);
+        }
+    }
+
+    TStageScope(const TStageScope&) = delete;
+    TStageScope& operator=(const TStageScope&) = delete;
+
+private:
+    using TClock = TTrace::TClock;
+    static thread_local TStageScope* Current;
+
+    const EStage Stage;
+    const bool Active;
+    const bool Traced;
+    const bool Counted;
+    TStageScope* Parent = nullptr;
+    TClock::time_point Start;
+    uint64_t ChildNs = 0;
+    TPerfCounters::TValues StartCounters{};
+    TPerfCounters::TValues ChildCounters{};
+};
+
+// Processing of one frame by the frame lambda: a trace event with the frame
+// number and, with --perf-counters, the hardware counters of the whole frame
+class TFrameScope {
+public:
+    explicit TFrameScope(uint64_t frame) noexcept
+        : Trace("frame", static_cast<int64_t>(frame))
+        , Counted(TStageStat::IsEnabled() && TPerfCounters::IsEnabled())
+    {
+        if (Counted) {
+            TPerfCounters::Read(StartCounters);
+        }
+    }
+
+    ~TFrameScope() {
+        if (Counted) {
+            TPerfCounters::TValues counters;
+            TPerfCounters::Read(counters);
+            for (size_t i = 0; i < counters.size(); i++) {
+                counters[i] -= StartCounters[i];
+            }
+            TStageStat::AddFrame(counters);
+        }
+    }
+
+    TFrameScope(const TFrameScope&) = delete;
+    TFrameScope& operator=(const TFrameScope&) = delete;
+
+private:
+    TTraceScope Trace;
+    const bool Counted;
+    TPerfCounters::TValues StartCounters{};
+};
+
+} // namespace NAtracDEnc
@@ -0,0 +1,92 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "stage_stat.h"
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace NAtracDEnc;
+
+TEST(TStageStat, NestedScopesAreExclusive) {
+    TStageStat::Reset();
+    TStageStat::Enable();
+    {
+        TStageScope outer(EStage::BitAlloc);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        for (int i = 0; i < 2; i++) {
+            TStageScope inner(EStage::Bitstream);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        TStageStat::AddIterations(EStage::BitAlloc, 7);
+    }
+    TStageStat::Enable(false);
+
+    const TStageStat::TStage bitAlloc = TStageStat::Get(EStage::BitAlloc);
+    const TStageStat::TStage bitstream = TStageStat::Get(EStage::Bitstream);
+    EXPECT_EQ(1u, bitAlloc.Calls);
+    EXPECT_EQ(7u, bitAlloc.Iterations);
+    EXPECT_EQ(2u, bitstream.Calls);
+    EXPECT_GE(bitstream.Ns, 40000000u);
+    EXPECT_GE(bitAlloc.Ns, 5000000u);
+    // Time of the nested scopes is not counted twice
+    EXPECT_LT(bitAlloc.Ns, 40000000u);
+}
+
+TEST(TStageStat, DisabledScopesAreNotCounted) {
+    TStageStat::Reset();
+    {
+        TStageScope stage(EStage::Mdct);
+        TStageStat::AddIterations(EStage::Mdct, 1);
+    }
+    const TStageStat::TStage mdct = TStageStat::Get(EStage::Mdct);
+    EXPECT_EQ(0u, mdct.Calls);
+    EXPECT_EQ(0u, mdct.Iterations);
+}
+
+TEST(TStageStat, PerfCountersOrError) {
+    TStageStat::Reset();
+    TStageStat::Enable();
+    TPerfCounters::Enable();
+    volatile uint64_t sum = 0;
+    {
+        TFrameScope frame(0);
+        TStageScope outer(EStage::Scale);
+        for (int i = 0; i < 100000; i++) {
+            sum = sum + i;
+        }
+        TStageScope inner(EStage::Mdct);
+    }
+    TPerfCounters::Enable(false);
+    TStageStat::Enable(false);
+
+    const size_t instructions = static_cast<size_t>(ECounter::Instructions);
+    const TStageStat::TFrames frames = TStageStat::GetFrames();
+    EXPECT_EQ(1u, frames.Count);
+    if (TPerfCounters::GetAvailable() & (1u << instructions)) {
+        const TStageStat::TStage scale = TStageStat::Get(EStage::Scale);
+        const TStageStat::TStage mdct = TStageStat::Get(EStage::Mdct);
+        EXPECT_GE(scale.Counters[instructions], 100000u);
+        EXPECT_LT(mdct.Counters[instructions], scale.Counters[instructions]);
+        EXPECT_GE(frames.Max[instructions], scale.Counters[instructions] + mdct.Counters[instructions]);
+    } else {
+        // Counters are not permitted here, encoding must go on without them
+        EXPECT_FALSE(TPerfCounters::GetError().empty());
+        EXPECT_EQ(0u, TStageStat::Get(EStage::Scale).Counters[instructions]);
+    }
+}
@@ -0,0 +1,120 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include "trace.h"
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace NAtracDEnc {
+
+namespace {
+
+struct TEvent {
+    const char* Name;
+    int64_t Frame;
+    int64_t StartNs;
+    int64_t DurNs;
+};
+
+struct TThreadBuffer {
+    explicit TThreadBuffer(size_t tid)
+        : Tid(tid)
+    {
+        Events.reserve(1 << 12);
+    }
+
+    const size_t Tid;
+    std::vector<TEvent> Events;
+};
+
+// The lock is taken once per thread, when its buffer is created
+std::mutex BuffersMutex;
+std::vector<std::unique_ptr<TThreadBuffer>> Buffers;
+
+TThreadBuffer* GetThreadBuffer() {
+    thread_local TThreadBuffer* buffer = nullptr;
+    if (!buffer) {
+        std::lock_guard<std::mutex> lock(BuffersMutex);
+        Buffers.emplace_back(new TThreadBuffer(Buffers.size()));
+        buffer = Buffers.back().get();
+    }
+    return buffer;
+}
+
+int64_t ToNs(TTrace::TClock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+void WriteEscaped(FILE* out, const char* str) {
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fputc('\\', out);
+        }
+        fputc(*str, out);
+    }
+}
+
+} // namespace
+
+std::atomic<bool> TTrace::Enabled{false};
+TTrace::TClock::time_point TTrace::Epoch;
+
+void TTrace::Enable() {
+    Epoch = TClock::now();
+    Enabled.store(true, std::memory_order_relaxed);
+}
+
+void TTrace::Add(const char* name, TClock::time_point start, TClock::time_point end, int64_t frame) {
+    GetThreadBuffer()->Events.push_back({name, frame, ToNs(start - Epoch), ToNs(end - start)});
+}
+
+bool TTrace::Write(const std::string& path) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(BuffersMutex);
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    for (const auto& buffer : Buffers) {
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"thread %zu\"}}",
+            first ? "" : ",\n", buffer->Tid, buffer->Tid);
+        first = false;
+        for (const TEvent& ev : buffer->Events) {
+            fprintf(out, ",\n{\"name\":\"");
+            WriteEscaped(out, ev.Name);
+            fprintf(out, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f",
+                buffer->Tid, ev.StartNs / 1000.0, ev.DurNs / 1000.0);
+            if (ev.Frame >= 0) {
+                fprintf(out, ",\"args\":{\"frame\":%lld}", static_cast<long long>(ev.Frame));
+            }
+            fputc('}', out);
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+    const bool ok = !ferror(out);
+    return fclose(out) == 0 && ok;
+}
+
+} // namespace NAtracDEnc
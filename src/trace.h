@@ -0,0 +1,82 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace NAtracDEnc {
+
+// Collects complete events ("ph":"X") of the Chrome trace event format, the
+// result can be opened in Perfetto or chrome://tracing. Every thread appends to
+// its own buffer without locking, the buffers are kept until Write, so threads
+// may exit before the trace is written.
+class TTrace {
+public:
+    using TClock = std::chrono::steady_clock;
+
+    // Starts collection, timestamps are counted from this call
+    static void Enable();
+    static bool IsEnabled() noexcept { return Enabled.load(std::memory_order_relaxed); }
+
+    // name must be a string literal or otherwise outlive the trace,
+    // arg < 0 means the event has no frame number
+    static void Add(const char* name, TClock::time_point start, TClock::time_point end, int64_t frame = -1);
+
+    // Must be called when the traced threads are idle or joined. Returns false on IO error
+    static bool Write(const std::string& path);
+
+private:
+    static std::atomic<bool> Enabled;
+    static TClock::time_point Epoch;
+};
+
+// Records the scope as one event of the current thread
+class TTraceScope {
+public:
+    explicit TTraceScope(const char* name, int64_t frame = -1) noexcept
+        : Name(name)
+        , Frame(frame)
+        , Active(TTrace::IsEnabled())
+    {
+        if (Active) {
+            Start = TTrace::TClock::now();
+        }
+    }
+
+    ~TTraceScope() {
+        if (Active) {
+            TTrace::Add(Name, Start, TTrace::TClock::now(), Frame);
+        }
+    }
+
+    TTraceScope(const TTraceScope&) = delete;
+    TTraceScope& operator=(const TTraceScope&) = delete;
+
+private:
+    const char* const Name;
+    const int64_t Frame;
+    const bool Active;
+    TTrace::TClock::time_point Start;
+};
+
+} // namespace NAtracDEnc
@@ -0,0 +1,63 @@
+/*
+ * This file is part of AtracDEnc.
+ *
+ * AtracDEnc is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * AtracDEnc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with AtracDEnc; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include "trace.h"
+#include "stage_stat.h"
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+using namespace NAtracDEnc;
+
+static size_t CountOf(const std::string& str, const std::string& what) {
+    size_t n = 0;
+    for (size_t pos = str.find(what); pos != std::string::npos; pos = str.find(what, pos + 1)) {
+        n++;
+    }
+    return n;
+}
+
+TEST(TTrace, EventsOfAllThreadsAreWritten) {
+    TTrace::Enable();
+    {
+        TTraceScope frame("frame", 3);
+        TStageScope stage(EStage::Mdct);
+    }
+    std::thread worker([]() {
+        TTraceScope frame("frame", 4);
+    });
+    worker.join();
+
+    const std::string path = "trace_ut.json";
+    ASSERT_TRUE(TTrace::Write(path));
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    const std::string trace = ss.str();
+    remove(path.c_str());
+
+    EXPECT_EQ(0u, trace.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+    EXPECT_EQ(1u, CountOf(trace, "\"name\":\"mdct\",\"ph\":\"X\""));
+    EXPECT_EQ(1u, CountOf(trace, "\"args\":{\"frame\":3}"));
+    EXPECT_EQ(1u, CountOf(trace, "\"args\":{\"frame\":4}"));
+    EXPECT_GE(CountOf(trace, "\"name\":\"thread_name\""), 2u);
+}